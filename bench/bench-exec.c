@@ -0,0 +1,136 @@
+/* Runs a command repeatedly and reports how long it took.
+ *
+ * Usage: bench-exec [-n ITERATIONS] [-s SETUP] COMMAND [ARG...]
+ *
+ * SETUP is a shell command run before every iteration and not timed,
+ * e.g. to recreate the home directory for first-run measurements.
+ * Prints the minimum and median wall time in milliseconds and the
+ * peak RSS of the command in kilobytes, separated by spaces, for
+ * run-bench.sh to pick up. The command's own output is discarded.
+ */
+
+#include <config.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+static double
+now (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int
+compare_double (const void *a, const void *b)
+{
+  double da = *(const double *) a, db = *(const double *) b;
+
+  return (da > db) - (da < db);
+}
+
+/* Returns the wall time in seconds, or a negative value on failure */
+static double
+run_once (char **argv, long *max_rss)
+{
+  struct rusage usage;
+  double start, elapsed;
+  pid_t pid;
+  int status, fd;
+
+  start = now ();
+  pid = fork ();
+  if (pid < 0)
+    return -1;
+
+  if (pid == 0)
+    {
+      fd = open ("/dev/null", O_WRONLY);
+      if (fd >= 0)
+        {
+          dup2 (fd, 1);
+          dup2 (fd, 2);
+          close (fd);
+        }
+      execvp (argv[0], argv);
+      _exit (127);
+    }
+
+  while (wait4 (pid, &status, 0, &usage) < 0)
+    if (errno != EINTR)
+      return -1;
+  elapsed = now () - start;
+
+  if (!WIFEXITED (status) || WEXITSTATUS (status) == 127)
+    return -1;
+
+  if (usage.ru_maxrss > *max_rss)
+    *max_rss = usage.ru_maxrss;
+  return elapsed;
+}
+
+int
+main (int argc, char *argv[])
+{
+  const char *setup = NULL;
+  double *times;
+  long max_rss = 0;
+  int iterations = 10;
+  int opt, i;
+
+  while ((opt = getopt (argc, argv, "+n:s:")) != -1)
+    {
+      switch (opt)
+        {
+        case 'n':
+          iterations = atoi (optarg);
+          break;
+        case 's':
+          setup = optarg;
+          break;
+        default:
+          return 2;
+        }
+    }
+
+  if (optind == argc || iterations < 1)
+    {
+      fprintf (stderr, "Usage: %s [-n ITERATIONS] [-s SETUP] COMMAND [ARG...]\n", argv[0]);
+      return 2;
+    }
+
+  times = calloc (iterations, sizeof (double));
+  if (times == NULL)
+    return 1;
+
+  for (i = 0; i < iterations; i++)
+    {
+      if (setup != NULL && system (setup) != 0)
+        {
+          fprintf (stderr, "%s: setup failed: %s\n", argv[0], setup);
+          return 1;
+        }
+
+      times[i] = run_once (argv + optind, &max_rss);
+      if (times[i] < 0)
+        {
+          fprintf (stderr, "%s: failed to run %s\n", argv[0], argv[optind]);
+          return 1;
+        }
+    }
+
+  qsort (times, iterations, sizeof (double), compare_double);
+  printf ("%.3f %.3f %ld\n", times[0] * 1e3, times[iterations / 2] * 1e3, max_rss);
+
+  free (times);
+  return 0;
+}
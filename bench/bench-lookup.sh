@@ -0,0 +1,115 @@
+#!/bin/sh
+# Compares builds of xdg-user-dir, e.g. one linked against GLib and
+# one built with --enable-static-lookup.
+#
+# Usage: bench-lookup.sh LOOKUP...
+#
+# First checks that all of them print the same, in every output format,
+# for a single type, several types and --all, with user-dirs.dirs read
+# directly, with a snapshot in $XDG_RUNTIME_DIR and without $HOME. Then
+# times each from exec to exit on a single lookup and on --all, and on
+# a single lookup with XDG_DESKTOP_DIR set, as exported to the session
+# by xdg-user-dirs-update --env-generator.
+#
+# Each result is printed as one JSON object per line, like run-bench.sh
+# does. Wall times are in milliseconds and the peak RSS in kilobytes.
+#
+# Environment:
+#   BENCH_EXEC        the bench-exec helper (default: ./bench-exec)
+#   BENCH_ITERATIONS  runs per measurement (default: 200)
+#   UPDATE            xdg-user-dirs-update, to create the snapshot with
+#                     --set; without it, only user-dirs.dirs is read
+
+set -e
+
+if test $# -lt 1; then
+	echo "Usage: $0 LOOKUP..." >&2
+	exit 2
+fi
+
+BENCH_EXEC=${BENCH_EXEC:-./bench-exec}
+BENCH_ITERATIONS=${BENCH_ITERATIONS:-200}
+
+commit=`cd "\`dirname "$0"\`" && git rev-parse --short HEAD 2>/dev/null || echo unknown`
+
+tmpdir=`mktemp -d "${TMPDIR:-/tmp}/xdg-user-dirs-bench.XXXXXX"`
+trap 'rm -rf "$tmpdir"' EXIT
+trap 'exit 1' HUP INT TERM
+
+HOME="$tmpdir/home"
+XDG_CONFIG_HOME="$HOME/.config"
+XDG_RUNTIME_DIR="$tmpdir/run"
+export HOME XDG_CONFIG_HOME XDG_RUNTIME_DIR
+unset XDG_CONFIG_DIRS XDG_DATA_DIRS
+unset XDG_DESKTOP_DIR XDG_DOWNLOAD_DIR XDG_TEMPLATES_DIR XDG_PUBLICSHARE_DIR XDG_DOCUMENTS_DIR XDG_MUSIC_DIR XDG_PICTURES_DIR XDG_VIDEOS_DIR
+mkdir -p "$XDG_CONFIG_HOME"
+mkdir -m 700 "$XDG_RUNTIME_DIR"
+
+# Absolute, relative and escaped paths, and an application directory
+cat > "$XDG_CONFIG_HOME/user-dirs.dirs" <<EOF
+XDG_DESKTOP_DIR="\$HOME/Desktop"
+XDG_DOWNLOAD_DIR="\$HOME/Downloads"
+XDG_TEMPLATES_DIR="\$HOME/"
+XDG_PUBLICSHARE_DIR="/srv/Public"
+XDG_DOCUMENTS_DIR="\$HOME/Documents"
+XDG_MUSIC_DIR="\$HOME/Music \\\$5 \\\`x\\\` \\\\"
+XDG_PICTURES_DIR="\$HOME/Pictures"
+XDG_VIDEOS_DIR="\$HOME/Vid\"eos"
+org.example.App.desktop="\$HOME/Documents/App"
+EOF
+
+# check DESCRIPTION: runs every LOOKUP with the remaining arguments and
+# fails if the output or exit status of any of them differs from the
+# first one's. Errors name the program, so they aren't compared.
+check ()
+{
+	description=$1
+	shift
+	n=0
+	for lookup in $lookups; do
+		n=`expr $n + 1`
+		"$lookup" "$@" > "$tmpdir/out$n" 2>/dev/null || echo "exit $?" >> "$tmpdir/out$n"
+		if ! cmp -s "$tmpdir/out1" "$tmpdir/out$n"; then
+			echo "$0: $lookup prints something else for $description: $*" >&2
+			diff "$tmpdir/out1" "$tmpdir/out$n" >&2 || true
+			exit 1
+		fi
+	done
+}
+
+check_all ()
+{
+	for format in lines nul json export; do
+		check "$1" --format=$format DESKTOP
+		check "$1" --format=$format MUSIC VIDEOS NOPE org.example.App.desktop
+		check "$1" --format=$format --all
+	done
+	check "$1" TEMPLATES PUBLICSHARE
+	check "$1" --format=nope DESKTOP
+	check "$1"
+}
+
+lookups="$*"
+check_all "user-dirs.dirs"
+if test -n "$UPDATE"; then
+	"$UPDATE" --set DESKTOP "$HOME/Desktop" >/dev/null
+	check_all "the snapshot"
+fi
+(unset HOME; check_all "no \$HOME")
+
+# measure MODE LOOKUP [ARG...]
+measure ()
+{
+	mode=$1
+	shift
+
+	set -- `"$BENCH_EXEC" -n "$BENCH_ITERATIONS" "$@"` "$@"
+	printf '{"commit":"%s","mode":"%s","lookup":"%s","iterations":%s,"wall_ms_min":%s,"wall_ms_median":%s,"max_rss_kb":%s}\n' \
+		"$commit" "$mode" "$4" "$BENCH_ITERATIONS" "$1" "$2" "$3"
+}
+
+for lookup in $lookups; do
+	measure lookup "$lookup" DESKTOP
+	measure lookup-all "$lookup" --all
+	XDG_DESKTOP_DIR="$HOME/Desktop" measure lookup-env "$lookup" DESKTOP
+done
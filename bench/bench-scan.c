@@ -0,0 +1,147 @@
+/* Microbenchmark for the string scanners.
+ *
+ * user_dirs_escape(), user_dirs_unescape() and user_dirs_is_ascii()
+ * skip over ordinary bytes 16 at a time where SSE2 is available. They
+ * are timed against the byte by byte loops they replaced on typical
+ * paths and a long one. That both give the same results is checked by
+ * tests/test-tokenizer.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "user-dirs-tokenizer.h"
+
+static double
+now (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static size_t
+reference_escape (const char *str, size_t len, char *dest)
+{
+  char *d = dest;
+  size_t i;
+
+  for (i = 0; i < len; i++)
+    {
+      if (str[i] == '$' || str[i] == '`' || str[i] == '\\')
+        *d++ = '\\';
+      *d++ = str[i];
+    }
+  *d = 0;
+  return d - dest;
+}
+
+static size_t
+reference_unescape (const char *s, size_t len, char *dest)
+{
+  const char *end = s + len;
+  char *d = dest;
+
+  while (s < end)
+    {
+      if (*s == '\\' && s + 1 < end)
+        s++;
+      *d++ = *s++;
+    }
+  *d = 0;
+  return d - dest;
+}
+
+static int
+reference_is_ascii (const char *str, size_t len)
+{
+  size_t i;
+
+  for (i = 0; i < len; i++)
+    if ((unsigned char) str[i] > 127)
+      return 0;
+  return 1;
+}
+
+static void
+run_bench (const char *name, const char *str)
+{
+  char *escaped, *unescaped;
+  UserDirsSlice slice;
+  size_t len, escaped_len, total;
+  double start, times[6];
+  int rounds, r;
+
+  len = strlen (str);
+  escaped = malloc (len * 2 + 1);
+  unescaped = malloc (len * 2 + 1);
+  escaped_len = reference_escape (str, len, escaped);
+  slice.str = escaped;
+  slice.len = escaped_len;
+  rounds = 20000000 / (len + 16);
+  total = 0;
+
+  start = now ();
+  for (r = 0; r < rounds; r++)
+    total += reference_escape (str, len, escaped);
+  times[0] = now () - start;
+  start = now ();
+  for (r = 0; r < rounds; r++)
+    total += user_dirs_escape (str, len, escaped);
+  times[1] = now () - start;
+
+  start = now ();
+  for (r = 0; r < rounds; r++)
+    total += reference_unescape (escaped, escaped_len, unescaped);
+  times[2] = now () - start;
+  start = now ();
+  for (r = 0; r < rounds; r++)
+    total += user_dirs_unescape (&slice, unescaped);
+  times[3] = now () - start;
+
+  start = now ();
+  for (r = 0; r < rounds; r++)
+    total += reference_is_ascii (str, len);
+  times[4] = now () - start;
+  start = now ();
+  for (r = 0; r < rounds; r++)
+    total += user_dirs_is_ascii (str, len);
+  times[5] = now () - start;
+
+  printf ("%-8s %6zu", name, len);
+  for (r = 0; r < 6; r++)
+    printf (" %9.1f", times[r] * 1e9 / rounds);
+  printf ("\n");
+
+  if (total == 0)
+    exit (1);
+  free (unescaped);
+  free (escaped);
+}
+
+int
+main (void)
+{
+  char *long_path;
+  int i;
+
+  long_path = malloc (4097);
+  for (i = 0; i < 4096; i++)
+    long_path[i] = i % 64 == 63 ? '/' : 'a' + i % 26;
+  long_path[4096] = 0;
+
+  /* Nanoseconds per call, byte by byte and with the scanners */
+  printf ("%-8s %6s %9s %9s %9s %9s %9s %9s\n", "path", "bytes",
+          "escape", "scanner", "unescape", "scanner", "is_ascii", "scanner");
+  run_bench ("short", "Music");
+  run_bench ("typical", "Documents/Projects/xdg-user-dirs");
+  run_bench ("escaped", "Price $5/`cmd`/back\\slash/Documents");
+  run_bench ("long", long_path);
+
+  free (long_path);
+  return 0;
+}
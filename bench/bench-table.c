@@ -0,0 +1,285 @@
+/* Scaling benchmark for the directory tables.
+ *
+ * Times filling a table with 10 to 10000 directories and looking up
+ * each of them once, which is what loading the defaults and
+ * create_default_dirs() do. The same work done with a GList and
+ * linear lookups, as the tables used to be, is shown for comparison;
+ * it grows quadratically.
+ *
+ * Then times sorting nested directories parents first, and moving one
+ * of the top level ones, as create_default_dirs() does after a rename.
+ * Sorting used to compare with a prefix test and g_utf8_collate(), and
+ * the move to scan all directories for the old path; both are shown
+ * next to the trie, and the orders are checked to agree on parents.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+
+#include "user-dirs-table.h"
+#include "user-dirs-trie.h"
+
+static int
+compare_dir_name (const Directory *dir, const char *name)
+{
+  return strcmp (dir->name, name);
+}
+
+static double
+run_list (char **names, guint n)
+{
+  UserDirsArena *arena;
+  GList *list = NULL, *l;
+  GTimer *timer;
+  double elapsed;
+  guint i;
+
+  arena = user_dirs_arena_new ();
+  timer = g_timer_new ();
+  for (i = 0; i < n; i++)
+    if (g_list_find_custom (list, names[i], (GCompareFunc) compare_dir_name) == NULL)
+      list = g_list_append (list, directory_new (arena, names[i], names[i]));
+  for (i = 0; i < n; i++)
+    {
+      l = g_list_find_custom (list, names[i], (GCompareFunc) compare_dir_name);
+      g_assert (l != NULL);
+    }
+  elapsed = g_timer_elapsed (timer, NULL);
+
+  g_timer_destroy (timer);
+  g_list_free (list);
+  user_dirs_arena_free (arena);
+  return elapsed;
+}
+
+static double
+run_table (char **names, guint n)
+{
+  UserDirsArena *arena;
+  UserDirsTable *table;
+  GTimer *timer;
+  double elapsed;
+  guint i;
+
+  arena = user_dirs_arena_new ();
+  timer = g_timer_new ();
+  table = user_dirs_table_new (arena);
+  for (i = 0; i < n; i++)
+    if (user_dirs_table_lookup (table, names[i]) == NULL)
+      user_dirs_table_add (table, directory_new (arena, names[i], names[i]));
+  for (i = 0; i < n; i++)
+    g_assert (user_dirs_table_lookup (table, names[i]) != NULL);
+  elapsed = g_timer_elapsed (timer, NULL);
+
+  g_timer_destroy (timer);
+  user_dirs_table_free (table);
+  user_dirs_arena_free (arena);
+  return elapsed;
+}
+
+static int
+prefix_collate_compare (gconstpointer a, gconstpointer b)
+{
+  const Directory *dir_a = a;
+  const Directory *dir_b = b;
+
+  if (g_str_has_prefix (dir_a->path, dir_b->path))
+    return 1;
+  if (g_str_has_prefix (dir_b->path, dir_a->path))
+    return -1;
+  return g_utf8_collate (dir_a->path, dir_b->path);
+}
+
+/* Vendor directories with subdirectories with leaves, in an order
+ * that isn't sorted already
+ */
+static UserDirsTable *
+nested_table (UserDirsArena *arena, guint n)
+{
+  UserDirsTable *table;
+  char *name, *path;
+  guint i, seed;
+
+  table = user_dirs_table_new (arena);
+  for (i = 0; i < n; i++)
+    {
+      seed = (i * 2654435761u) % n;
+      name = g_strdup_printf ("DIR%u", i);
+      if (seed % 10 == 0)
+        path = g_strdup_printf ("Vendor %u", seed / 100);
+      else if (seed % 10 < 4)
+        path = g_strdup_printf ("Vendor %u/Sub %u", seed / 100, seed / 10);
+      else
+        path = g_strdup_printf ("Vendor %u/Sub %u/Leaf %u", seed / 100, seed / 10, seed);
+      user_dirs_table_add (table, directory_new (arena, name, path));
+      g_free (name);
+      g_free (path);
+    }
+
+  return table;
+}
+
+static void
+check_parents_first (UserDirsTable *table)
+{
+  GHashTable *all, *seen;
+  Directory *dir;
+  char *parent, *slash;
+  guint i;
+
+  all = g_hash_table_new (g_str_hash, g_str_equal);
+  seen = g_hash_table_new (g_str_hash, g_str_equal);
+  for (i = 0; i < user_dirs_table_size (table); i++)
+    g_hash_table_add (all, user_dirs_table_index (table, i)->path);
+
+  for (i = 0; i < user_dirs_table_size (table); i++)
+    {
+      dir = user_dirs_table_index (table, i);
+      g_hash_table_add (seen, dir->path);
+      parent = g_strdup (dir->path);
+      while ((slash = strrchr (parent, '/')) != NULL)
+        {
+          *slash = 0;
+          /* Parents that are in the table must have come earlier */
+          if (g_hash_table_contains (all, parent))
+            g_assert (g_hash_table_contains (seen, parent));
+        }
+      g_free (parent);
+    }
+
+  g_hash_table_destroy (seen);
+  g_hash_table_destroy (all);
+}
+
+static double
+run_sort (guint n, gboolean trie)
+{
+  UserDirsArena *arena;
+  UserDirsTable *table;
+  GTimer *timer;
+  double elapsed;
+
+  arena = user_dirs_arena_new ();
+  table = nested_table (arena, n);
+  timer = g_timer_new ();
+  if (trie)
+    user_dirs_table_sort_by_path (table);
+  else
+    user_dirs_table_sort (table, prefix_collate_compare);
+  elapsed = g_timer_elapsed (timer, NULL);
+  if (trie)
+    check_parents_first (table);
+
+  g_timer_destroy (timer);
+  user_dirs_table_free (table);
+  user_dirs_arena_free (arena);
+  return elapsed;
+}
+
+typedef struct {
+  UserDirsArena *arena;
+  UserDirsTrie *trie;
+  guint moved;
+} Rewrite;
+
+static void
+rewrite_dir (gpointer value, const char *rest, gpointer user_data)
+{
+  Rewrite *rewrite = user_data;
+  Directory *dir = value;
+
+  dir->path = user_dirs_arena_build_filename (rewrite->arena, "Moved", rest, NULL);
+  user_dirs_trie_insert (rewrite->trie, dir->path, dir);
+  rewrite->moved++;
+}
+
+/* Moves every top level directory in turn, returns the time per move */
+static double
+run_move (guint n, gboolean trie)
+{
+  UserDirsArena *arena;
+  UserDirsTable *table;
+  Rewrite rewrite;
+  Directory *dir;
+  GTimer *timer;
+  double elapsed;
+  char *old_path;
+  const char *p;
+  guint i, j, moves = 0, moved = 0;
+
+  arena = user_dirs_arena_new ();
+  table = nested_table (arena, n);
+  rewrite.arena = arena;
+  rewrite.trie = user_dirs_trie_new ();
+  rewrite.moved = 0;
+  for (i = 0; i < user_dirs_table_size (table); i++)
+    {
+      dir = user_dirs_table_index (table, i);
+      user_dirs_trie_insert (rewrite.trie, dir->path, dir);
+    }
+
+  timer = g_timer_new ();
+  for (i = 0; i < n / 100 + 1; i++)
+    {
+      old_path = g_strdup_printf ("Vendor %u", i);
+      if (trie)
+        user_dirs_trie_take (rewrite.trie, old_path, rewrite_dir, &rewrite);
+      else
+        for (j = 0; j < user_dirs_table_size (table); j++)
+          {
+            dir = user_dirs_table_index (table, j);
+            if (!g_str_has_prefix (dir->path, old_path))
+              continue;
+            p = dir->path + strlen (old_path);
+            if (*p != '/' && *p != 0)
+              continue;
+            dir->path = user_dirs_arena_build_filename (arena, "Moved", p, NULL);
+            moved++;
+          }
+      g_free (old_path);
+      moves++;
+    }
+  elapsed = g_timer_elapsed (timer, NULL);
+
+  /* Both ways move the same directories */
+  g_assert ((trie ? rewrite.moved : moved) == n);
+
+  g_timer_destroy (timer);
+  user_dirs_trie_free (rewrite.trie);
+  user_dirs_table_free (table);
+  user_dirs_arena_free (arena);
+  return elapsed / moves;
+}
+
+int
+main (int argc, char *argv[])
+{
+  char **names;
+  guint n, i;
+  double list_time, table_time;
+
+  g_print ("%8s %14s %14s\n", "entries", "list (us)", "table (us)");
+  for (n = 10; n <= 10000; n *= 10)
+    {
+      names = g_new0 (char *, n + 1);
+      for (i = 0; i < n; i++)
+        names[i] = g_strdup_printf ("org.example.App%u.desktop", i);
+
+      list_time = run_list (names, n);
+      table_time = run_table (names, n);
+      g_print ("%8u %14.1f %14.1f\n", n, list_time * 1e6, table_time * 1e6);
+
+      g_strfreev (names);
+    }
+
+  g_print ("\n%8s %14s %14s %14s %14s\n", "entries",
+           "sort (us)", "trie sort (us)", "move (us)", "trie move (us)");
+  for (n = 10; n <= 10000; n *= 10)
+    g_print ("%8u %14.1f %14.1f %14.1f %14.1f\n", n,
+             run_sort (n, FALSE) * 1e6, run_sort (n, TRUE) * 1e6,
+             run_move (n, FALSE) * 1e6, run_move (n, TRUE) * 1e6);
+
+  return 0;
+}
@@ -0,0 +1,141 @@
+/* Microbenchmark for the config file tokenizer.
+ *
+ * Generates user-dirs.dirs files of growing size in memory and times
+ * parsing them the way libxdg-user-dirs does, reporting the cost per
+ * line, which should stay flat. Then feeds random garbage through the
+ * tokenizer to check that it never reads outside of its buffer; run
+ * it under valgrind or with -fsanitize=address for that to mean
+ * anything.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "user-dirs-tokenizer.h"
+
+static const char *lines[] = {
+  "# This file is written by xdg-user-dirs-update\n",
+  "XDG_DESKTOP_DIR=\"$HOME/Desktop\"\n",
+  "XDG_DOWNLOAD_DIR=\"$HOME/Downloads\"\n",
+  "  XDG_MUSIC_DIR = \"$HOME/My\\ Music\"\n",
+  "XDG_PICTURES_DIR=\"/srv/pictures/\\\"shared\\\"\"\n",
+  "XDG_VIDEOS_DIR=\"$HOME\"\n",
+  "\n",
+  "org.example.App.desktop=\"$HOME/App\"\n",
+};
+
+static double
+now (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static char *
+generate (size_t n_lines, size_t *len)
+{
+  size_t i, alloc;
+  char *buffer;
+
+  alloc = 64;
+  buffer = malloc (alloc);
+  *len = 0;
+  for (i = 0; i < n_lines; i++)
+    {
+      const char *line = lines[i % (sizeof (lines) / sizeof (lines[0]))];
+      size_t line_len = strlen (line);
+
+      if (*len + line_len > alloc)
+        {
+          alloc = alloc * 2 + line_len;
+          buffer = realloc (buffer, alloc);
+        }
+      memcpy (buffer + *len, line, line_len);
+      *len += line_len;
+    }
+
+  return buffer;
+}
+
+static size_t
+parse (const char *buffer, size_t len, char *scratch)
+{
+  UserDirsTokenizer tokenizer;
+  UserDirsSlice key, value, path;
+  size_t n = 0;
+
+  user_dirs_tokenizer_init (&tokenizer, buffer, len);
+  while (user_dirs_tokenizer_next (&tokenizer, &key, &value))
+    {
+      if (!user_dirs_slice_dir_key (&key) ||
+          !user_dirs_slice_path (&value, &path))
+        continue;
+      n += user_dirs_unescape (&path, scratch);
+    }
+
+  return n;
+}
+
+static void
+run_fuzz (unsigned int iterations)
+{
+  static const char alphabet[] = "XDG_DIR=\"$HOME/\\ #\n\t.desktop";
+  char scratch[256];
+  unsigned int i;
+  size_t j, len;
+  char *buffer;
+
+  srand (1);
+  for (i = 0; i < iterations; i++)
+    {
+      len = rand () % 200;
+      /* Exactly sized, so overreads are caught by the tools */
+      buffer = malloc (len ? len : 1);
+      for (j = 0; j < len; j++)
+        buffer[j] = alphabet[rand () % (sizeof (alphabet) - 1)];
+      parse (buffer, len, scratch);
+      free (buffer);
+    }
+
+  printf ("fuzz: %u random buffers parsed\n", iterations);
+}
+
+int
+main (int argc, char *argv[])
+{
+  size_t n_lines, len, total;
+  double start, elapsed;
+  char *buffer, *scratch;
+  int rounds, r;
+
+  printf ("%10s %12s %10s\n", "lines", "bytes", "ns/line");
+  for (n_lines = 10; n_lines <= 1000000; n_lines *= 10)
+    {
+      buffer = generate (n_lines, &len);
+      scratch = malloc (len + 1);
+      rounds = n_lines >= 100000 ? 5 : 1000000 / n_lines;
+
+      total = 0;
+      start = now ();
+      for (r = 0; r < rounds; r++)
+        total += parse (buffer, len, scratch);
+      elapsed = now () - start;
+
+      printf ("%10zu %12zu %10.1f\n", n_lines, len,
+              elapsed * 1e9 / ((double) n_lines * rounds));
+      if (total == 0)
+        return 1;
+
+      free (scratch);
+      free (buffer);
+    }
+
+  run_fuzz (argc > 1 ? atoi (argv[1]) : 100000);
+
+  return 0;
+}
@@ -0,0 +1,211 @@
+#!/bin/sh
+# Benchmarks xdg-user-dirs-update and xdg-user-dir on synthetic homes.
+#
+# Usage: run-bench.sh UPDATE LOOKUP
+#
+# Every scenario gets its own home, XDG_CONFIG_DIRS, XDG_DATA_DIRS and
+# XDG_RUNTIME_DIR in a temporary directory. Starting from a base
+# scenario, one of the number of user-dirs.dirs entries, application
+# directories (.desktop files), the locale and the number of missing
+# directories is varied at a time. xdg-user-dirs-update is timed on
+# a first run, a run with nothing to do, with --force and moving every
+# directory with --force --move; xdg-user-dir on a single lookup.
+#
+# Each result is printed as one JSON object per line, so the output
+# of different commits can be compared with e.g. jq. Wall times are in
+# milliseconds and the peak RSS in kilobytes. Syscall counts need
+# strace and are null without it.
+#
+# Environment:
+#   BENCH_EXEC        the bench-exec helper (default: ./bench-exec)
+#   BENCH_ITERATIONS  runs per measurement (default: 20)
+#   BENCH_ENTRIES     numbers of entries (default: "8 64 512")
+#   BENCH_APP_DIRS    numbers of .desktop files (default: "0 32 256")
+#   BENCH_LOCALES     locales (default: "C de_DE.UTF-8")
+#   BENCH_MISSING     numbers of missing directories (default: "0 4")
+# The first value of each list is the base scenario.
+
+set -e
+
+if test $# -ne 2; then
+	echo "Usage: $0 UPDATE LOOKUP" >&2
+	exit 2
+fi
+
+UPDATE=$1
+LOOKUP=$2
+BENCH_EXEC=${BENCH_EXEC:-./bench-exec}
+BENCH_ITERATIONS=${BENCH_ITERATIONS:-20}
+BENCH_ENTRIES=${BENCH_ENTRIES:-"8 64 512"}
+BENCH_APP_DIRS=${BENCH_APP_DIRS:-"0 32 256"}
+BENCH_LOCALES=${BENCH_LOCALES:-"C de_DE.UTF-8"}
+BENCH_MISSING=${BENCH_MISSING:-"0 4"}
+
+commit=`cd "\`dirname "$0"\`" && git rev-parse --short HEAD 2>/dev/null || echo unknown`
+
+if command -v strace >/dev/null 2>&1; then
+	have_strace=yes
+else
+	have_strace=no
+fi
+
+tmpdir=`mktemp -d "${TMPDIR:-/tmp}/xdg-user-dirs-bench.XXXXXX"`
+trap 'rm -rf "$tmpdir"' EXIT
+trap 'exit 1' HUP INT TERM
+
+unset LANGUAGE LANG XDG_CONFIG_HOME
+# Set by xdg-user-dirs-update --env-generator, lookups would use them
+unset XDG_DESKTOP_DIR XDG_DOWNLOAD_DIR XDG_TEMPLATES_DIR XDG_PUBLICSHARE_DIR XDG_DOCUMENTS_DIR XDG_MUSIC_DIR XDG_PICTURES_DIR XDG_VIDEOS_DIR
+scenario=0
+
+# Writes user-dirs.defaults with ENTRIES entries, the well known ones
+# first, and APP_DIRS application directories inside Documents
+write_config ()
+{
+	mkdir -p "$1/etc/xdg" "$1/share/xdg-user-dirs"
+	printf 'enabled=True\nfilename_encoding=UTF-8\n' > "$1/etc/xdg/user-dirs.conf"
+	awk -v n="$2" 'BEGIN {
+		split("DESKTOP=Desktop DOWNLOAD=Downloads TEMPLATES=Templates PUBLICSHARE=Public DOCUMENTS=Documents MUSIC=Music PICTURES=Pictures VIDEOS=Videos", known, " ");
+		for (i = 1; i <= n; i++)
+			print (i in known) ? known[i] : "BENCH" i "=Bench" i;
+	}' > "$1/etc/xdg/user-dirs.defaults"
+	awk -v n="$3" -v dir="$1/share/xdg-user-dirs" 'BEGIN {
+		for (i = 1; i <= n; i++) {
+			file = dir "/org.example.App" i ".desktop";
+			print "[Directory]" > file;
+			print "Parent=XDG_DOCUMENTS_DIR" > file;
+			print "Name=App" i > file;
+			print "Name[de]=Anwendung" i > file;
+			close (file);
+		}
+	}'
+}
+
+# Prints the directories of the last COUNT entries in user-dirs.dirs,
+# quoted for the shell
+last_dirs ()
+{
+	sed -n 's,^XDG_.*_DIR="$HOME/\(.*\)"$,'"'\\1'"',p' "$HOME/.config/user-dirs.dirs" | tail -n "$1" | tr '\n' ' '
+}
+
+# Renames every directory of the home in the template at $1 and points
+# user-dirs.dirs to the new names, so that --force --move moves them
+# all back
+make_move_template ()
+{
+	cp -R "$HOME" "$1"
+	sed -n 's,^XDG_.*_DIR="$HOME/\(.*\)"$,\1,p' "$1/.config/user-dirs.dirs" | while read dir; do
+		if test -d "$1/$dir"; then
+			mv "$1/$dir" "$1/$dir.old"
+		fi
+	done
+	sed -e 's,^\(XDG_.*_DIR="$HOME/.*\)"$,\1.old",' "$1/.config/user-dirs.dirs" > "$1/.config/user-dirs.dirs.tmp"
+	mv "$1/.config/user-dirs.dirs.tmp" "$1/.config/user-dirs.dirs"
+}
+
+# measure MODE SETUP COMMAND [ARG...]
+measure ()
+{
+	mode=$1
+	setup=$2
+	shift 2
+
+	set -- `"$BENCH_EXEC" -n "$BENCH_ITERATIONS" -s "$setup" "$@"` "$@"
+	wall_min=$1
+	wall_median=$2
+	max_rss=$3
+	shift 3
+
+	syscalls=null
+	if test $have_strace = yes; then
+		sh -c "$setup"
+		strace -f -c -o "$tmpdir/strace" "$@" >/dev/null 2>&1 || true
+		syscalls=`awk '$NF == "total" { print $4 }' "$tmpdir/strace"`
+		test -n "$syscalls" || syscalls=null
+	fi
+
+	printf '{"commit":"%s","mode":"%s","entries":%s,"app_dirs":%s,"locale":"%s","missing":%s,"iterations":%s,"wall_ms_min":%s,"wall_ms_median":%s,"max_rss_kb":%s,"syscalls":%s}\n' \
+		"$commit" "$mode" "$entries" "$app_dirs" "$locale" "$missing" \
+		"$BENCH_ITERATIONS" "$wall_min" "$wall_median" "$max_rss" "$syscalls"
+}
+
+# run_scenario ENTRIES APP_DIRS LOCALE MISSING MODES
+run_scenario ()
+{
+	entries=$1
+	app_dirs=$2
+	locale=$3
+	missing=$4
+	modes=$5
+
+	if test "$locale" != C && (LC_ALL=$locale locale 2>&1 >/dev/null) | grep -q .; then
+		echo "$0: skipping locale $locale, it is not available" >&2
+		return
+	fi
+
+	scenario=`expr $scenario + 1`
+	root="$tmpdir/$scenario"
+	write_config "$root" "$entries" "$app_dirs"
+
+	HOME="$root/home"
+	XDG_CONFIG_DIRS="$root/etc/xdg"
+	XDG_DATA_DIRS="$root/share"
+	XDG_RUNTIME_DIR="$root/run"
+	LC_ALL=$locale
+	export HOME XDG_CONFIG_DIRS XDG_DATA_DIRS XDG_RUNTIME_DIR LC_ALL
+
+	reset="rm -rf '$HOME' '$XDG_RUNTIME_DIR' && mkdir -p '$HOME' && mkdir -m 700 '$XDG_RUNTIME_DIR'"
+	sh -c "$reset"
+	"$UPDATE" >/dev/null
+
+	if test "$missing" -gt 0; then
+		remove="cd '$HOME' && rm -rf `last_dirs $missing`"
+	else
+		remove=true
+	fi
+
+	for mode in $modes; do
+		case $mode in
+		first-run)
+			measure $mode "$reset" "$UPDATE"
+			;;
+		no-op)
+			measure $mode "$remove" "$UPDATE"
+			;;
+		force)
+			measure $mode "$remove" "$UPDATE" --force
+			;;
+		move)
+			make_move_template "$root/move"
+			measure $mode "rm -rf '$HOME' && cp -R '$root/move' '$HOME'" "$UPDATE" --force --move
+			"$UPDATE" --force >/dev/null
+			;;
+		lookup)
+			measure $mode true "$LOOKUP" DESKTOP
+			;;
+		esac
+	done
+
+	rm -rf "$root"
+}
+
+set -- $BENCH_ENTRIES; base_entries=$1
+set -- $BENCH_APP_DIRS; base_app_dirs=$1
+set -- $BENCH_LOCALES; base_locale=$1
+set -- $BENCH_MISSING; base_missing=$1
+all_modes="first-run no-op force move lookup"
+
+run_scenario $base_entries $base_app_dirs $base_locale $base_missing "$all_modes"
+for n in $BENCH_ENTRIES; do
+	test $n = $base_entries || run_scenario $n $base_app_dirs $base_locale $base_missing "$all_modes"
+done
+for n in $BENCH_APP_DIRS; do
+	test $n = $base_app_dirs || run_scenario $base_entries $n $base_locale $base_missing "$all_modes"
+done
+for l in $BENCH_LOCALES; do
+	test $l = $base_locale || run_scenario $base_entries $base_app_dirs $l $base_missing "$all_modes"
+done
+# Missing directories only make a difference to existing homes
+for n in $BENCH_MISSING; do
+	test $n = $base_missing || run_scenario $base_entries $base_app_dirs $base_locale $n "no-op force"
+done
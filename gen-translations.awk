@@ -0,0 +1,133 @@
+# Generates the translation tables used by xdg-user-dirs-update from
+# the strings marked in translate.c and the po files of all languages.
+#
+# Usage: LC_ALL=C awk -f gen-translations.awk translate.c po/*.po
+#
+# The C locale is needed so that both tables come out sorted in strcmp()
+# order, which the lookups rely on.
+
+function po_string(line)
+{
+  sub(/^[^"]*"/, "", line);
+  sub(/"[ \t\r]*$/, "", line);
+  return line;
+}
+
+function finish_entry()
+{
+  if (state != "" && !fuzzy && !skip && (msgid in wanted) && msgstr != "")
+    translation[locale, msgid] = msgstr;
+  state = "";
+  fuzzy = 0;
+  skip = 0;
+  msgid = "";
+  msgstr = "";
+}
+
+function sort(array, n,    i, j, tmp)
+{
+  for (i = 2; i <= n; i++)
+    {
+      tmp = array[i];
+      for (j = i - 1; j >= 1 && array[j] > tmp; j--)
+        array[j + 1] = array[j];
+      array[j + 1] = tmp;
+    }
+}
+
+FNR == 1 {
+  finish_entry();
+  locale = FILENAME;
+  sub(/^.*\//, "", locale);
+  sub(/\.po$/, "", locale);
+  if (FILENAME !~ /\.po$/)
+    source = 1;
+  else
+    {
+      source = 0;
+      locales[++n_locales] = locale;
+    }
+}
+
+source {
+  line = $0;
+  while (match(line, /_\("[^"]*"\)/))
+    {
+      id = substr(line, RSTART + 3, RLENGTH - 5);
+      if (!(id in wanted))
+        {
+          wanted[id] = 1;
+          msgids[++n_msgids] = id;
+        }
+      line = substr(line, RSTART + RLENGTH);
+    }
+  next;
+}
+
+# Comments start the next entry
+/^#/ && state == "str" { finish_entry() }
+/^#,.*fuzzy/ { fuzzy = 1; next }
+/^#/ { next }
+/^[ \t\r]*$/ { finish_entry(); next }
+
+/^msgctxt / { skip = 1; next }
+/^msgid_plural / { skip = 1; next }
+/^msgstr\[/ { skip = 1; next }
+
+/^msgid / {
+  if (state == "str")
+    finish_entry();
+  state = "id";
+  msgid = po_string($0);
+  next;
+}
+
+/^msgstr / {
+  state = "str";
+  msgstr = po_string($0);
+  next;
+}
+
+/^"/ {
+  if (state == "id")
+    msgid = msgid po_string($0);
+  else if (state == "str")
+    msgstr = msgstr po_string($0);
+  next;
+}
+
+END {
+  finish_entry();
+  sort(msgids, n_msgids);
+  sort(locales, n_locales);
+
+  print "/* Generated by gen-translations.awk, do not edit */";
+  print "";
+  print "#define N_MSGIDS " n_msgids;
+  print "#define N_CATALOGS " n_locales;
+  print "";
+  print "typedef struct {";
+  print "  const char *name;";
+  print "  const char *strings[N_MSGIDS];";
+  print "} Catalog;";
+  print "";
+  print "static const char * const msgids[N_MSGIDS] = {";
+  for (i = 1; i <= n_msgids; i++)
+    print "  \"" msgids[i] "\",";
+  print "};";
+  print "";
+  print "static const Catalog catalogs[N_CATALOGS] = {";
+  for (l = 1; l <= n_locales; l++)
+    {
+      print "  { \"" locales[l] "\", {";
+      for (i = 1; i <= n_msgids; i++)
+        {
+          if ((locales[l], msgids[i]) in translation)
+            print "    \"" translation[locales[l], msgids[i]] "\",";
+          else
+            print "    NULL,";
+        }
+      print "  } },";
+    }
+  print "};";
+}
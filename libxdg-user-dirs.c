@@ -0,0 +1,822 @@
+/*
+  This file is not licenced under the GPL like the rest of the code.
+  Its is under the MIT license, to encourage reuse.
+
+  Copyright (c) 2007 Red Hat, Inc.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation files
+  (the "Software"), to deal in the Software without restriction,
+  including without limitation the rights to use, copy, modify, merge,
+  publish, distribute, sublicense, and/or sell copies of the Software,
+  and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions: 
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software. 
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+  BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+  ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <pwd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "xdg-user-dirs.h"
+#include "xdg-user-dirs-snapshot.h"
+#include "user-dirs-tokenizer.h"
+
+/* user-dirs.dirs is parsed once into a table which is kept until the
+ * file changes. Every lookup stat()s the file to revalidate the table,
+ * which is much cheaper than reading and parsing it again. If
+ * xdg-user-dirs-update left a current snapshot in $XDG_RUNTIME_DIR,
+ * that is mapped and used instead of parsing the file at all.
+ *
+ * Before any of that, XDG_<TYPE>_DIR in the environment is used, as
+ * exported for the session by xdg-user-dirs-update --env-generator.
+ */
+
+typedef struct {
+  char *type;
+  char *path; /* absolute */
+} Entry;
+
+typedef struct {
+  char *config_file;
+  char *home_dir;
+  int exists;
+  dev_t dev;
+  ino_t ino;
+  off_t size;
+  struct timespec mtime;
+
+  Entry *entries; /* in file order, duplicates removed */
+  size_t n_entries;
+  Entry **sorted; /* sorted by type, for lookups */
+
+  /* Used instead of the entries if set */
+  const XdgUserDirsSnapshotHeader *snapshot;
+  size_t snapshot_size;
+} Cache;
+
+static pthread_rwlock_t cache_lock = PTHREAD_RWLOCK_INITIALIZER;
+static Cache *cache = NULL;
+
+static char *
+read_file (int fd, off_t size, size_t *len_out)
+{
+  char *buffer;
+  size_t len;
+  ssize_t res;
+
+  /* The size is only a hint, the file may be growing */
+  len = 0;
+  buffer = malloc (size + 1);
+  if (buffer == NULL)
+    return NULL;
+
+  for (;;)
+    {
+      if (len == (size_t) size)
+        {
+          char *new_buffer;
+
+          size = size * 2 + 64;
+          new_buffer = realloc (buffer, size + 1);
+          if (new_buffer == NULL)
+            {
+              free (buffer);
+              return NULL;
+            }
+          buffer = new_buffer;
+        }
+
+      res = read (fd, buffer + len, size - len);
+      if (res < 0)
+        {
+          free (buffer);
+          return NULL;
+        }
+      if (res == 0)
+        break;
+      len += res;
+    }
+
+  buffer[len] = 0;
+  *len_out = len;
+  return buffer;
+}
+
+/**
+ * xdg_user_dirs_parse_file:
+ * @filename: a file in the user-dirs.dirs format
+ * @func: function to call for each directory
+ * @user_data: data to pass to @func
+ * @returns: 0 on success, -1 if the file couldn't be read
+ *
+ * Parses @filename without caching, calling @func for every entry in
+ * file order. Unlike with xdg_user_dirs_foreach() the paths passed to
+ * @func are relative to the home directory, unless they are absolute.
+ * Entries pointing at the home directory itself are passed as "".
+ **/
+int
+xdg_user_dirs_parse_file (const char *filename,
+                          XdgUserDirsFunc func,
+                          void *user_data)
+{
+  struct stat statbuf;
+  char *buffer;
+  size_t len;
+  int fd;
+
+  fd = open (filename, O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+    return -1;
+
+  buffer = NULL;
+  if (fstat (fd, &statbuf) == 0)
+    buffer = read_file (fd, statbuf.st_size, &len);
+  close (fd);
+
+  if (buffer == NULL)
+    return -1;
+
+  user_dirs_parse_dirs (buffer, len, func, user_data);
+  free (buffer);
+  return 0;
+}
+
+static pthread_once_t passwd_home_once = PTHREAD_ONCE_INIT;
+static char *passwd_home_dir = NULL;
+
+static void
+init_passwd_home_dir (void)
+{
+  struct passwd pwd, *result;
+  char buffer[4096];
+
+  if (getpwuid_r (getuid (), &pwd, buffer, sizeof (buffer), &result) == 0 &&
+      result != NULL)
+    passwd_home_dir = strdup (pwd.pw_dir);
+}
+
+/* Like g_get_home_dir(), $HOME is preferred over the password database */
+static const char *
+get_home_dir (void)
+{
+  const char *home_dir;
+
+  home_dir = getenv ("HOME");
+  if (home_dir != NULL && *home_dir != 0)
+    return home_dir;
+
+  pthread_once (&passwd_home_once, init_passwd_home_dir);
+  return passwd_home_dir;
+}
+
+/* Builds the path of user-dirs.dirs into buffer, which must be
+ * PATH_MAX bytes long.
+ */
+static int
+get_config_file (const char *home_dir, char *buffer)
+{
+  const char *config_home;
+  int len;
+
+  config_home = getenv ("XDG_CONFIG_HOME");
+  if (config_home != NULL && *config_home != 0)
+    len = snprintf (buffer, PATH_MAX, "%s/user-dirs.dirs", config_home);
+  else
+    len = snprintf (buffer, PATH_MAX, "%s/.config/user-dirs.dirs", home_dir);
+
+  return len > 0 && len < PATH_MAX;
+}
+
+static char *
+build_path (const char *home_dir, const char *path)
+{
+  char *res;
+  size_t home_len, path_len;
+
+  if (*path == '/')
+    return strdup (path);
+
+  home_len = strlen (home_dir);
+  path_len = strlen (path);
+  res = malloc (home_len + 1 + path_len + 1);
+  if (res == NULL)
+    return NULL;
+
+  memcpy (res, home_dir, home_len);
+  if (path_len > 0)
+    {
+      res[home_len++] = '/';
+      memcpy (res + home_len, path, path_len);
+    }
+  res[home_len + path_len] = 0;
+  return res;
+}
+
+static void
+cache_free (Cache *c)
+{
+  size_t i;
+
+  if (c == NULL)
+    return;
+
+  for (i = 0; i < c->n_entries; i++)
+    {
+      free (c->entries[i].type);
+      free (c->entries[i].path);
+    }
+  free (c->entries);
+  free (c->sorted);
+  if (c->snapshot)
+    munmap ((void *) c->snapshot, c->snapshot_size);
+  free (c->config_file);
+  free (c->home_dir);
+  free (c);
+}
+
+typedef struct {
+  Cache *cache;
+  size_t allocated;
+  int failed;
+} CacheBuilder;
+
+static void
+add_cache_entry (const char *type, const char *path, void *user_data)
+{
+  CacheBuilder *builder = user_data;
+  Cache *c = builder->cache;
+  Entry *entry;
+
+  if (builder->failed)
+    return;
+
+  if (c->n_entries == builder->allocated)
+    {
+      Entry *entries;
+
+      builder->allocated = builder->allocated * 2 + 16;
+      entries = realloc (c->entries, builder->allocated * sizeof (Entry));
+      if (entries == NULL)
+        {
+          builder->failed = 1;
+          return;
+        }
+      c->entries = entries;
+    }
+
+  entry = &c->entries[c->n_entries];
+  entry->type = strdup (type);
+  entry->path = build_path (c->home_dir, path);
+  if (entry->type == NULL || entry->path == NULL)
+    {
+      free (entry->type);
+      free (entry->path);
+      builder->failed = 1;
+      return;
+    }
+
+  c->n_entries++;
+}
+
+/* Orders by type, then by position in the file */
+static int
+compare_entries (const void *a, const void *b)
+{
+  const Entry *entry_a = *(const Entry * const *) a;
+  const Entry *entry_b = *(const Entry * const *) b;
+  int res;
+
+  res = strcmp (entry_a->type, entry_b->type);
+  if (res != 0)
+    return res;
+
+  return (entry_a > entry_b) - (entry_a < entry_b);
+}
+
+static int
+compare_type (const void *key, const void *elem)
+{
+  const Entry *entry = *(const Entry * const *) elem;
+
+  return strcmp (key, entry->type);
+}
+
+/* Drops all but the first entry of each type, like the original
+ * line-by-line lookup did.
+ */
+static int
+index_cache (Cache *c)
+{
+  size_t i, n_unique;
+  Entry *entries, *first;
+
+  if (c->n_entries == 0)
+    return 1;
+
+  c->sorted = malloc (c->n_entries * sizeof (Entry *));
+  if (c->sorted == NULL)
+    return 0;
+
+  for (i = 0; i < c->n_entries; i++)
+    c->sorted[i] = &c->entries[i];
+  qsort (c->sorted, c->n_entries, sizeof (Entry *), compare_entries);
+
+  /* Mark duplicates by clearing their type */
+  first = c->sorted[0];
+  for (i = 1; i < c->n_entries; i++)
+    {
+      if (strcmp (c->sorted[i]->type, first->type) == 0)
+        {
+          free (c->sorted[i]->type);
+          c->sorted[i]->type = NULL;
+        }
+      else
+        first = c->sorted[i];
+    }
+
+  /* Compact the entries, keeping file order */
+  entries = c->entries;
+  n_unique = 0;
+  for (i = 0; i < c->n_entries; i++)
+    {
+      if (entries[i].type == NULL)
+        {
+          free (entries[i].path);
+          continue;
+        }
+      entries[n_unique++] = entries[i];
+    }
+  c->n_entries = n_unique;
+
+  for (i = 0; i < c->n_entries; i++)
+    c->sorted[i] = &c->entries[i];
+  qsort (c->sorted, c->n_entries, sizeof (Entry *), compare_entries);
+
+  return 1;
+}
+
+static const XdgUserDirsSnapshotEntry *
+snapshot_entries (const XdgUserDirsSnapshotHeader *snapshot)
+{
+  return (const XdgUserDirsSnapshotEntry *) (snapshot + 1);
+}
+
+static const uint32_t *
+snapshot_index (const XdgUserDirsSnapshotHeader *snapshot)
+{
+  return (const uint32_t *) (snapshot_entries (snapshot) + snapshot->n_entries);
+}
+
+static const char *
+snapshot_string (const XdgUserDirsSnapshotHeader *snapshot, uint32_t offset)
+{
+  return (const char *) snapshot + offset;
+}
+
+/* Checks that all offsets are in bounds. As the file ends with a NUL
+ * byte, all strings are terminated then.
+ */
+static int
+snapshot_is_valid (const XdgUserDirsSnapshotHeader *snapshot, size_t size)
+{
+  const XdgUserDirsSnapshotEntry *entries;
+  const uint32_t *index;
+  uint32_t i;
+
+  if (size < sizeof (XdgUserDirsSnapshotHeader) ||
+      memcmp (snapshot->magic, XDG_USER_DIRS_SNAPSHOT_MAGIC, 8) != 0 ||
+      snapshot->version != XDG_USER_DIRS_SNAPSHOT_VERSION ||
+      snapshot->size != size ||
+      ((const char *) snapshot)[size - 1] != 0)
+    return 0;
+
+  if (snapshot->n_entries > (size - sizeof (XdgUserDirsSnapshotHeader)) /
+                            (sizeof (XdgUserDirsSnapshotEntry) + sizeof (uint32_t)))
+    return 0;
+
+  if (snapshot->config_file >= size || snapshot->home_dir >= size)
+    return 0;
+
+  entries = snapshot_entries (snapshot);
+  index = snapshot_index (snapshot);
+  for (i = 0; i < snapshot->n_entries; i++)
+    {
+      if (entries[i].type >= size || entries[i].path >= size ||
+          index[i] >= snapshot->n_entries)
+        return 0;
+    }
+
+  return 1;
+}
+
+/* Maps the snapshot if it was generated from the user-dirs.dirs
+ * described by source, for the same home directory.
+ */
+static int
+map_snapshot (Cache *c, struct stat *source)
+{
+  char snapshot_file[PATH_MAX];
+  const XdgUserDirsSnapshotHeader *snapshot;
+  const char *runtime_dir;
+  struct stat statbuf;
+  void *map;
+  int fd, len;
+
+  runtime_dir = getenv ("XDG_RUNTIME_DIR");
+  if (runtime_dir == NULL || *runtime_dir != '/')
+    return 0;
+
+  len = snprintf (snapshot_file, PATH_MAX, "%s/%s",
+                  runtime_dir, XDG_USER_DIRS_SNAPSHOT_NAME);
+  if (len <= 0 || len >= PATH_MAX)
+    return 0;
+
+  fd = open (snapshot_file, O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+    return 0;
+
+  map = MAP_FAILED;
+  if (fstat (fd, &statbuf) == 0 && statbuf.st_size > 0)
+    map = mmap (NULL, statbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close (fd);
+
+  if (map == MAP_FAILED)
+    return 0;
+
+  snapshot = map;
+  if (!snapshot_is_valid (snapshot, statbuf.st_size) ||
+      snapshot->source_dev != (uint64_t) source->st_dev ||
+      snapshot->source_ino != (uint64_t) source->st_ino ||
+      snapshot->source_size != (uint64_t) source->st_size ||
+      snapshot->source_mtime_sec != (int64_t) source->st_mtim.tv_sec ||
+      snapshot->source_mtime_nsec != (int64_t) source->st_mtim.tv_nsec ||
+      strcmp (snapshot_string (snapshot, snapshot->home_dir), c->home_dir) != 0)
+    {
+      munmap (map, statbuf.st_size);
+      return 0;
+    }
+
+  c->snapshot = snapshot;
+  c->snapshot_size = statbuf.st_size;
+  c->exists = 1;
+  c->dev = source->st_dev;
+  c->ino = source->st_ino;
+  c->size = source->st_size;
+  c->mtime = source->st_mtim;
+  return 1;
+}
+
+static const char *
+snapshot_lookup (const XdgUserDirsSnapshotHeader *snapshot, const char *type)
+{
+  const XdgUserDirsSnapshotEntry *entries, *entry;
+  const uint32_t *index;
+  uint32_t low, high, mid;
+  int res;
+
+  entries = snapshot_entries (snapshot);
+  index = snapshot_index (snapshot);
+
+  low = 0;
+  high = snapshot->n_entries;
+  while (low < high)
+    {
+      mid = low + (high - low) / 2;
+      entry = &entries[index[mid]];
+      res = strcmp (type, snapshot_string (snapshot, entry->type));
+      if (res == 0)
+        return snapshot_string (snapshot, entry->path);
+      if (res < 0)
+        high = mid;
+      else
+        low = mid + 1;
+    }
+
+  return NULL;
+}
+
+static Cache *
+load_cache (const char *config_file, const char *home_dir,
+            int exists, struct stat *source)
+{
+  CacheBuilder builder = { NULL, 0, 0 };
+  struct stat statbuf;
+  char *buffer;
+  size_t len;
+  Cache *c;
+  int fd;
+
+  c = calloc (1, sizeof (Cache));
+  if (c == NULL)
+    return NULL;
+
+  c->config_file = strdup (config_file);
+  c->home_dir = strdup (home_dir);
+  if (c->config_file == NULL || c->home_dir == NULL)
+    goto error;
+
+  if (exists && map_snapshot (c, source))
+    return c;
+
+  fd = open (config_file, O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+    return c; /* A missing file is cached too */
+
+  /* Remember the identity of what was actually read */
+  buffer = NULL;
+  if (fstat (fd, &statbuf) == 0)
+    {
+      c->exists = 1;
+      c->dev = statbuf.st_dev;
+      c->ino = statbuf.st_ino;
+      c->size = statbuf.st_size;
+      c->mtime = statbuf.st_mtim;
+      buffer = read_file (fd, statbuf.st_size, &len);
+    }
+  close (fd);
+
+  if (buffer == NULL)
+    goto error;
+
+  builder.cache = c;
+  user_dirs_parse_dirs (buffer, len, add_cache_entry, &builder);
+  free (buffer);
+
+  if (builder.failed || !index_cache (c))
+    goto error;
+
+  return c;
+
+ error:
+  cache_free (c);
+  return NULL;
+}
+
+static int
+cache_is_valid (Cache *c, const char *config_file, const char *home_dir,
+                int exists, struct stat *statbuf)
+{
+  if (c == NULL ||
+      strcmp (c->config_file, config_file) != 0 ||
+      strcmp (c->home_dir, home_dir) != 0 ||
+      c->exists != exists)
+    return 0;
+
+  if (!exists)
+    return 1;
+
+  return c->dev == statbuf->st_dev &&
+         c->ino == statbuf->st_ino &&
+         c->size == statbuf->st_size &&
+         c->mtime.tv_sec == statbuf->st_mtim.tv_sec &&
+         c->mtime.tv_nsec == statbuf->st_mtim.tv_nsec;
+}
+
+/* Returns with cache_lock held for reading and the cache current, or
+ * with the lock not held and -1 if the cache couldn't be loaded.
+ */
+static int
+lock_cache (void)
+{
+  char config_file[PATH_MAX];
+  const char *home_dir;
+  struct stat statbuf;
+  int exists;
+
+  home_dir = get_home_dir ();
+  if (home_dir == NULL || !get_config_file (home_dir, config_file))
+    return -1;
+
+  exists = stat (config_file, &statbuf) == 0;
+
+  pthread_rwlock_rdlock (&cache_lock);
+  if (cache_is_valid (cache, config_file, home_dir, exists, &statbuf))
+    return 0;
+  pthread_rwlock_unlock (&cache_lock);
+
+  pthread_rwlock_wrlock (&cache_lock);
+  /* Another thread may have reloaded it meanwhile */
+  if (!cache_is_valid (cache, config_file, home_dir, exists, &statbuf))
+    {
+      cache_free (cache);
+      cache = load_cache (config_file, home_dir, exists, &statbuf);
+    }
+  pthread_rwlock_unlock (&cache_lock);
+
+  /* If the file changed again while loading, use what we loaded */
+  pthread_rwlock_rdlock (&cache_lock);
+  if (cache == NULL)
+    {
+      pthread_rwlock_unlock (&cache_lock);
+      return -1;
+    }
+
+  return 0;
+}
+
+/* Returns the absolute path in XDG_<TYPE>_DIR, or NULL if it isn't set
+ * to one
+ */
+static const char *
+env_lookup (const char *type)
+{
+  char name[256];
+  const char *path;
+  size_t len;
+
+  len = strlen (type);
+  if (len + sizeof ("XDG__DIR") > sizeof (name) || !user_dirs_type_is_env (type))
+    return NULL;
+
+  memcpy (name, "XDG_", 4);
+  memcpy (name + 4, type, len);
+  memcpy (name + 4 + len, "_DIR", sizeof ("_DIR"));
+
+  path = getenv (name);
+  if (path == NULL || path[0] != '/')
+    return NULL;
+  return path;
+}
+
+/**
+ * xdg_user_dir_lookup_with_fallback:
+ * @type: a string specifying the type of directory
+ * @fallback: value to use if the directory isn't specified by the user
+ * @returns: a newly allocated absolute pathname
+ *
+ * Looks up a XDG user directory of the specified type.
+ * Example of types are "DESKTOP" and "DOWNLOAD".
+ *
+ * In case the user hasn't specified any directory for the specified
+ * type the value returned is @fallback.
+ *
+ * If the environment variable XDG_<TYPE>_DIR is set to an absolute
+ * path, e.g. XDG_DESKTOP_DIR for "DESKTOP", that is returned without
+ * reading the configuration.
+ *
+ * The return value is newly allocated and must be freed with
+ * free(). The return value is never NULL if @fallback != NULL, unless
+ * out of memory.
+ *
+ * The configuration is parsed once and kept in memory until it
+ * changes on disk. This function may be called from several threads
+ * at once.
+ **/
+char *
+xdg_user_dir_lookup_with_fallback (const char *type, const char *fallback)
+{
+  Entry **found;
+  const char *path;
+  char *user_dir;
+
+  path = env_lookup (type);
+  if (path)
+    return strdup (path);
+
+  user_dir = NULL;
+  if (lock_cache () == 0)
+    {
+      if (cache->snapshot)
+        {
+          path = snapshot_lookup (cache->snapshot, type);
+          if (path)
+            user_dir = strdup (path);
+        }
+      else if (cache->n_entries > 0)
+        {
+          found = bsearch (type, cache->sorted, cache->n_entries,
+                           sizeof (Entry *), compare_type);
+          if (found)
+            user_dir = strdup ((*found)->path);
+        }
+      pthread_rwlock_unlock (&cache_lock);
+    }
+
+  if (user_dir)
+    return user_dir;
+
+  if (fallback)
+    return strdup (fallback);
+  return NULL;
+}
+
+/**
+ * xdg_user_dir_lookup:
+ * @type: a string specifying the type of directory
+ * @returns: a newly allocated absolute pathname
+ *
+ * Looks up a XDG user directory of the specified type.
+ * Example of types are "DESKTOP" and "DOWNLOAD".
+ *
+ * The return value is always != NULL (unless out of memory),
+ * and if a directory
+ * for the type is not specified by the user the default
+ * is the home directory. Except for DESKTOP which defaults
+ * to ~/Desktop.
+ *
+ * The return value is newly allocated and must be freed with
+ * free().
+ **/
+char *
+xdg_user_dir_lookup (const char *type)
+{
+  char *dir;
+  const char *home_dir;
+
+  dir = xdg_user_dir_lookup_with_fallback (type, NULL);
+  if (dir != NULL)
+    return dir;
+
+  home_dir = get_home_dir ();
+  if (home_dir == NULL)
+    return strdup ("/tmp");
+
+  /* Special case desktop for historical compatibility */
+  if (strcmp (type, "DESKTOP") == 0)
+    return build_path (home_dir, "Desktop");
+
+  return strdup (home_dir);
+}
+
+/**
+ * xdg_user_dirs_foreach:
+ * @func: function to call for each directory
+ * @user_data: data to pass to @func
+ *
+ * Calls @func for each directory the user has configured, in the
+ * order of the configuration file, with its absolute path. If a type
+ * is listed several times only the first one is used. As with
+ * xdg_user_dir_lookup(), XDG_<TYPE>_DIR in the environment takes
+ * precedence over the path in the file.
+ *
+ * @func must not call back into this library.
+ **/
+void
+xdg_user_dirs_foreach (XdgUserDirsFunc func, void *user_data)
+{
+  const XdgUserDirsSnapshotHeader *snapshot;
+  const XdgUserDirsSnapshotEntry *entries;
+  const char *type, *path;
+  size_t i;
+
+  if (lock_cache () != 0)
+    return;
+
+  snapshot = cache->snapshot;
+  if (snapshot)
+    {
+      entries = snapshot_entries (snapshot);
+      for (i = 0; i < snapshot->n_entries; i++)
+        {
+          type = snapshot_string (snapshot, entries[i].type);
+          path = env_lookup (type);
+          func (type, path ? path : snapshot_string (snapshot, entries[i].path),
+                user_data);
+        }
+    }
+
+  for (i = 0; i < cache->n_entries; i++)
+    {
+      path = env_lookup (cache->entries[i].type);
+      func (cache->entries[i].type, path ? path : cache->entries[i].path,
+            user_data);
+    }
+
+  pthread_rwlock_unlock (&cache_lock);
+}
+
+/**
+ * xdg_user_dirs_invalidate:
+ *
+ * Drops the in-memory copy of the configuration, so that it is read
+ * again on the next lookup. This is not needed to notice changes to
+ * the file, but can be used to release the memory.
+ **/
+void
+xdg_user_dirs_invalidate (void)
+{
+  pthread_rwlock_wrlock (&cache_lock);
+  cache_free (cache);
+  cache = NULL;
+  pthread_rwlock_unlock (&cache_lock);
+}
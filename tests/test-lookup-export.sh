@@ -0,0 +1,64 @@
+#!/bin/sh
+# Checks that xdg-user-dir --format=export prints nothing but valid
+# assignments, whatever the types in user-dirs.dirs or on the command
+# line, as its output is meant for eval.
+#
+# Environment:
+#   LOOKUP  the xdg-user-dir to test (default: ../xdg-user-dir)
+
+set -e
+
+LOOKUP=${LOOKUP:-../xdg-user-dir}
+
+tmpdir=`mktemp -d "${TMPDIR:-/tmp}/xdg-user-dirs-test.XXXXXX"`
+trap 'rm -rf "$tmpdir"' EXIT
+trap 'exit 1' HUP INT TERM
+
+HOME="$tmpdir/home"
+XDG_CONFIG_HOME="$HOME/.config"
+export HOME XDG_CONFIG_HOME
+unset XDG_RUNTIME_DIR
+unset XDG_DESKTOP_DIR XDG_DOWNLOAD_DIR XDG_TEMPLATES_DIR XDG_PUBLICSHARE_DIR XDG_DOCUMENTS_DIR XDG_MUSIC_DIR XDG_PICTURES_DIR XDG_VIDEOS_DIR
+mkdir -p "$XDG_CONFIG_HOME"
+
+# Keys can hold anything but whitespace and =
+cat > "$XDG_CONFIG_HOME/user-dirs.dirs" <<'EOF'
+XDG_DESKTOP_DIR="$HOME/Desktop"
+XDG_X;:>pwned;_DIR="$HOME/x"
+XDG_$(:>pwned)_DIR="$HOME/x"
+XDG_RUNTIME_DIR="$HOME/run"
+org.example.App.desktop="$HOME/App"
+XDG_MUSIC_DIR="$HOME/it's"
+EOF
+
+fail ()
+{
+	echo "$0: $*" >&2
+	exit 1
+}
+
+# expect DESCRIPTION EXPECTED ARG...
+expect ()
+{
+	description=$1
+	expected=$2
+	shift 2
+
+	output=`cd "$tmpdir" && "$LOOKUP" --format=export "$@"`
+	test "$output" = "$expected" || fail "$description: expected
+$expected
+got
+$output"
+
+	(cd "$tmpdir" && eval "$output" && test "$XDG_MUSIC_DIR" = "${expected_music-$XDG_MUSIC_DIR}") ||
+		fail "$description: evaluating the output failed"
+	test ! -e "$tmpdir/pwned" || fail "$description: the output ran a command"
+}
+
+expected_music="$HOME/it's"
+expect "--all" "export XDG_DESKTOP_DIR='$HOME/Desktop'
+export XDG_MUSIC_DIR='$HOME/it'\\''s'" --all
+
+unset expected_music
+expect "types from the command line" "export XDG_DESKTOP_DIR='$HOME/Desktop'" \
+	'X;:>pwned;' '$(:>pwned)' RUNTIME org.example.App.desktop DESKTOP
@@ -0,0 +1,420 @@
+/* Tests for the tokenizer that all configuration files are parsed with.
+ *
+ * A small corpus of user-dirs.dirs lines covers quoting, $HOME/
+ * prefixes, comments, CRLF line ends and overlong lines. The scanners
+ * that skip over ordinary bytes, one by one, 8 at a time and 16 at a
+ * time with SSE2, are compared with each other with a special byte at
+ * every position around the 8 and 16 byte boundaries. Escaping,
+ * unescaping, path slicing and the ASCII check are compared with the
+ * byte by byte loops they replaced on random strings, and so is the
+ * check for converters that keep ASCII as it is.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <iconv.h>
+
+#include "user-dirs-tokenizer.h"
+#include "user-dirs-io.h"
+
+static int failures = 0;
+
+static void
+fail (const char *what, const char *str, size_t len)
+{
+  size_t i;
+
+  printf ("FAIL: %s for \"", what);
+  for (i = 0; i < len; i++)
+    {
+      if (str[i] >= ' ' && str[i] <= '~' && str[i] != '"' && str[i] != '\\')
+        putchar (str[i]);
+      else
+        printf ("\\x%02x", (unsigned char) str[i]);
+    }
+  printf ("\"\n");
+  failures++;
+}
+
+static void
+append_entry (const char *type, const char *path, void *user_data)
+{
+  char *result = user_data;
+
+  strcat (result, type);
+  strcat (result, "=");
+  strcat (result, path);
+  strcat (result, "\n");
+}
+
+/* Parses an exactly sized copy of contents, with the one byte more
+ * that the parser may terminate the last entry with, so overreads are
+ * caught by the tools. Compares the entries found with expected.
+ */
+static void
+check_parse (const char *what, const char *contents, size_t len,
+             const char *expected)
+{
+  char *buffer, *result;
+
+  buffer = malloc (len + 1);
+  memcpy (buffer, contents, len);
+  result = malloc (len + 1);
+  *result = 0;
+
+  user_dirs_parse_dirs (buffer, len, append_entry, result);
+  if (strcmp (result, expected) != 0)
+    {
+      fail (what, contents, len);
+      printf ("expected:\n%sgot:\n%s", expected, result);
+    }
+
+  free (result);
+  free (buffer);
+}
+
+static const char corpus[] =
+  "# This file is written by xdg-user-dirs-update\n"
+  "XDG_DESKTOP_DIR=\"$HOME/Desktop\"\n"
+  "  # XDG_COMMENTED_DIR=\"$HOME/Commented\"\n"
+  "\n"
+  "\t\n"
+  "XDG_DOWNLOAD_DIR = \"$HOME/Down loads\"\t\n"
+  "XDG_TEMPLATES_DIR=\"$HOME/\"\n"
+  "XDG_PUBLICSHARE_DIR=\"$HOME\"\n"
+  "XDG_DOCUMENTS_DIR=\"/srv/Documents\"\n"
+  "XDG_MUSIC_DIR=\"$HOME/Music \\\"live\\\" \\$5 \\`x\\` \\\\\"\n"
+  "XDG_PICTURES_DIR=\"$HOME//Pictures\"\n"
+  "XDG_VIDEOS_DIR=\"$HOMEVideos\"\n"
+  "XDG_RELATIVE_DIR=\"Relative\"\n"
+  "XDG_UNQUOTED_DIR=$HOME/Unquoted\n"
+  "XDG_EMPTY_DIR=\n"
+  "NOT_A_DIR=\"$HOME/Not\"\n"
+  "org.example.App.desktop=\"$HOME/App\"\n"
+  "XDG_TRAILING_DIR=\"$HOME/Trailing\" # a comment\n"
+  "XDG_LAST_DIR=\"$HOME/Last\"";
+
+static const char corpus_entries[] =
+  "DESKTOP=Desktop\n"
+  "DOWNLOAD=Down loads\n"
+  "TEMPLATES=\n"
+  "PUBLICSHARE=\n"
+  "DOCUMENTS=/srv/Documents\n"
+  "MUSIC=Music \"live\" $5 `x` \\\n"
+  "PICTURES=Pictures\n"
+  "org.example.App.desktop=App\n"
+  "TRAILING=Trailing\n"
+  "LAST=Last\n";
+
+static void
+test_corpus (void)
+{
+  char *crlf, *d;
+  const char *s;
+
+  check_parse ("corpus", corpus, strlen (corpus), corpus_entries);
+
+  crlf = malloc (sizeof (corpus) * 2);
+  for (s = corpus, d = crlf; *s; s++)
+    {
+      if (*s == '\n')
+        *d++ = '\r';
+      *d++ = *s;
+    }
+  check_parse ("corpus with CRLF", crlf, d - crlf, corpus_entries);
+  free (crlf);
+
+  check_parse ("empty file", "", 0, "");
+  s = "# XDG_X_DIR=\"$HOME/x\"";
+  check_parse ("only a comment", s, strlen (s), "");
+  s = "XDG_X_DIR=\"$HOME/x";
+  check_parse ("unterminated quote", s, strlen (s), "X=x\n");
+}
+
+/* A path much longer than a line is usually, with escapes around the
+ * vector boundaries, followed by another entry
+ */
+static void
+test_overlong_line (void)
+{
+  char *contents, *expected, *c, *e;
+  int i;
+
+  contents = malloc (40000);
+  expected = malloc (40000);
+  c = contents + sprintf (contents, "XDG_LONG_DIR=\"$HOME/");
+  e = expected + sprintf (expected, "LONG=");
+  for (i = 0; i < 8192; i++)
+    {
+      if (i % 61 == 15 || i % 61 == 16)
+        {
+          *c++ = '\\';
+          *c++ = "$`\\\""[i % 4];
+          *e++ = "$`\\\""[i % 4];
+        }
+      else
+        *c++ = *e++ = i % 64 == 63 ? '/' : 'a' + i % 26;
+    }
+  c += sprintf (c, "\"\nXDG_NEXT_DIR=\"$HOME/Next\"\n");
+  sprintf (e, "\nNEXT=Next\n");
+
+  check_parse ("overlong line", contents, c - contents, expected);
+  free (expected);
+  free (contents);
+}
+
+/* Escaped specials at every position around the 16 byte boundaries of
+ * the path, and of the line
+ */
+static void
+test_path_boundaries (void)
+{
+  static const char specials[] = "\"\\$`";
+  char contents[128], expected[128];
+  int offset, i, len;
+
+  for (offset = 0; offset < 40; offset++)
+    for (i = 0; i < 4; i++)
+      {
+        len = sprintf (contents, "XDG_B_DIR=\"$HOME/%.*s\\%cz\"\n",
+                       offset, "0123456789012345678901234567890123456789",
+                       specials[i]);
+        sprintf (expected, "B=%.*s%cz\n",
+                 offset, "0123456789012345678901234567890123456789",
+                 specials[i]);
+        check_parse ("escape near a boundary", contents, len, expected);
+      }
+}
+
+static void
+check_scanners (const char *str, size_t len)
+{
+  const char *end, *expected;
+  char *buffer;
+
+  /* Exactly sized, so overreads are caught by the tools */
+  buffer = malloc (len > 0 ? len : 1);
+  memcpy (buffer, str, len);
+  end = buffer + len;
+
+  expected = user_dirs_scan_special_scalar (buffer, end);
+  if (user_dirs_scan_special_swar (buffer, end) != expected)
+    fail ("SWAR scanner differs", str, len);
+#ifdef __SSE2__
+  if (user_dirs_scan_special_sse2 (buffer, end) != expected)
+    fail ("SSE2 scanner differs", str, len);
+#endif
+  if (user_dirs_scan_special (buffer, end) != expected)
+    fail ("scanner differs", str, len);
+
+  free (buffer);
+}
+
+static void
+test_scanners (void)
+{
+  static const char specials[] = "\"\\$`\n";
+  char str[64];
+  size_t len, pos;
+  int i;
+
+  for (len = 0; len < sizeof (str); len++)
+    {
+      memset (str, 'a', len);
+      check_scanners (str, len);
+
+      /* Bytes close to the specials don't count */
+      for (pos = 0; pos < len; pos++)
+        {
+          str[pos] = pos % 2 ? '#' : '\xa2';
+          check_scanners (str, len);
+          str[pos] = 'a';
+        }
+
+      for (pos = 0; pos < len; pos++)
+        for (i = 0; i < 5; i++)
+          {
+            str[pos] = specials[i];
+            check_scanners (str, len);
+
+            /* And a second one further on */
+            if (pos + 9 < len)
+              {
+                str[pos + 9] = specials[4 - i];
+                check_scanners (str, len);
+                check_scanners (str + pos + 1, len - pos - 1);
+                str[pos + 9] = 'a';
+              }
+            str[pos] = 'a';
+          }
+    }
+}
+
+static size_t
+reference_escape (const char *str, size_t len, char *dest)
+{
+  char *d = dest;
+  size_t i;
+
+  for (i = 0; i < len; i++)
+    {
+      if (str[i] == '$' || str[i] == '`' || str[i] == '\\')
+        *d++ = '\\';
+      *d++ = str[i];
+    }
+  *d = 0;
+  return d - dest;
+}
+
+static size_t
+reference_unescape (const char *s, size_t len, char *dest)
+{
+  const char *end = s + len;
+  char *d = dest;
+
+  while (s < end)
+    {
+      if (*s == '\\' && s + 1 < end)
+        s++;
+      *d++ = *s++;
+    }
+  *d = 0;
+  return d - dest;
+}
+
+/* The length of the path in a value starting after the opening quote */
+static size_t
+reference_path_len (const char *p, size_t len)
+{
+  const char *start = p, *end = p + len;
+
+  while (p < end && *p != '"')
+    {
+      if (*p == '\\' && p + 1 < end)
+        p++;
+      p++;
+    }
+  return p - start;
+}
+
+static int
+reference_is_ascii (const char *str, size_t len)
+{
+  size_t i;
+
+  for (i = 0; i < len; i++)
+    if ((unsigned char) str[i] > 127)
+      return 0;
+  return 1;
+}
+
+static void
+check_strings (const char *str, size_t len)
+{
+  char expected[256], result[256], *value;
+  UserDirsSlice slice, path;
+  size_t expected_len, result_len;
+
+  expected_len = reference_escape (str, len, expected);
+  result_len = user_dirs_escape (str, len, result);
+  if (result_len != expected_len || memcmp (result, expected, expected_len + 1) != 0)
+    fail ("escape differs", str, len);
+
+  slice.str = str;
+  slice.len = len;
+  expected_len = reference_unescape (str, len, expected);
+  result_len = user_dirs_unescape (&slice, result);
+  if (result_len != expected_len || memcmp (result, expected, expected_len + 1) != 0)
+    fail ("unescape differs", str, len);
+
+  /* In place, as libxdg-user-dirs does it */
+  memcpy (result, str, len);
+  slice.str = result;
+  result_len = user_dirs_unescape (&slice, result);
+  if (result_len != expected_len || memcmp (result, expected, expected_len + 1) != 0)
+    fail ("unescape in place differs", str, len);
+
+  /* Exactly sized, so overreads are caught by the tools */
+  value = malloc (len + 2);
+  value[0] = '"';
+  value[1] = '/';
+  memcpy (value + 2, str, len);
+  slice.str = value;
+  slice.len = len + 2;
+  if (!user_dirs_slice_path (&slice, &path) ||
+      path.str != value + 1 ||
+      path.len != reference_path_len (value + 1, len + 1))
+    fail ("path differs", str, len);
+  free (value);
+
+  if (!user_dirs_is_ascii (str, len) != !reference_is_ascii (str, len))
+    fail ("is_ascii differs", str, len);
+}
+
+/* Random strings of every length up to 100 bytes, built from the
+ * special characters, ASCII and UTF-8 bytes, so that each position of
+ * a vector and the scalar tails are covered
+ */
+static void
+test_strings (void)
+{
+  static const char alphabet[] = "\"\\$`\nab/ .\303\251";
+  char str[100];
+  unsigned int i;
+  size_t j, len;
+
+  srand (1);
+  for (i = 0; i < 100000; i++)
+    {
+      len = i % sizeof (str);
+      for (j = 0; j < len; j++)
+        {
+          /* Mostly ordinary bytes, so whole vectors get skipped too */
+          if (rand () % 4 != 0)
+            str[j] = 'a' + rand () % 26;
+          else
+            str[j] = alphabet[rand () % (sizeof (alphabet) - 1)];
+        }
+      check_strings (str, len);
+    }
+}
+
+static void
+check_converter (const char *to, const char *from, int expected)
+{
+  iconv_t converter;
+
+  converter = iconv_open (to, from);
+  if (converter == (iconv_t)(-1))
+    {
+      printf ("SKIP: no converter from %s to %s\n", from, to);
+      return;
+    }
+  if (!user_dirs_converter_keeps_ascii (converter) != !expected)
+    fail ("converter_keeps_ascii", to, strlen (to));
+  iconv_close (converter);
+}
+
+static void
+test_converters (void)
+{
+  check_converter ("UTF-8", "UTF-8", 1);
+  check_converter ("ISO-8859-1", "UTF-8", 1);
+  check_converter ("UTF-16LE", "UTF-8", 0);
+  check_converter ("UTF-32", "UTF-8", 0);
+}
+
+int
+main (void)
+{
+  test_corpus ();
+  test_overlong_line ();
+  test_path_boundaries ();
+  test_scanners ();
+  test_strings ();
+  test_converters ();
+
+  return failures > 0 ? 1 : 0;
+}
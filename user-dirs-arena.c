@@ -0,0 +1,273 @@
+#include <config.h>
+
+#include <stdarg.h>
+#include <string.h>
+#include <glib.h>
+
+#include "user-dirs-arena.h"
+
+#define FIRST_BLOCK_SIZE 2048
+#define MAX_BLOCK_SIZE (64 * 1024)
+
+typedef struct _Block Block;
+
+struct _Block {
+  Block *next;
+  gsize size;
+  gsize used;
+};
+
+/* Keeps the data after the block header aligned */
+#define BLOCK_HEADER_SIZE \
+  ((sizeof (Block) + G_MEM_ALIGN - 1) & ~(gsize) (G_MEM_ALIGN - 1))
+
+struct _UserDirsArena {
+  Block *blocks; /* the current block first */
+  gsize next_block_size;
+  guint64 allocations;
+  guint64 bytes;
+};
+
+/* Only updated when an arena is freed, so allocating doesn't touch
+ * any shared state.
+ */
+G_LOCK_DEFINE_STATIC (stats);
+static UserDirsArenaStats stats;
+
+UserDirsArena *
+user_dirs_arena_new (void)
+{
+  UserDirsArena *arena;
+
+  arena = g_new0 (UserDirsArena, 1);
+  arena->next_block_size = FIRST_BLOCK_SIZE;
+  return arena;
+}
+
+void
+user_dirs_arena_free (UserDirsArena *arena)
+{
+  Block *block, *next;
+  guint64 n_blocks = 0;
+
+  for (block = arena->blocks; block != NULL; block = next)
+    {
+      next = block->next;
+      g_free (block);
+      n_blocks++;
+    }
+
+  G_LOCK (stats);
+  stats.allocations += arena->allocations;
+  stats.blocks += n_blocks;
+  stats.block_bytes += arena->bytes;
+  stats.peak_bytes = MAX (stats.peak_bytes, arena->bytes);
+  G_UNLOCK (stats);
+
+  g_free (arena);
+}
+
+static Block *
+add_block (UserDirsArena *arena, gsize min_size)
+{
+  Block *block;
+  gsize size;
+
+  size = arena->next_block_size;
+  if (size < MAX_BLOCK_SIZE)
+    arena->next_block_size *= 2;
+
+  /* Large allocations get a block of their own, behind the current one,
+   * so the rest of the current block isn't wasted.
+   */
+  if (min_size > size / 4)
+    {
+      block = g_malloc (BLOCK_HEADER_SIZE + min_size);
+      block->size = min_size;
+      block->used = 0;
+      if (arena->blocks)
+        {
+          block->next = arena->blocks->next;
+          arena->blocks->next = block;
+        }
+      else
+        {
+          block->next = NULL;
+          arena->blocks = block;
+        }
+      arena->bytes += min_size;
+      return block;
+    }
+
+  block = g_malloc (BLOCK_HEADER_SIZE + size);
+  block->size = size;
+  block->used = 0;
+  block->next = arena->blocks;
+  arena->blocks = block;
+  arena->bytes += size;
+  return block;
+}
+
+/* Returns zeroed memory that lives as long as the arena */
+gpointer
+user_dirs_arena_alloc (UserDirsArena *arena, gsize size)
+{
+  Block *block;
+  char *mem;
+
+  size = (size + G_MEM_ALIGN - 1) & ~(gsize) (G_MEM_ALIGN - 1);
+
+  block = arena->blocks;
+  if (block == NULL || block->size - block->used < size)
+    block = add_block (arena, size);
+
+  mem = (char *) block + BLOCK_HEADER_SIZE + block->used;
+  block->used += size;
+  arena->allocations++;
+
+  memset (mem, 0, size);
+  return mem;
+}
+
+char *
+user_dirs_arena_strndup (UserDirsArena *arena, const char *str, gsize len)
+{
+  char *copy;
+
+  copy = user_dirs_arena_alloc (arena, len + 1);
+  memcpy (copy, str, len);
+  return copy;
+}
+
+char *
+user_dirs_arena_strdup (UserDirsArena *arena, const char *str)
+{
+  if (str == NULL)
+    return NULL;
+
+  return user_dirs_arena_strndup (arena, str, strlen (str));
+}
+
+char *
+user_dirs_arena_strconcat (UserDirsArena *arena, const char *first, ...)
+{
+  va_list args;
+  const char *s;
+  gsize len;
+  char *res, *p;
+
+  len = 0;
+  va_start (args, first);
+  for (s = first; s != NULL; s = va_arg (args, const char *))
+    len += strlen (s);
+  va_end (args);
+
+  res = user_dirs_arena_alloc (arena, len + 1);
+
+  p = res;
+  va_start (args, first);
+  for (s = first; s != NULL; s = va_arg (args, const char *))
+    p = g_stpcpy (p, s);
+  va_end (args);
+
+  return res;
+}
+
+/* Like g_build_filename(), joins the elements with single slashes.
+ * Unlike it, trailing slashes are always dropped.
+ */
+char *
+user_dirs_arena_build_filename (UserDirsArena *arena, const char *first, ...)
+{
+  va_list args;
+  const char *s, *start, *end;
+  gsize len;
+  char *res, *p;
+  gboolean started;
+
+  len = 0;
+  va_start (args, first);
+  for (s = first; s != NULL; s = va_arg (args, const char *))
+    len += strlen (s) + 1;
+  va_end (args);
+
+  res = user_dirs_arena_alloc (arena, len + 1);
+
+  p = res;
+  started = FALSE;
+  va_start (args, first);
+  for (s = first; s != NULL; s = va_arg (args, const char *))
+    {
+      start = s;
+      end = s + strlen (s);
+
+      /* Only the first non-empty element keeps its leading slashes */
+      if (started)
+        while (*start == '/')
+          start++;
+
+      while (end > start && end[-1] == '/')
+        end--;
+
+      if (start == end)
+        {
+          /* An element made of slashes only still counts */
+          if (*s != 0 && !started)
+            {
+              *p++ = '/';
+              started = TRUE;
+            }
+          continue;
+        }
+
+      if (p > res && p[-1] != '/')
+        *p++ = '/';
+      memcpy (p, start, end - start);
+      p += end - start;
+      started = TRUE;
+    }
+  va_end (args);
+
+  *p = 0;
+  return res;
+}
+
+char *
+user_dirs_arena_printf (UserDirsArena *arena, const char *format, ...)
+{
+  va_list args;
+  char buffer[256];
+  char *res;
+  int len;
+
+  va_start (args, format);
+  len = g_vsnprintf (buffer, sizeof (buffer), format, args);
+  va_end (args);
+
+  res = user_dirs_arena_alloc (arena, len + 1);
+  if (len < (int) sizeof (buffer))
+    memcpy (res, buffer, len);
+  else
+    {
+      va_start (args, format);
+      g_vsnprintf (res, len + 1, format, args);
+      va_end (args);
+    }
+
+  return res;
+}
+
+guint64
+user_dirs_arena_n_allocations (UserDirsArena *arena)
+{
+  return arena->allocations;
+}
+
+/* Arenas that are still in use are not included */
+void
+user_dirs_arena_get_stats (UserDirsArenaStats *stats_out)
+{
+  G_LOCK (stats);
+  *stats_out = stats;
+  G_UNLOCK (stats);
+}
@@ -0,0 +1,46 @@
+#ifndef __USER_DIRS_ARENA_H__
+#define __USER_DIRS_ARENA_H__
+
+#include <glib.h>
+
+/* An arena hands out memory from a few large blocks and frees all of
+ * it at once. Each job allocates its directories and temporary strings
+ * from its own arena, so nothing needs to be freed individually and
+ * jobs running in parallel don't compete for the malloc lock.
+ *
+ * An arena must only be used by one thread at a time.
+ */
+
+typedef struct _UserDirsArena UserDirsArena;
+
+/* Totals over all arenas of the process */
+typedef struct {
+  guint64 allocations; /* served from arenas */
+  guint64 blocks;      /* malloc() calls made by arenas */
+  guint64 block_bytes;
+  guint64 peak_bytes;  /* largest size of a single arena */
+} UserDirsArenaStats;
+
+UserDirsArena *user_dirs_arena_new            (void);
+void           user_dirs_arena_free           (UserDirsArena      *arena);
+gpointer       user_dirs_arena_alloc          (UserDirsArena      *arena,
+                                               gsize               size);
+char          *user_dirs_arena_strdup         (UserDirsArena      *arena,
+                                               const char         *str);
+char          *user_dirs_arena_strndup        (UserDirsArena      *arena,
+                                               const char         *str,
+                                               gsize               len);
+char          *user_dirs_arena_strconcat      (UserDirsArena      *arena,
+                                               const char         *first,
+                                               ...) G_GNUC_NULL_TERMINATED;
+char          *user_dirs_arena_build_filename (UserDirsArena      *arena,
+                                               const char         *first,
+                                               ...) G_GNUC_NULL_TERMINATED;
+char          *user_dirs_arena_printf         (UserDirsArena      *arena,
+                                               const char         *format,
+                                               ...) G_GNUC_PRINTF (2, 3);
+
+guint64        user_dirs_arena_n_allocations  (UserDirsArena      *arena);
+void           user_dirs_arena_get_stats      (UserDirsArenaStats *stats);
+
+#endif /* __USER_DIRS_ARENA_H__ */
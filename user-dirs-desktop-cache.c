@@ -0,0 +1,629 @@
+#include <config.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+
+#include "user-dirs-arena.h"
+#include "user-dirs-desktop-cache.h"
+#include "user-dirs-fields.h"
+#include "user-dirs-stats.h"
+
+/* The cache is a text file. After the header, each directory is a
+ * "D" line with its path and identity, followed by an "F" line per
+ * .desktop file in it, and an "N" line per name of that file:
+ *
+ *   D <path> <dev> <ino> <mtime>
+ *   F <desktop id> <dev> <ino> <mtime> <size> [<parent>]
+ *   N <locale> <name>
+ *
+ * Fields are separated by tabs, with tabs, newlines and backslashes
+ * in them escaped. Files that can't be used have no parent, so they
+ * are only parsed again when they change.
+ *
+ * Like the stamp, this relies on the mtime of the directory changing
+ * when files are added, removed or replaced, which is how packages
+ * install them. A file edited in place is only noticed once something
+ * else in its directory changes, or after --update-desktop-cache.
+ */
+
+#define CACHE_HEADER "xdg-user-dirs desktop cache 1\n"
+
+/* Parsing a file is quick, so a few threads are enough for the
+ * hundreds of files a system may have, and starting them isn't worth
+ * it for a few
+ */
+#define MAX_PARSER_THREADS 4
+#define MIN_FILES_PER_THREAD 16
+
+typedef struct {
+  const char *path;
+  const char *identity;
+  GPtrArray *entries; /* all .desktop files */
+  GPtrArray *usable;  /* those with a parent and a name, once known */
+} Section;
+
+struct _UserDirsDesktopCache {
+  UserDirsArena *arena;
+  GPtrArray *arenas;   /* of the parser threads */
+  GPtrArray *buffers;  /* contents of the loaded files */
+  GPtrArray *sections; /* loaded ones first, in the order loaded */
+  GPtrArray *current;  /* the ones looked up, which are saved */
+  gboolean dirty;
+};
+
+UserDirsDesktopCache *
+user_dirs_desktop_cache_new (void)
+{
+  UserDirsDesktopCache *cache;
+
+  cache = g_new0 (UserDirsDesktopCache, 1);
+  cache->arena = user_dirs_arena_new ();
+  cache->arenas = g_ptr_array_new ();
+  cache->buffers = g_ptr_array_new ();
+  cache->sections = g_ptr_array_new ();
+  cache->current = g_ptr_array_new ();
+  return cache;
+}
+
+static void
+section_free (Section *section)
+{
+  g_ptr_array_free (section->entries, TRUE);
+  if (section->usable != NULL)
+    g_ptr_array_free (section->usable, TRUE);
+}
+
+void
+user_dirs_desktop_cache_free (UserDirsDesktopCache *cache)
+{
+  g_ptr_array_foreach (cache->sections, (GFunc) section_free, NULL);
+  g_ptr_array_free (cache->sections, TRUE);
+  g_ptr_array_free (cache->current, TRUE);
+  g_ptr_array_foreach (cache->buffers, (GFunc) g_free, NULL);
+  g_ptr_array_free (cache->buffers, TRUE);
+  g_ptr_array_foreach (cache->arenas, (GFunc) user_dirs_arena_free, NULL);
+  g_ptr_array_free (cache->arenas, TRUE);
+  user_dirs_arena_free (cache->arena);
+  g_free (cache);
+}
+
+gboolean
+user_dirs_desktop_cache_is_dirty (UserDirsDesktopCache *cache)
+{
+  return cache->dirty;
+}
+
+static Section *
+section_new (UserDirsDesktopCache *cache, const char *path, const char *identity)
+{
+  Section *section;
+
+  section = user_dirs_arena_alloc (cache->arena, sizeof (Section));
+  section->path = path;
+  section->identity = identity;
+  section->entries = g_ptr_array_new ();
+  section->usable = NULL;
+  return section;
+}
+
+/* Collects the usable entries, once all of them are parsed */
+static void
+section_finish (Section *section)
+{
+  UserDirsDesktopEntry *entry;
+  guint i;
+
+  section->usable = g_ptr_array_new ();
+  for (i = 0; i < section->entries->len; i++)
+    {
+      entry = g_ptr_array_index (section->entries, i);
+      if (entry->parent != NULL && entry->n_names > 0)
+        g_ptr_array_add (section->usable, entry);
+    }
+}
+
+static int
+compare_names (const void *a, const void *b)
+{
+  return strcmp (((const UserDirsDesktopName *) a)->locale,
+                 ((const UserDirsDesktopName *) b)->locale);
+}
+
+/* Picks the name like g_key_file_get_locale_string() would */
+const char *
+user_dirs_desktop_entry_get_name (const UserDirsDesktopEntry *entry,
+                                  const char * const         *languages)
+{
+  UserDirsDesktopName key, *found;
+  int i;
+
+  found = NULL;
+  for (i = 0; found == NULL && languages[i] != NULL; i++)
+    {
+      key.locale = languages[i];
+      found = bsearch (&key, entry->names, entry->n_names,
+                       sizeof (UserDirsDesktopName), compare_names);
+    }
+
+  if (found == NULL)
+    {
+      key.locale = "";
+      found = bsearch (&key, entry->names, entry->n_names,
+                       sizeof (UserDirsDesktopName), compare_names);
+    }
+
+  return found ? found->name : NULL;
+}
+
+/* For keeping an entry after its cache is freed */
+UserDirsDesktopEntry *
+user_dirs_desktop_entry_copy (const UserDirsDesktopEntry *entry,
+                              UserDirsArena              *arena)
+{
+  UserDirsDesktopEntry *copy;
+  guint i;
+
+  copy = user_dirs_arena_alloc (arena, sizeof (UserDirsDesktopEntry));
+  copy->desktop_id = user_dirs_arena_strdup (arena, entry->desktop_id);
+  copy->identity = user_dirs_arena_strdup (arena, entry->identity);
+  copy->parent = user_dirs_arena_strdup (arena, entry->parent);
+  copy->n_names = entry->n_names;
+  copy->names = user_dirs_arena_alloc (arena, entry->n_names * sizeof (UserDirsDesktopName));
+  for (i = 0; i < entry->n_names; i++)
+    {
+      copy->names[i].locale = user_dirs_arena_strdup (arena, entry->names[i].locale);
+      copy->names[i].name = user_dirs_arena_strdup (arena, entry->names[i].name);
+    }
+
+  return copy;
+}
+
+static char *
+format_identity (UserDirsDesktopCache *cache, const struct stat *statbuf,
+                 gboolean with_size)
+{
+  if (with_size)
+    return user_dirs_arena_printf (cache->arena, "%lu %lu %ld.%09ld %ld",
+                                   (gulong) statbuf->st_dev,
+                                   (gulong) statbuf->st_ino,
+                                   (long) statbuf->st_mtim.tv_sec,
+                                   (long) statbuf->st_mtim.tv_nsec,
+                                   (long) statbuf->st_size);
+
+  return user_dirs_arena_printf (cache->arena, "%lu %lu %ld.%09ld",
+                                 (gulong) statbuf->st_dev,
+                                 (gulong) statbuf->st_ino,
+                                 (long) statbuf->st_mtim.tv_sec,
+                                 (long) statbuf->st_mtim.tv_nsec);
+}
+
+/* Fills in the parent and names of entry. Runs in the parser threads,
+ * so it only allocates from the arena it is given.
+ */
+static void
+parse_desktop_file (UserDirsArena        *arena,
+                    UserDirsDesktopEntry *entry,
+                    const char           *path)
+{
+  GKeyFile *keyfile;
+  char **keys;
+  char *parent, *value;
+  const char *key, *locale;
+  gsize n_keys, i, len;
+
+  /* Without KEEP_TRANSLATIONS only the names for the current locale
+   * would be loaded
+   */
+  keyfile = g_key_file_new ();
+  if (!g_key_file_load_from_file (keyfile, path, G_KEY_FILE_KEEP_TRANSLATIONS, NULL))
+    goto out;
+
+  parent = g_key_file_get_string (keyfile, G_KEY_FILE_DESKTOP_TYPE_DIRECTORY,
+                                  "Parent", NULL);
+  if (parent == NULL)
+    goto out;
+  entry->parent = user_dirs_arena_strdup (arena, parent);
+  g_free (parent);
+
+  keys = g_key_file_get_keys (keyfile, G_KEY_FILE_DESKTOP_TYPE_DIRECTORY, &n_keys, NULL);
+  if (keys == NULL)
+    goto out;
+
+  entry->names = user_dirs_arena_alloc (arena, n_keys * sizeof (UserDirsDesktopName));
+  for (i = 0; i < n_keys; i++)
+    {
+      key = keys[i];
+      len = strlen (key);
+      if (strcmp (key, G_KEY_FILE_DESKTOP_KEY_NAME) == 0)
+        locale = "";
+      else if (g_str_has_prefix (key, G_KEY_FILE_DESKTOP_KEY_NAME "[") && key[len - 1] == ']')
+        locale = user_dirs_arena_strndup (arena, key + 5, len - 6);
+      else
+        continue;
+
+      /* Names that aren't valid UTF-8 are skipped, like GKeyFile does */
+      value = g_key_file_get_string (keyfile, G_KEY_FILE_DESKTOP_TYPE_DIRECTORY, key, NULL);
+      if (value == NULL)
+        continue;
+
+      entry->names[entry->n_names].locale = locale;
+      entry->names[entry->n_names].name = user_dirs_arena_strdup (arena, value);
+      entry->n_names++;
+      g_free (value);
+    }
+  g_strfreev (keys);
+
+  qsort (entry->names, entry->n_names, sizeof (UserDirsDesktopName), compare_names);
+
+ out:
+  g_key_file_free (keyfile);
+}
+
+/* A file to parse, and the entry to fill in */
+typedef struct {
+  char *path;
+  UserDirsDesktopEntry *entry;
+} ParseTask;
+
+/* A run of tasks parsed by one thread, with an arena of its own */
+typedef struct {
+  ParseTask *tasks;
+  guint n_tasks;
+  UserDirsArena *arena;
+} ParseChunk;
+
+static void
+parse_chunk (gpointer data, gpointer user_data)
+{
+  ParseChunk *chunk = data;
+  guint i;
+
+  for (i = 0; i < chunk->n_tasks; i++)
+    parse_desktop_file (chunk->arena, chunk->tasks[i].entry, chunk->tasks[i].path);
+}
+
+/* Parses the files, on several threads if there are enough of them.
+ * Each entry already has its place in its section, so the results
+ * don't depend on which thread finishes first.
+ */
+static void
+parse_desktop_files (UserDirsDesktopCache *cache, GArray *tasks)
+{
+  ParseChunk *chunks;
+  GThreadPool *pool;
+  guint n_chunks, per_chunk, i;
+
+  n_chunks = MIN (g_get_num_processors (), MAX_PARSER_THREADS);
+  n_chunks = MIN (n_chunks, tasks->len / MIN_FILES_PER_THREAD);
+  if (n_chunks <= 1)
+    {
+      for (i = 0; i < tasks->len; i++)
+        parse_desktop_file (cache->arena,
+                            g_array_index (tasks, ParseTask, i).entry,
+                            g_array_index (tasks, ParseTask, i).path);
+      return;
+    }
+
+  chunks = g_new0 (ParseChunk, n_chunks);
+  per_chunk = (tasks->len + n_chunks - 1) / n_chunks;
+  for (i = 0; i < n_chunks; i++)
+    {
+      chunks[i].tasks = &g_array_index (tasks, ParseTask, i * per_chunk);
+      chunks[i].n_tasks = MIN (per_chunk, tasks->len - MIN (i * per_chunk, tasks->len));
+      chunks[i].arena = user_dirs_arena_new ();
+      g_ptr_array_add (cache->arenas, chunks[i].arena);
+    }
+
+  pool = g_thread_pool_new (parse_chunk, NULL, n_chunks, TRUE, NULL);
+  for (i = 0; i < n_chunks; i++)
+    g_thread_pool_push (pool, &chunks[i], NULL);
+
+  /* Wait for all chunks to be parsed */
+  g_thread_pool_free (pool, FALSE, TRUE);
+  g_free (chunks);
+}
+
+/* Reads the directory again. The files that aren't in old with the
+ * same identity are added to tasks, to be parsed once all directories
+ * have been read.
+ */
+static Section *
+scan_dir (UserDirsDesktopCache *cache,
+          const char           *dir_path,
+          const char           *identity,
+          Section              *old,
+          GArray               *tasks)
+{
+  GHashTable *old_entries;
+  UserDirsDesktopEntry *entry;
+  Section *section;
+  ParseTask task;
+  struct stat statbuf;
+  const char *basename, *file_identity;
+  char *path;
+  GDir *dir;
+  guint i;
+
+  user_dirs_stats_count (USER_DIRS_OP_OPEN);
+  dir = g_dir_open (dir_path, 0, NULL);
+  if (dir == NULL)
+    return NULL;
+
+  old_entries = g_hash_table_new (g_str_hash, g_str_equal);
+  for (i = 0; old != NULL && i < old->entries->len; i++)
+    {
+      entry = g_ptr_array_index (old->entries, i);
+      g_hash_table_insert (old_entries, (char *) entry->desktop_id, entry);
+    }
+
+  section = section_new (cache, user_dirs_arena_strdup (cache->arena, dir_path), identity);
+  while ((basename = g_dir_read_name (dir)) != NULL)
+    {
+      if (!g_str_has_suffix (basename, ".desktop"))
+        continue;
+
+      path = g_build_filename (dir_path, basename, NULL);
+      user_dirs_stats_count (USER_DIRS_OP_STAT);
+      if (stat (path, &statbuf) != 0)
+        {
+          g_free (path);
+          continue;
+        }
+
+      file_identity = format_identity (cache, &statbuf, TRUE);
+      entry = g_hash_table_lookup (old_entries, basename);
+      if (entry != NULL && strcmp (entry->identity, file_identity) == 0)
+        {
+          g_free (path);
+          g_ptr_array_add (section->entries, entry);
+          continue;
+        }
+
+      entry = user_dirs_arena_alloc (cache->arena, sizeof (UserDirsDesktopEntry));
+      memset (entry, 0, sizeof (UserDirsDesktopEntry));
+      entry->desktop_id = user_dirs_arena_strdup (cache->arena, basename);
+      entry->identity = file_identity;
+      g_ptr_array_add (section->entries, entry);
+
+      user_dirs_stats_count (USER_DIRS_OP_OPEN);
+      task.path = path;
+      task.entry = entry;
+      g_array_append_val (tasks, task);
+    }
+
+  g_hash_table_destroy (old_entries);
+  g_dir_close (dir);
+
+  g_ptr_array_add (cache->sections, section);
+  cache->dirty = TRUE;
+  return section;
+}
+
+/* Looks up the directories in dir_paths, and sets entries[i] to the
+ * usable entries for the .desktop files in dir_paths[i], or NULL if it
+ * isn't a directory. They belong to the cache.
+ *
+ * All directories that changed are read first, and then the files
+ * that changed in any of them are parsed together.
+ */
+void
+user_dirs_desktop_cache_lookup (UserDirsDesktopCache *cache,
+                                const char * const   *dir_paths,
+                                guint                 n_dirs,
+                                GPtrArray           **entries)
+{
+  Section **sections, *section, *old;
+  struct stat statbuf;
+  const char *identity;
+  GArray *tasks;
+  guint i, j;
+
+  sections = g_new0 (Section *, n_dirs);
+  tasks = g_array_new (FALSE, FALSE, sizeof (ParseTask));
+
+  for (i = 0; i < n_dirs; i++)
+    {
+      user_dirs_stats_count (USER_DIRS_OP_STAT);
+      if (stat (dir_paths[i], &statbuf) != 0 || !S_ISDIR (statbuf.st_mode))
+        continue;
+
+      identity = format_identity (cache, &statbuf, FALSE);
+      old = NULL;
+      section = NULL;
+      for (j = 0; section == NULL && j < cache->sections->len; j++)
+        {
+          Section *candidate = g_ptr_array_index (cache->sections, j);
+
+          if (strcmp (candidate->path, dir_paths[i]) != 0)
+            continue;
+          if (strcmp (candidate->identity, identity) == 0)
+            section = candidate;
+          else if (old == NULL)
+            old = candidate;
+        }
+
+      if (section == NULL)
+        section = scan_dir (cache, dir_paths[i], identity, old, tasks);
+      sections[i] = section;
+    }
+
+  parse_desktop_files (cache, tasks);
+  for (i = 0; i < tasks->len; i++)
+    g_free (g_array_index (tasks, ParseTask, i).path);
+  g_array_free (tasks, TRUE);
+
+  for (i = 0; i < n_dirs; i++)
+    {
+      entries[i] = NULL;
+      if (sections[i] == NULL)
+        continue;
+
+      if (sections[i]->usable == NULL)
+        section_finish (sections[i]);
+      g_ptr_array_add (cache->current, sections[i]);
+      entries[i] = sections[i]->usable;
+    }
+
+  g_free (sections);
+}
+
+static void
+finish_entry (UserDirsDesktopCache *cache, Section *section,
+              UserDirsDesktopEntry *entry, GArray *names)
+{
+  if (entry == NULL)
+    return;
+
+  entry->n_names = names->len;
+  entry->names = user_dirs_arena_alloc (cache->arena, names->len * sizeof (UserDirsDesktopName));
+  memcpy (entry->names, names->data, names->len * sizeof (UserDirsDesktopName));
+  g_array_set_size (names, 0);
+  g_ptr_array_add (section->entries, entry);
+}
+
+/* Adds the directories cached in cache_file. Those found in several
+ * files are used from the first one that is current. A file that
+ * can't be read or parsed is ignored.
+ */
+void
+user_dirs_desktop_cache_load (UserDirsDesktopCache *cache,
+                              const char           *cache_file)
+{
+  UserDirsDesktopEntry *entry;
+  UserDirsDesktopName name;
+  GPtrArray *sections;
+  Section *section;
+  GArray *names;
+  char *contents, *line, *next, *tag;
+  char *fields[3];
+  gboolean res;
+  int n;
+
+  user_dirs_stats_count (USER_DIRS_OP_OPEN);
+  if (!g_file_get_contents (cache_file, &contents, NULL, NULL))
+    return;
+
+  if (!g_str_has_prefix (contents, CACHE_HEADER))
+    {
+      g_free (contents);
+      return;
+    }
+
+  sections = g_ptr_array_new ();
+  names = g_array_new (FALSE, FALSE, sizeof (UserDirsDesktopName));
+  section = NULL;
+  entry = NULL;
+  res = TRUE;
+
+  for (line = contents + strlen (CACHE_HEADER); res && *line != 0; line = next)
+    {
+      next = strchr (line, '\n');
+      if (next == NULL)
+        {
+          res = FALSE;
+          break;
+        }
+      *next++ = 0;
+
+      tag = user_dirs_fields_next (&line);
+      for (n = 0; n < 3 && (fields[n] = user_dirs_fields_next (&line)) != NULL; n++)
+        ;
+
+      if (strcmp (tag, "D") == 0 && n == 2)
+        {
+          finish_entry (cache, section, entry, names);
+          entry = NULL;
+          section = section_new (cache, fields[0], fields[1]);
+          g_ptr_array_add (sections, section);
+        }
+      else if (strcmp (tag, "F") == 0 && n >= 2 && section != NULL)
+        {
+          finish_entry (cache, section, entry, names);
+          entry = user_dirs_arena_alloc (cache->arena, sizeof (UserDirsDesktopEntry));
+          entry->desktop_id = fields[0];
+          entry->identity = fields[1];
+          entry->parent = n == 3 ? fields[2] : NULL;
+        }
+      else if (strcmp (tag, "N") == 0 && n == 2 && entry != NULL)
+        {
+          name.locale = fields[0];
+          name.name = fields[1];
+          g_array_append_val (names, name);
+        }
+      else
+        res = FALSE;
+    }
+
+  if (res)
+    {
+      finish_entry (cache, section, entry, names);
+      for (n = 0; n < sections->len; n++)
+        g_ptr_array_add (cache->sections, g_ptr_array_index (sections, n));
+      g_ptr_array_add (cache->buffers, contents);
+    }
+  else
+    {
+      g_ptr_array_foreach (sections, (GFunc) section_free, NULL);
+      g_free (contents);
+    }
+
+  g_array_free (names, TRUE);
+  g_ptr_array_free (sections, TRUE);
+}
+
+/* Saves the directories looked up, replacing cache_file */
+gboolean
+user_dirs_desktop_cache_save (UserDirsDesktopCache *cache,
+                              const char           *cache_file,
+                              GError              **error)
+{
+  UserDirsDesktopEntry *entry;
+  Section *section;
+  GString *contents;
+  char *dir;
+  gboolean res;
+  guint i, j, k;
+
+  contents = g_string_new (CACHE_HEADER);
+  for (i = 0; i < cache->current->len; i++)
+    {
+      section = g_ptr_array_index (cache->current, i);
+      g_string_append_c (contents, 'D');
+      user_dirs_fields_append (contents, section->path);
+      user_dirs_fields_append (contents, section->identity);
+      g_string_append_c (contents, '\n');
+
+      for (j = 0; j < section->entries->len; j++)
+        {
+          entry = g_ptr_array_index (section->entries, j);
+          g_string_append_c (contents, 'F');
+          user_dirs_fields_append (contents, entry->desktop_id);
+          user_dirs_fields_append (contents, entry->identity);
+          if (entry->parent != NULL)
+            user_dirs_fields_append (contents, entry->parent);
+          g_string_append_c (contents, '\n');
+
+          for (k = 0; k < entry->n_names; k++)
+            {
+              g_string_append_c (contents, 'N');
+              user_dirs_fields_append (contents, entry->names[k].locale);
+              user_dirs_fields_append (contents, entry->names[k].name);
+              g_string_append_c (contents, '\n');
+            }
+        }
+    }
+
+  dir = g_path_get_dirname (cache_file);
+  g_mkdir_with_parents (dir, 0755);
+  g_free (dir);
+
+  res = g_file_set_contents (cache_file, contents->str, contents->len, error);
+  if (res)
+    cache->dirty = FALSE;
+
+  g_string_free (contents, TRUE);
+  return res;
+}
@@ -0,0 +1,52 @@
+#ifndef __USER_DIRS_DESKTOP_CACHE_H__
+#define __USER_DIRS_DESKTOP_CACHE_H__
+
+#include <glib.h>
+
+#include "user-dirs-arena.h"
+
+/* The .desktop files describing application directories, parsed once
+ * and cached on disk. Each $XDG_DATA_DIRS/xdg-user-dirs directory is
+ * cached with its identity, so if it is unchanged only stat() is
+ * needed to use its cached entries. Otherwise it is read again, and
+ * only the files that changed are parsed, on several threads if there
+ * are many of them.
+ *
+ * The names are cached in all languages, so one cache can be used
+ * for any locale.
+ */
+
+typedef struct _UserDirsDesktopCache UserDirsDesktopCache;
+
+typedef struct {
+  const char *locale; /* "" for the untranslated name */
+  const char *name;
+} UserDirsDesktopName;
+
+typedef struct {
+  const char *desktop_id;
+  const char *identity; /* of the file when it was parsed */
+  const char *parent;   /* the Parent key as is */
+  UserDirsDesktopName *names; /* sorted by locale */
+  guint n_names;
+} UserDirsDesktopEntry;
+
+UserDirsDesktopCache *user_dirs_desktop_cache_new      (void);
+void                  user_dirs_desktop_cache_free     (UserDirsDesktopCache *cache);
+void                  user_dirs_desktop_cache_load     (UserDirsDesktopCache *cache,
+                                                        const char           *cache_file);
+gboolean              user_dirs_desktop_cache_save     (UserDirsDesktopCache *cache,
+                                                        const char           *cache_file,
+                                                        GError              **error);
+gboolean              user_dirs_desktop_cache_is_dirty (UserDirsDesktopCache *cache);
+void                  user_dirs_desktop_cache_lookup   (UserDirsDesktopCache *cache,
+                                                        const char * const   *dir_paths,
+                                                        guint                 n_dirs,
+                                                        GPtrArray           **entries);
+
+const char           *user_dirs_desktop_entry_get_name (const UserDirsDesktopEntry *entry,
+                                                        const char * const         *languages);
+UserDirsDesktopEntry *user_dirs_desktop_entry_copy     (const UserDirsDesktopEntry *entry,
+                                                        UserDirsArena              *arena);
+
+#endif /* __USER_DIRS_DESKTOP_CACHE_H__ */
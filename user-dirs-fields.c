@@ -0,0 +1,53 @@
+#include <config.h>
+
+#include <glib.h>
+
+#include "user-dirs-fields.h"
+
+/* Splits off the next tab separated field of a line and unescapes it
+ * in place. Returns NULL if there are no more.
+ */
+char *
+user_dirs_fields_next (char **line)
+{
+  char *field, *in, *out;
+
+  field = *line;
+  if (field == NULL)
+    return NULL;
+
+  for (in = out = field; *in != 0 && *in != '\t'; in++, out++)
+    {
+      if (*in == '\\' && in[1] != 0)
+        {
+          in++;
+          *out = *in == 't' ? '\t' : *in == 'n' ? '\n' : *in;
+        }
+      else
+        *out = *in;
+    }
+
+  *line = *in == '\t' ? in + 1 : NULL;
+  *out = 0;
+  return field;
+}
+
+/* Appends a tab and the escaped field */
+void
+user_dirs_fields_append (GString *contents, const char *field)
+{
+  const char *p;
+
+  g_string_append_c (contents, '\t');
+  for (p = field; *p != 0; p++)
+    {
+      if (*p == '\t')
+        g_string_append (contents, "\\t");
+      else if (*p == '\n')
+        g_string_append (contents, "\\n");
+      else if (*p == '\\')
+        g_string_append (contents, "\\\\");
+      else
+        g_string_append_c (contents, *p);
+    }
+}
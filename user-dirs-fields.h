@@ -0,0 +1,15 @@
+#ifndef __USER_DIRS_FIELDS_H__
+#define __USER_DIRS_FIELDS_H__
+
+#include <glib.h>
+
+/* Text files made of lines of tab separated fields, with tabs,
+ * newlines and backslashes in the fields escaped, as used for the
+ * desktop cache and plans.
+ */
+
+char *user_dirs_fields_next   (char       **line);
+void  user_dirs_fields_append (GString     *contents,
+                               const char  *field);
+
+#endif /* __USER_DIRS_FIELDS_H__ */
@@ -0,0 +1,663 @@
+#include <config.h>
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <glib.h>
+
+#include "user-dirs-io.h"
+#include "user-dirs-uring.h"
+
+#ifndef O_PATH
+#define O_PATH 0
+#endif
+
+/* Known paths map to their S_IFMT type, or this if they don't exist */
+#define TYPE_MISSING 1
+
+struct _UserDirsRoot {
+  char *path;
+  int fd;
+  GHashTable *known; /* paths as passed in */
+  UserDirsUring *ring;
+  gboolean ring_tried;
+};
+
+UserDirsRoot *
+user_dirs_root_new (const char *path)
+{
+  UserDirsRoot *root;
+
+  root = g_new0 (UserDirsRoot, 1);
+  root->path = g_strdup (path);
+  root->fd = -1;
+  root->known = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  return root;
+}
+
+void
+user_dirs_root_free (UserDirsRoot *root)
+{
+  if (root->fd >= 0)
+    close (root->fd);
+  if (root->ring)
+    user_dirs_uring_free (root->ring);
+  g_hash_table_destroy (root->known);
+  g_free (root->path);
+  g_free (root);
+}
+
+const char *
+user_dirs_root_get_path (UserDirsRoot *root)
+{
+  return root->path;
+}
+
+/* Fails if the directory doesn't exist (yet) */
+gboolean
+user_dirs_root_open (UserDirsRoot *root)
+{
+  if (root->fd < 0)
+    root->fd = open (root->path, O_PATH | O_DIRECTORY | O_CLOEXEC);
+  return root->fd >= 0;
+}
+
+void
+user_dirs_root_forget (UserDirsRoot *root)
+{
+  g_hash_table_remove_all (root->known);
+}
+
+static void
+remember (UserDirsRoot *root, const char *path, mode_t type)
+{
+  g_hash_table_replace (root->known, g_strdup (path), GUINT_TO_POINTER (type));
+}
+
+/* Returns 0 if unknown */
+static mode_t
+lookup_type (UserDirsRoot *root, const char *path)
+{
+  return GPOINTER_TO_UINT (g_hash_table_lookup (root->known, path));
+}
+
+/* Returns the descriptor to pass to the *at() syscalls for path, or -1
+ * with errno set. The root itself is "", and a NULL root stands for
+ * the current directory.
+ */
+static int
+get_dirfd (UserDirsRoot *root, const char **path)
+{
+  if (root == NULL || g_path_is_absolute (*path))
+    return AT_FDCWD;
+
+  if (**path == 0)
+    *path = ".";
+  if (!user_dirs_root_open (root))
+    return -1;
+  return root->fd;
+}
+
+static int
+get_file_type (UserDirsRoot *root, const char *path, mode_t *type)
+{
+#ifdef HAVE_STATX
+  struct statx stx;
+#endif
+  struct stat statbuf;
+  int dirfd;
+
+  dirfd = get_dirfd (root, &path);
+  if (dirfd == -1)
+    return -1;
+
+#ifdef HAVE_STATX
+  /* Only the type is asked for, which may save fetching the rest */
+  if (statx (dirfd, path, 0, STATX_TYPE, &stx) == 0)
+    {
+      *type = stx.stx_mode & S_IFMT;
+      return 0;
+    }
+  if (errno != ENOSYS)
+    return -1;
+#endif
+
+  if (fstatat (dirfd, path, &statbuf, 0) != 0)
+    return -1;
+  *type = statbuf.st_mode & S_IFMT;
+  return 0;
+}
+
+/* Follows symlinks, like g_file_test (path, G_FILE_TEST_EXISTS) */
+gboolean
+user_dirs_root_exists (UserDirsRoot *root, const char *path)
+{
+  mode_t type;
+  int dirfd;
+
+  type = lookup_type (root, path);
+  if (type != 0)
+    return type != TYPE_MISSING;
+
+  dirfd = get_dirfd (root, &path);
+  return dirfd != -1 && faccessat (dirfd, path, F_OK, 0) == 0;
+}
+
+gboolean
+user_dirs_root_is_dir (UserDirsRoot *root, const char *path)
+{
+  mode_t type;
+
+  type = lookup_type (root, path);
+  if (type != 0)
+    return type == S_IFDIR;
+
+  if (get_file_type (root, path, &type) != 0)
+    {
+      if (errno == ENOENT)
+        remember (root, path, TYPE_MISSING);
+      return FALSE;
+    }
+
+  remember (root, path, type);
+  return type == S_IFDIR;
+}
+
+gboolean
+user_dirs_root_is_regular (UserDirsRoot *root, const char *path)
+{
+  mode_t type;
+
+  return get_file_type (root, path, &type) == 0 && type == S_IFREG;
+}
+
+static int
+make_dir (UserDirsRoot *root, const char *path, int mode)
+{
+  const char *at_path = path;
+  int dirfd;
+
+  dirfd = get_dirfd (root, &at_path);
+  if (dirfd == -1)
+    return -1;
+
+  if (mkdirat (dirfd, at_path, mode) == 0)
+    {
+      remember (root, path, S_IFDIR);
+      return 0;
+    }
+
+  if (errno == EEXIST)
+    {
+      g_hash_table_remove (root->known, path);
+      if (user_dirs_root_is_dir (root, path))
+        return 0;
+      errno = ENOTDIR;
+    }
+  return -1;
+}
+
+/* Like g_mkdir_with_parents(), but parents are only looked at when the
+ * directory can't be created directly. If the root itself is missing,
+ * it is created too.
+ */
+int
+user_dirs_root_mkdir_with_parents (UserDirsRoot *root,
+                                   const char   *path,
+                                   int           mode)
+{
+  const char *slash;
+  char *parent;
+  int res;
+
+  if (lookup_type (root, path) == S_IFDIR)
+    return 0;
+
+  if (!g_path_is_absolute (path) && !user_dirs_root_open (root))
+    {
+      if (errno != ENOENT ||
+          g_mkdir_with_parents (root->path, mode) != 0 ||
+          !user_dirs_root_open (root))
+        return -1;
+    }
+
+  if (make_dir (root, path, mode) == 0)
+    return 0;
+  if (errno != ENOENT)
+    return -1;
+
+  slash = strrchr (path, G_DIR_SEPARATOR);
+  while (slash != NULL && slash > path && slash[-1] == G_DIR_SEPARATOR)
+    slash--;
+  if (slash == NULL || slash == path)
+    return -1;
+
+  parent = g_strndup (path, slash - path);
+  res = user_dirs_root_mkdir_with_parents (root, parent, mode);
+  g_free (parent);
+  if (res != 0)
+    return -1;
+
+  return make_dir (root, path, mode);
+}
+
+/* Renames old_path to new_path, or copies it there if they are on
+ * different file systems, see user-dirs-move.h
+ */
+int
+user_dirs_root_move (UserDirsRoot *root,
+                     UserDirsMove *move,
+                     const char   *old_path,
+                     const char   *new_path)
+{
+  int old_dirfd, new_dirfd;
+
+  old_dirfd = get_dirfd (root, &old_path);
+  new_dirfd = get_dirfd (root, &new_path);
+  if (old_dirfd == -1 || new_dirfd == -1)
+    return -1;
+
+  if (user_dirs_move (move, old_dirfd, old_path, new_dirfd, new_path) != 0)
+    return -1;
+
+  /* Whatever was known below the old name is gone */
+  user_dirs_root_forget (root);
+  return 0;
+}
+
+static UserDirsUring *
+get_ring (UserDirsRoot *root)
+{
+  if (!root->ring_tried)
+    {
+      root->ring = user_dirs_uring_new ();
+      root->ring_tried = TRUE;
+    }
+  return root->ring;
+}
+
+/* Whether the prefetch functions do anything */
+gboolean
+user_dirs_root_can_prefetch (UserDirsRoot *root)
+{
+  return get_ring (root) != NULL;
+}
+
+static void
+drop_ring (UserDirsRoot *root)
+{
+  user_dirs_uring_free (root->ring);
+  root->ring = NULL;
+}
+
+/* Collects the paths not known to be directories yet, with the
+ * descriptors and names to pass to the kernel for them
+ */
+static guint
+prepare_batch (UserDirsRoot *root, const char * const *paths, guint n_paths,
+               gboolean unknown_only, const char **batch_paths,
+               const char **at_paths, int *dirfds)
+{
+  const char *at_path;
+  mode_t type;
+  guint i, n;
+
+  for (i = 0, n = 0; i < n_paths; i++)
+    {
+      type = lookup_type (root, paths[i]);
+      if (type == S_IFDIR || (unknown_only && type != 0))
+        continue;
+
+      at_path = paths[i];
+      dirfds[n] = get_dirfd (root, &at_path);
+      if (dirfds[n] == -1)
+        continue;
+      at_paths[n] = at_path;
+      batch_paths[n] = paths[i];
+      n++;
+    }
+
+  return n;
+}
+
+/* Looks up the types of all paths at once where io_uring is available,
+ * so that the lookups that follow are answered from memory. Otherwise
+ * does nothing, and they are looked up one at a time.
+ */
+void
+user_dirs_root_prefetch_types (UserDirsRoot       *root,
+                               const char * const *paths,
+                               guint               n_paths)
+{
+  const char **batch_paths, **at_paths;
+  mode_t *types;
+  int *dirfds, *results;
+  guint i, n;
+
+  if (n_paths == 0 || get_ring (root) == NULL)
+    return;
+
+  batch_paths = g_new (const char *, n_paths);
+  at_paths = g_new (const char *, n_paths);
+  dirfds = g_new (int, n_paths);
+  types = g_new (mode_t, n_paths);
+  results = g_new (int, n_paths);
+
+  n = prepare_batch (root, paths, n_paths, TRUE, batch_paths, at_paths, dirfds);
+  if (n > 0 &&
+      !user_dirs_uring_statx (root->ring, dirfds, at_paths, n, types, results))
+    {
+      drop_ring (root);
+      n = 0;
+    }
+
+  for (i = 0; i < n; i++)
+    {
+      if (results[i] == 0)
+        remember (root, batch_paths[i], types[i]);
+      else if (results[i] == -ENOENT)
+        remember (root, batch_paths[i], TYPE_MISSING);
+    }
+
+  g_free (batch_paths);
+  g_free (at_paths);
+  g_free (dirfds);
+  g_free (types);
+  g_free (results);
+}
+
+/* Creates all directories at once where io_uring is available. Those
+ * whose parent is missing are tried again once others were created,
+ * so parents are only waited for where that is needed, and needn't
+ * come first. Whatever fails is left to
+ * user_dirs_root_mkdir_with_parents() to retry or report.
+ */
+void
+user_dirs_root_prefetch_mkdirs (UserDirsRoot       *root,
+                                const char * const *paths,
+                                guint               n_paths,
+                                int                 mode)
+{
+  const char **pending, **batch_paths, **at_paths;
+  int *dirfds, *results;
+  gboolean progress;
+  guint i, n, n_pending;
+
+  if (n_paths == 0 || get_ring (root) == NULL)
+    return;
+
+  pending = g_new (const char *, n_paths);
+  batch_paths = g_new (const char *, n_paths);
+  at_paths = g_new (const char *, n_paths);
+  dirfds = g_new (int, n_paths);
+  results = g_new (int, n_paths);
+
+  memcpy (pending, paths, n_paths * sizeof (char *));
+  n_pending = n_paths;
+  do
+    {
+      n = prepare_batch (root, pending, n_pending, FALSE, batch_paths, at_paths, dirfds);
+      if (n == 0)
+        break;
+      if (!user_dirs_uring_mkdirat (root->ring, dirfds, at_paths, n, mode, results))
+        {
+          drop_ring (root);
+          break;
+        }
+
+      progress = FALSE;
+      n_pending = 0;
+      for (i = 0; i < n; i++)
+        {
+          if (results[i] == 0)
+            {
+              remember (root, batch_paths[i], S_IFDIR);
+              progress = TRUE;
+            }
+          else if (results[i] == -ENOENT)
+            pending[n_pending++] = batch_paths[i];
+          else
+            g_hash_table_remove (root->known, batch_paths[i]);
+        }
+    }
+  while (progress && n_pending > 0);
+
+  g_free (pending);
+  g_free (batch_paths);
+  g_free (at_paths);
+  g_free (dirfds);
+  g_free (results);
+}
+
+static gboolean
+file_has_contents (int          dirfd,
+                   const char  *path,
+                   const char  *contents,
+                   gsize        len,
+                   struct stat *statbuf)
+{
+  struct stat st;
+  char *buffer;
+  gsize done;
+  ssize_t res;
+  gboolean same;
+  int fd;
+
+  fd = openat (dirfd, path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return FALSE;
+
+  if (fstat (fd, &st) != 0 || !S_ISREG (st.st_mode) || st.st_size != len)
+    {
+      close (fd);
+      return FALSE;
+    }
+
+  buffer = g_malloc (len + 1);
+  done = 0;
+  while (done < len)
+    {
+      res = read (fd, buffer + done, len - done);
+      if (res < 0 && errno == EINTR)
+        continue;
+      if (res <= 0)
+        break;
+      done += res;
+    }
+
+  same = done == len && memcmp (buffer, contents, len) == 0;
+  if (same && statbuf != NULL)
+    *statbuf = st;
+  g_free (buffer);
+  close (fd);
+  return same;
+}
+
+char *
+user_dirs_root_read_file (UserDirsRoot *root,
+                          const char   *path,
+                          gsize        *len,
+                          struct stat  *statbuf)
+{
+  struct stat st;
+  char *buffer;
+  gsize size, done;
+  ssize_t res;
+  int dirfd, fd, saved_errno;
+
+  dirfd = get_dirfd (root, &path);
+  if (dirfd == -1)
+    return NULL;
+
+  fd = openat (dirfd, path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return NULL;
+
+  /* Before reading, so that a change while reading makes the result
+   * look out of date rather than current
+   */
+  if (fstat (fd, &st) != 0)
+    {
+      saved_errno = errno;
+      close (fd);
+      errno = saved_errno;
+      return NULL;
+    }
+
+  /* The size is only a hint, the file may be growing */
+  size = st.st_size;
+  buffer = g_malloc (size + 1);
+  done = 0;
+  for (;;)
+    {
+      if (done == size)
+        {
+          size = size * 2 + 64;
+          buffer = g_realloc (buffer, size + 1);
+        }
+
+      res = read (fd, buffer + done, size - done);
+      if (res < 0 && errno == EINTR)
+        continue;
+      if (res < 0)
+        {
+          saved_errno = errno;
+          g_free (buffer);
+          close (fd);
+          errno = saved_errno;
+          return NULL;
+        }
+      if (res == 0)
+        break;
+      done += res;
+    }
+  close (fd);
+
+  buffer[done] = 0;
+  *len = done;
+  if (statbuf != NULL)
+    *statbuf = st;
+  return buffer;
+}
+
+/* Like g_mkstemp_full() on path.XXXXXX, but relative to dirfd */
+static int
+open_tmp_file (int dirfd, const char *path, int mode, char **tmp_file)
+{
+  int i, fd;
+
+  for (i = 0; i < 100; i++)
+    {
+      *tmp_file = g_strdup_printf ("%s.%06x", path,
+                                   g_random_int_range (0, 0x1000000));
+      fd = openat (dirfd, *tmp_file,
+                   O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, mode);
+      if (fd >= 0)
+        return fd;
+      g_free (*tmp_file);
+      *tmp_file = NULL;
+      if (errno != EEXIST)
+        return -1;
+    }
+
+  return -1;
+}
+
+/* The file is written with one write() into a temporary file, which is
+ * then renamed over it. If sync is set, the data is flushed to disk
+ * before the rename, so the file can't end up empty after a crash.
+ */
+int
+user_dirs_root_replace_file (UserDirsRoot *root,
+                             const char   *path,
+                             const char   *contents,
+                             gsize         len,
+                             int           mode,
+                             gboolean      sync,
+                             struct stat  *statbuf)
+{
+  char *tmp_file;
+  gsize done;
+  ssize_t res;
+  int dirfd, fd, saved_errno;
+
+  dirfd = get_dirfd (root, &path);
+  if (dirfd == -1)
+    return -1;
+
+  if (file_has_contents (dirfd, path, contents, len, statbuf))
+    return 0;
+
+  fd = open_tmp_file (dirfd, path, mode, &tmp_file);
+  if (fd < 0)
+    return -1;
+
+  done = 0;
+  while (done < len)
+    {
+      res = write (fd, contents + done, len - done);
+      if (res < 0 && errno == EINTR)
+        continue;
+      if (res < 0)
+        goto error;
+      done += res;
+    }
+
+  if (sync && fdatasync (fd) != 0)
+    goto error;
+
+  /* The rename keeps all of it but the name */
+  if (statbuf != NULL && fstat (fd, statbuf) != 0)
+    goto error;
+
+  if (close (fd) != 0)
+    {
+      fd = -1;
+      goto error;
+    }
+  fd = -1;
+
+  if (renameat (dirfd, tmp_file, dirfd, path) != 0)
+    goto error;
+
+  g_free (tmp_file);
+  return 1;
+
+ error:
+  saved_errno = errno;
+  if (fd >= 0)
+    close (fd);
+  unlinkat (dirfd, tmp_file, 0);
+  g_free (tmp_file);
+  errno = saved_errno;
+  return -1;
+}
+
+gboolean
+user_dirs_converter_keeps_ascii (iconv_t converter)
+{
+  char ascii[95], converted[sizeof (ascii) * 4];
+  char *in, *out;
+  size_t in_left, out_left, res;
+  int i;
+
+  for (i = 0; i < sizeof (ascii); i++)
+    ascii[i] = ' ' + i;
+
+  in = ascii;
+  in_left = sizeof (ascii);
+  out = converted;
+  out_left = sizeof (converted);
+  res = iconv (converter, (ICONV_CONST char **)&in, &in_left, &out, &out_left);
+  iconv (converter, NULL, NULL, NULL, NULL);
+
+  return res != (size_t)(-1) &&
+         out - converted == sizeof (ascii) &&
+         memcmp (ascii, converted, sizeof (ascii)) == 0;
+}
@@ -0,0 +1,90 @@
+#ifndef __USER_DIRS_IO_H__
+#define __USER_DIRS_IO_H__
+
+#include <sys/stat.h>
+#include <iconv.h>
+#include <glib.h>
+
+#include "user-dirs-move.h"
+
+/* A directory that xdg-user-dirs-update works below, such as the home
+ * directory. It is opened on first use, and relative paths are looked
+ * up from it with the *at() syscalls, so the kernel doesn't walk the
+ * full path each time. Absolute paths work as usual.
+ *
+ * Directories found or created are remembered, so creating one whose
+ * parent is known takes a single mkdirat(), instead of a stat() per
+ * ancestor as with g_mkdir_with_parents(). Call user_dirs_root_forget()
+ * when they may have changed since.
+ *
+ * Where io_uring is available, the lookups and directories needed for
+ * a whole home can be prefetched in one batch each.
+ *
+ * The functions reading and replacing files also take a NULL root, for
+ * paths relative to the current directory.
+ *
+ * A root must only be used by one thread at a time, except for
+ * user_dirs_root_is_regular(), which doesn't touch its state once the
+ * root is open.
+ */
+
+typedef struct _UserDirsRoot UserDirsRoot;
+
+UserDirsRoot *user_dirs_root_new                (const char   *path);
+void          user_dirs_root_free               (UserDirsRoot *root);
+const char   *user_dirs_root_get_path           (UserDirsRoot *root);
+gboolean      user_dirs_root_open               (UserDirsRoot *root);
+void          user_dirs_root_forget             (UserDirsRoot *root);
+
+gboolean      user_dirs_root_exists             (UserDirsRoot *root,
+                                                 const char   *path);
+gboolean      user_dirs_root_is_dir             (UserDirsRoot *root,
+                                                 const char   *path);
+gboolean      user_dirs_root_is_regular         (UserDirsRoot *root,
+                                                 const char   *path);
+int           user_dirs_root_mkdir_with_parents (UserDirsRoot *root,
+                                                 const char   *path,
+                                                 int           mode);
+int           user_dirs_root_move               (UserDirsRoot *root,
+                                                 UserDirsMove *move,
+                                                 const char   *old_path,
+                                                 const char   *new_path);
+
+gboolean      user_dirs_root_can_prefetch       (UserDirsRoot       *root);
+void          user_dirs_root_prefetch_types     (UserDirsRoot       *root,
+                                                 const char * const *paths,
+                                                 guint               n_paths);
+void          user_dirs_root_prefetch_mkdirs    (UserDirsRoot       *root,
+                                                 const char * const *paths,
+                                                 guint               n_paths,
+                                                 int                 mode);
+
+/* Reads the whole file at path into a NUL terminated buffer, to be
+ * freed with g_free(). If statbuf is set, it is filled in from the
+ * file that was read. Returns NULL on error, setting errno.
+ */
+char         *user_dirs_root_read_file          (UserDirsRoot *root,
+                                                 const char   *path,
+                                                 gsize        *len,
+                                                 struct stat  *statbuf);
+
+/* Replaces the file at path with contents, unless it has them already,
+ * so that watchers of unchanged files aren't woken up. Returns 1 if
+ * the file was written, 0 if not, or -1 on error, setting errno. If
+ * statbuf is set, it is filled in from the file now at path.
+ */
+int           user_dirs_root_replace_file       (UserDirsRoot *root,
+                                                 const char   *path,
+                                                 const char   *contents,
+                                                 gsize         len,
+                                                 int           mode,
+                                                 gboolean      sync,
+                                                 struct stat  *statbuf);
+
+/* Returns whether converter turns printable ASCII into the same bytes,
+ * as it does for anything but e.g. UTF-16 or EBCDIC, so that ASCII
+ * paths can be used without converting them
+ */
+gboolean      user_dirs_converter_keeps_ascii   (iconv_t       converter);
+
+#endif /* __USER_DIRS_IO_H__ */
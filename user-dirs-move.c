@@ -0,0 +1,749 @@
+#include <config.h>
+
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef HAVE_SYS_FSUID_H
+#include <sys/fsuid.h>
+#endif
+#ifdef HAVE_LINUX_FS_H
+#include <linux/fs.h>
+#endif
+#include <glib.h>
+
+#include "user-dirs-move.h"
+
+/* Copying is mostly waiting for the disks, so a few threads are
+ * enough to keep them busy
+ */
+#define MAX_COPY_THREADS 4
+
+/* Amount copied per copy_file_range() call, so progress is seen */
+#define COPY_CHUNK_SIZE (8 * 1024 * 1024)
+#define BUFFER_SIZE (256 * 1024)
+
+typedef struct {
+  char *path; /* relative to the top of the tree */
+  struct stat statbuf;
+} Entry;
+
+typedef struct {
+  UserDirsMove *move;
+  int src_fd; /* the tops of the trees */
+  int dst_fd;
+  dev_t dev; /* of the original, which is not left while copying */
+  GPtrArray *dirs;   /* parents first */
+  GPtrArray *files;  /* regular files, copied by the threads */
+  GPtrArray *others; /* symlinks and fifos */
+#ifdef HAVE_SYS_FSUID_H
+  uid_t fsuid; /* of the caller, for the threads */
+  gid_t fsgid;
+#endif
+
+  GMutex lock; /* protects the rest */
+  GCond cond;
+  guint pending;
+  guint64 n_files;
+  guint64 bytes;
+  char *error; /* the first failure */
+  int error_code;
+} Copy;
+
+static void
+entry_free (Entry *entry)
+{
+  g_free (entry->path);
+  g_free (entry);
+}
+
+/* Records the first failure, for all threads to give up */
+static gboolean
+fail (Copy *copy, const char *what, const char *path, int code)
+{
+  g_mutex_lock (&copy->lock);
+  if (copy->error == NULL)
+    {
+      copy->error = g_strdup_printf ("Can't %s %s: %s", what,
+                                     *path ? path : ".", g_strerror (code));
+      copy->error_code = code;
+    }
+  g_mutex_unlock (&copy->lock);
+  return FALSE;
+}
+
+static gboolean
+has_failed (Copy *copy)
+{
+  gboolean res;
+
+  g_mutex_lock (&copy->lock);
+  res = copy->error != NULL;
+  g_mutex_unlock (&copy->lock);
+  return res;
+}
+
+static void
+add_progress (Copy *copy, guint64 bytes, guint64 n_files)
+{
+  g_mutex_lock (&copy->lock);
+  copy->bytes += bytes;
+  copy->n_files += n_files;
+  g_mutex_unlock (&copy->lock);
+}
+
+static const char *
+at_path (const char *path)
+{
+  return *path ? path : ".";
+}
+
+/* Records everything below path, and creates the directories and
+ * symlinks in the copy. The subdirectories are walked after closing
+ * path, so deep trees don't run out of descriptors.
+ */
+static gboolean
+walk (Copy *copy, const char *path)
+{
+  struct dirent *dirent;
+  GPtrArray *subdirs;
+  Entry *entry;
+  char *target;
+  struct stat statbuf;
+  DIR *dir;
+  int fd;
+  guint i;
+  gboolean res;
+
+  fd = openat (copy->src_fd, at_path (path), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+  if (fd >= 0 && fstat (fd, &statbuf) == 0 && statbuf.st_dev != copy->dev)
+    {
+      /* Mounted after the directory was recorded */
+      close (fd);
+      return fail (copy, "copy mount point", path, EXDEV);
+    }
+  if (fd < 0 || (dir = fdopendir (fd)) == NULL)
+    {
+      if (fd >= 0)
+        close (fd);
+      return fail (copy, "read", path, errno);
+    }
+
+  res = TRUE;
+  subdirs = g_ptr_array_new ();
+  while (res && (errno = 0, dirent = readdir (dir)) != NULL)
+    {
+      if (strcmp (dirent->d_name, ".") == 0 || strcmp (dirent->d_name, "..") == 0)
+        continue;
+
+      entry = g_new0 (Entry, 1);
+      entry->path = *path ? g_build_filename (path, dirent->d_name, NULL)
+                          : g_strdup (dirent->d_name);
+      if (fstatat (dirfd (dir), dirent->d_name, &entry->statbuf, AT_SYMLINK_NOFOLLOW) != 0)
+        {
+          res = fail (copy, "read", entry->path, errno);
+          entry_free (entry);
+          break;
+        }
+
+      /* Whatever is mounted inside the directory stays where it is,
+       * copying it could fill the disk and removing it could lose it
+       */
+      if (entry->statbuf.st_dev != copy->dev)
+        {
+          res = fail (copy, "copy mount point", entry->path, EXDEV);
+          entry_free (entry);
+          break;
+        }
+
+      switch (entry->statbuf.st_mode & S_IFMT)
+        {
+        case S_IFDIR:
+          g_ptr_array_add (copy->dirs, entry);
+          if (mkdirat (copy->dst_fd, entry->path, 0700) != 0)
+            res = fail (copy, "create", entry->path, errno);
+          g_ptr_array_add (subdirs, entry->path);
+          break;
+
+        case S_IFREG:
+          g_ptr_array_add (copy->files, entry);
+          copy->move->total_files++;
+          copy->move->total_bytes += entry->statbuf.st_size;
+          break;
+
+        case S_IFLNK:
+          g_ptr_array_add (copy->others, entry);
+          target = g_malloc (entry->statbuf.st_size + 1);
+          if (readlinkat (dirfd (dir), dirent->d_name, target, entry->statbuf.st_size + 1) !=
+              entry->statbuf.st_size)
+            res = fail (copy, "read", entry->path, errno ? errno : EIO);
+          else
+            {
+              target[entry->statbuf.st_size] = 0;
+              if (symlinkat (target, copy->dst_fd, entry->path) != 0)
+                res = fail (copy, "create", entry->path, errno);
+            }
+          g_free (target);
+          break;
+
+        case S_IFIFO:
+          g_ptr_array_add (copy->others, entry);
+          if (mkfifoat (copy->dst_fd, entry->path, 0600) != 0)
+            res = fail (copy, "create", entry->path, errno);
+          break;
+
+        default:
+          /* Sockets and devices don't belong in a user directory,
+           * and leaving them behind would lose them
+           */
+          res = fail (copy, "copy special file", entry->path, EOPNOTSUPP);
+          entry_free (entry);
+          break;
+        }
+    }
+
+  if (res && errno != 0)
+    res = fail (copy, "read", path, errno);
+  closedir (dir);
+
+  for (i = 0; res && i < subdirs->len; i++)
+    res = walk (copy, g_ptr_array_index (subdirs, i));
+  g_ptr_array_free (subdirs, TRUE);
+
+  return res;
+}
+
+/* Returns 1 if the file system can't do it, so nothing was copied */
+static int
+copy_file_range_all (Copy *copy, int in, int out)
+{
+#ifdef HAVE_COPY_FILE_RANGE
+  gboolean copied = FALSE;
+  ssize_t n;
+
+  for (;;)
+    {
+      n = copy_file_range (in, NULL, out, NULL, COPY_CHUNK_SIZE, 0);
+      if (n == 0)
+        return 0;
+      if (n > 0)
+        {
+          copied = TRUE;
+          add_progress (copy, n, 0);
+          continue;
+        }
+
+      if (errno == EINTR)
+        continue;
+      if (!copied && (errno == EXDEV || errno == ENOSYS || errno == EINVAL ||
+                      errno == EOPNOTSUPP || errno == EBADF))
+        return 1;
+      return -1;
+    }
+#else
+  return 1;
+#endif
+}
+
+static int
+read_write_all (Copy *copy, int in, int out)
+{
+  char *buffer;
+  ssize_t n, written, res;
+
+  buffer = g_malloc (BUFFER_SIZE);
+  for (;;)
+    {
+      n = read (in, buffer, BUFFER_SIZE);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        break;
+
+      for (written = 0; written < n; written += res)
+        {
+          res = write (out, buffer + written, n - written);
+          if (res < 0 && errno == EINTR)
+            res = 0;
+          else if (res < 0)
+            {
+              g_free (buffer);
+              return -1;
+            }
+        }
+      add_progress (copy, n, 0);
+    }
+
+  g_free (buffer);
+  return n < 0 ? -1 : 0;
+}
+
+static gboolean
+copy_contents (Copy *copy, int in, int out, const Entry *entry)
+{
+  int res;
+
+#ifdef FICLONE
+  /* Shares the data with the original if it is the same file system
+   * mounted elsewhere, e.g. a bind mount on btrfs or XFS
+   */
+  if (ioctl (out, FICLONE, in) == 0)
+    {
+      add_progress (copy, entry->statbuf.st_size, 0);
+      return TRUE;
+    }
+#endif
+
+  res = copy_file_range_all (copy, in, out);
+  if (res == 1)
+    res = read_write_all (copy, in, out);
+  return res == 0;
+}
+
+static gboolean
+same_time (const struct timespec *a, const struct timespec *b)
+{
+  return a->tv_sec == b->tv_sec && a->tv_nsec == b->tv_nsec;
+}
+
+static void
+copy_file (Copy *copy, const Entry *entry)
+{
+  struct timespec times[2];
+  struct stat after;
+  int in, out;
+
+  in = openat (copy->src_fd, entry->path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+  if (in < 0)
+    {
+      fail (copy, "read", entry->path, errno);
+      return;
+    }
+
+  out = openat (copy->dst_fd, entry->path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+  if (out < 0)
+    {
+      fail (copy, "create", entry->path, errno);
+      close (in);
+      return;
+    }
+
+  times[0] = entry->statbuf.st_atim;
+  times[1] = entry->statbuf.st_mtim;
+
+  if (!copy_contents (copy, in, out, entry))
+    fail (copy, "copy", entry->path, errno);
+  /* Only root can give files away, others keep them as their own */
+  else if (fchown (out, entry->statbuf.st_uid, entry->statbuf.st_gid) != 0 && errno != EPERM)
+    fail (copy, "change owner of", entry->path, errno);
+  else if (fchmod (out, entry->statbuf.st_mode & 07777) != 0)
+    fail (copy, "change permissions of", entry->path, errno);
+  else if (futimens (out, times) != 0)
+    fail (copy, "set times of", entry->path, errno);
+  /* Verify that nothing changed meanwhile, and all of it was copied */
+  else if (fstat (in, &after) != 0 || after.st_size != entry->statbuf.st_size ||
+           !same_time (&after.st_mtim, &entry->statbuf.st_mtim))
+    fail (copy, "copy", entry->path, EBUSY);
+  else if (fstat (out, &after) != 0 || after.st_size != entry->statbuf.st_size)
+    fail (copy, "copy", entry->path, EIO);
+  else
+    add_progress (copy, 0, 1);
+
+  close (in);
+  if (close (out) != 0)
+    fail (copy, "write", entry->path, errno);
+}
+
+static void
+copy_file_func (gpointer data, gpointer user_data)
+{
+  Copy *copy = user_data;
+  Entry *entry = data;
+
+  if (!has_failed (copy))
+    {
+#ifdef HAVE_SYS_FSUID_H
+      /* The file system ids are per thread */
+      setfsuid (copy->fsuid);
+      setfsgid (copy->fsgid);
+#endif
+      copy_file (copy, entry);
+    }
+
+  g_mutex_lock (&copy->lock);
+  if (--copy->pending == 0)
+    g_cond_signal (&copy->cond);
+  g_mutex_unlock (&copy->lock);
+}
+
+static void
+report_progress (Copy *copy, gint64 start_time, gboolean done)
+{
+  g_mutex_lock (&copy->lock);
+  copy->move->bytes = copy->bytes;
+  copy->move->n_files = copy->n_files;
+  g_mutex_unlock (&copy->lock);
+  copy->move->elapsed = g_get_monotonic_time () - start_time;
+
+  if (copy->move->progress)
+    copy->move->progress (copy->move, done, copy->move->user_data);
+}
+
+static gboolean
+copy_files (Copy *copy, gint64 start_time)
+{
+  GThreadPool *pool;
+  gint64 end_time;
+  guint i;
+
+  if (copy->files->len == 0)
+    return TRUE;
+
+  copy->pending = copy->files->len;
+  pool = g_thread_pool_new (copy_file_func, copy,
+                            MIN (g_get_num_processors (), MAX_COPY_THREADS),
+                            TRUE, NULL);
+  for (i = 0; i < copy->files->len; i++)
+    g_thread_pool_push (pool, g_ptr_array_index (copy->files, i), NULL);
+
+  g_mutex_lock (&copy->lock);
+  end_time = g_get_monotonic_time () + G_USEC_PER_SEC;
+  while (copy->pending > 0)
+    {
+      if (g_cond_wait_until (&copy->cond, &copy->lock, end_time))
+        continue;
+
+      g_mutex_unlock (&copy->lock);
+      report_progress (copy, start_time, FALSE);
+      g_mutex_lock (&copy->lock);
+      end_time = g_get_monotonic_time () + G_USEC_PER_SEC;
+    }
+  g_mutex_unlock (&copy->lock);
+
+  g_thread_pool_free (pool, FALSE, TRUE);
+  return !has_failed (copy);
+}
+
+/* Applies the ownership, permissions and times of entry to its copy */
+static gboolean
+copy_metadata (Copy *copy, const Entry *entry)
+{
+  struct timespec times[2];
+  int flags;
+
+  flags = S_ISLNK (entry->statbuf.st_mode) ? AT_SYMLINK_NOFOLLOW : 0;
+  times[0] = entry->statbuf.st_atim;
+  times[1] = entry->statbuf.st_mtim;
+
+  if (fchownat (copy->dst_fd, at_path (entry->path), entry->statbuf.st_uid,
+                entry->statbuf.st_gid, flags) != 0 && errno != EPERM)
+    return fail (copy, "change owner of", entry->path, errno);
+  if (!S_ISLNK (entry->statbuf.st_mode) &&
+      fchmodat (copy->dst_fd, at_path (entry->path), entry->statbuf.st_mode & 07777, 0) != 0)
+    return fail (copy, "change permissions of", entry->path, errno);
+  if (utimensat (copy->dst_fd, at_path (entry->path), times, flags) != 0)
+    return fail (copy, "set times of", entry->path, errno);
+  return TRUE;
+}
+
+/* Removes everything below fd, but not fd itself */
+static int
+remove_contents (int fd)
+{
+  struct dirent *dirent;
+  DIR *dir;
+  int subfd, res;
+
+  subfd = openat (fd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (subfd < 0 || (dir = fdopendir (subfd)) == NULL)
+    {
+      if (subfd >= 0)
+        close (subfd);
+      return -1;
+    }
+
+  res = 0;
+  while ((dirent = readdir (dir)) != NULL)
+    {
+      if (strcmp (dirent->d_name, ".") == 0 || strcmp (dirent->d_name, "..") == 0)
+        continue;
+
+      if (unlinkat (dirfd (dir), dirent->d_name, 0) == 0)
+        continue;
+      if (errno != EISDIR)
+        {
+          res = -1;
+          continue;
+        }
+
+      subfd = openat (dirfd (dir), dirent->d_name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+      if (subfd < 0 || remove_contents (subfd) != 0 ||
+          unlinkat (dirfd (dir), dirent->d_name, AT_REMOVEDIR) != 0)
+        res = -1;
+      if (subfd >= 0)
+        close (subfd);
+    }
+
+  closedir (dir);
+  return res;
+}
+
+/* Whether statbuf is still the entry that was copied. Directories
+ * change when their contents are removed, so only files are compared
+ * by time as well.
+ */
+static gboolean
+same_entry (const struct stat *statbuf, const Entry *entry)
+{
+  return statbuf->st_dev == entry->statbuf.st_dev &&
+         statbuf->st_ino == entry->statbuf.st_ino &&
+         (S_ISDIR (statbuf->st_mode) ||
+          same_time (&statbuf->st_mtim, &entry->statbuf.st_mtim));
+}
+
+/* Removes the originals of entries, last first, if they are still what
+ * was copied. Anything else is left alone, and the first reason for
+ * leaving something is stored in error.
+ */
+static void
+remove_copied (Copy *copy, GPtrArray *entries, int *error)
+{
+  const Entry *entry;
+  struct stat statbuf;
+  guint i;
+  int res;
+
+  for (i = entries->len; i > 0; i--)
+    {
+      entry = g_ptr_array_index (entries, i - 1);
+      if (fstatat (copy->src_fd, entry->path, &statbuf, AT_SYMLINK_NOFOLLOW) != 0)
+        res = errno == ENOENT ? 0 : errno;
+      else if (!same_entry (&statbuf, entry))
+        res = EBUSY;
+      else if (unlinkat (copy->src_fd, entry->path,
+                         S_ISDIR (statbuf.st_mode) ? AT_REMOVEDIR : 0) != 0)
+        res = errno;
+      else
+        res = 0;
+
+      if (*error == 0)
+        *error = res;
+    }
+}
+
+/* Returns 0 once the original is gone, or why it isn't. EBUSY and
+ * ENOTEMPTY mean that it changed while copying.
+ */
+static int
+remove_original (Copy        *copy,
+                 const Entry *top,
+                 int          old_dirfd,
+                 const char  *old_path)
+{
+  struct stat statbuf;
+  int error;
+
+  /* Directories last, so they are empty by then */
+  error = 0;
+  remove_copied (copy, copy->files, &error);
+  remove_copied (copy, copy->others, &error);
+  remove_copied (copy, copy->dirs, &error);
+  if (error != 0)
+    return error;
+
+  if (fstatat (old_dirfd, old_path, &statbuf, AT_SYMLINK_NOFOLLOW) != 0)
+    return errno;
+  if (!same_entry (&statbuf, top))
+    return EBUSY;
+  if (unlinkat (old_dirfd, old_path, AT_REMOVEDIR) != 0)
+    return errno;
+  return 0;
+}
+
+static gboolean
+is_empty_dir (int fd)
+{
+  struct dirent *dirent;
+  gboolean res;
+  DIR *dir;
+  int subfd;
+
+  subfd = openat (fd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (subfd < 0 || (dir = fdopendir (subfd)) == NULL)
+    {
+      if (subfd >= 0)
+        close (subfd);
+      return FALSE;
+    }
+
+  res = TRUE;
+  while (res && (dirent = readdir (dir)) != NULL)
+    res = strcmp (dirent->d_name, ".") == 0 || strcmp (dirent->d_name, "..") == 0;
+
+  closedir (dir);
+  return res;
+}
+
+static gboolean
+copy_tree (Copy *copy, const Entry *top)
+{
+  gint64 start_time;
+  guint i;
+
+  start_time = g_get_monotonic_time ();
+  copy->move->copying = TRUE;
+
+  if (!walk (copy, ""))
+    return FALSE;
+
+  report_progress (copy, start_time, FALSE);
+  if (!copy_files (copy, start_time))
+    return FALSE;
+
+  for (i = 0; i < copy->others->len; i++)
+    if (!copy_metadata (copy, g_ptr_array_index (copy->others, i)))
+      return FALSE;
+
+  /* Children first, as adding to a directory changes its times */
+  for (i = copy->dirs->len; i > 0; i--)
+    if (!copy_metadata (copy, g_ptr_array_index (copy->dirs, i - 1)))
+      return FALSE;
+  if (!copy_metadata (copy, top))
+    return FALSE;
+
+  /* The original is only removed once the copy is on disk */
+  if (syncfs (copy->dst_fd) != 0)
+    return fail (copy, "write", "", errno);
+
+  report_progress (copy, start_time, TRUE);
+  return TRUE;
+}
+
+static void
+warn (UserDirsMove *move, const char *format, ...)
+{
+  va_list args;
+  char *message;
+
+  if (move->warning == NULL)
+    return;
+
+  va_start (args, format);
+  message = g_strdup_vprintf (format, args);
+  va_end (args);
+
+  move->warning (move, message, move->user_data);
+  g_free (message);
+}
+
+/* Returns 0 on success, and -1 with errno set otherwise. As with
+ * rename(), new_path may exist if it is an empty directory, and only
+ * fails with ENOTEMPTY or EEXIST if it isn't.
+ */
+int
+user_dirs_move (UserDirsMove *move,
+                int           old_dirfd,
+                const char   *old_path,
+                int           new_dirfd,
+                const char   *new_path)
+{
+  Copy copy;
+  Entry top;
+  gboolean res;
+  int saved_errno, error;
+
+  move->copying = FALSE;
+  move->n_files = move->total_files = 0;
+  move->bytes = move->total_bytes = 0;
+  move->elapsed = 0;
+
+  if (renameat (old_dirfd, old_path, new_dirfd, new_path) == 0)
+    return 0;
+  if (errno != EXDEV)
+    return -1;
+
+  memset (&copy, 0, sizeof (copy));
+  copy.move = move;
+  copy.dst_fd = -1;
+  copy.src_fd = openat (old_dirfd, old_path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+  if (copy.src_fd < 0)
+    return -1;
+
+  copy.dst_fd = openat (new_dirfd, new_path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+  if (copy.dst_fd < 0 || fstat (copy.src_fd, &top.statbuf) != 0)
+    {
+      saved_errno = errno;
+      goto out;
+    }
+  top.path = "";
+  copy.dev = top.statbuf.st_dev;
+
+  if (!is_empty_dir (copy.dst_fd))
+    {
+      saved_errno = ENOTEMPTY;
+      goto out;
+    }
+
+  copy.dirs = g_ptr_array_new_with_free_func ((GDestroyNotify) entry_free);
+  copy.files = g_ptr_array_new_with_free_func ((GDestroyNotify) entry_free);
+  copy.others = g_ptr_array_new_with_free_func ((GDestroyNotify) entry_free);
+  g_mutex_init (&copy.lock);
+  g_cond_init (&copy.cond);
+#ifdef HAVE_SYS_FSUID_H
+  copy.fsuid = setfsuid (-1);
+  copy.fsgid = setfsgid (-1);
+#endif
+
+  res = copy_tree (&copy, &top);
+  saved_errno = 0;
+  if (res)
+    {
+      /* The copy is complete, so leftovers are only worth a warning.
+       * Only what was copied is removed, so whatever was added or
+       * changed meanwhile is kept in the original.
+       */
+      error = remove_original (&copy, &top, old_dirfd, old_path);
+      if (error == EBUSY || error == ENOTEMPTY)
+        warn (move, "Copied %s to %s, but kept %s, as it changed while copying",
+              old_path, new_path, old_path);
+      else if (error != 0)
+        warn (move, "Copied %s to %s, but can't remove all of %s: %s",
+              old_path, new_path, old_path, g_strerror (error));
+    }
+  else
+    {
+      /* Callers take ENOTEMPTY and EEXIST to mean that new_path was
+       * there already, and it is kept instead of the original
+       */
+      saved_errno = copy.error_code;
+      if (saved_errno == 0 || saved_errno == ENOTEMPTY || saved_errno == EEXIST)
+        saved_errno = EIO;
+      warn (move, "%s, leaving %s as it was", copy.error, old_path);
+      if (remove_contents (copy.dst_fd) != 0)
+        warn (move, "Can't remove the incomplete copy in %s: %s",
+              new_path, g_strerror (errno));
+    }
+
+  g_free (copy.error);
+  g_ptr_array_free (copy.dirs, TRUE);
+  g_ptr_array_free (copy.files, TRUE);
+  g_ptr_array_free (copy.others, TRUE);
+  g_mutex_clear (&copy.lock);
+  g_cond_clear (&copy.cond);
+
+ out:
+  close (copy.src_fd);
+  if (copy.dst_fd >= 0)
+    close (copy.dst_fd);
+
+  errno = saved_errno;
+  return saved_errno == 0 ? 0 : -1;
+}
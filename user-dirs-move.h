@@ -0,0 +1,53 @@
+#ifndef __USER_DIRS_MOVE_H__
+#define __USER_DIRS_MOVE_H__
+
+#include <glib.h>
+
+/* Moves a directory with rename(), or if that isn't possible because
+ * the new location is on another file system, copies it there and
+ * removes the original once the copy is complete and verified.
+ *
+ * Files are copied on several threads, by cloning them where the file
+ * system supports it, and with copy_file_range() or read() and write()
+ * otherwise. Permissions, ownership (where allowed) and timestamps are
+ * kept. If anything can't be copied, the copy is removed again and the
+ * original is left as it was. File systems mounted inside the directory
+ * are never copied, the move fails with EXDEV instead. Only what was
+ * copied is removed from the original, so files added or changed while
+ * copying are kept there.
+ */
+
+typedef struct _UserDirsMove UserDirsMove;
+
+/* Called about once a second while copying, and once when done */
+typedef void (* UserDirsMoveProgressFunc) (UserDirsMove *move,
+                                           gboolean      done,
+                                           gpointer      user_data);
+
+/* Called with a description of what went wrong, before failing */
+typedef void (* UserDirsMoveWarningFunc)  (UserDirsMove *move,
+                                           const char   *message,
+                                           gpointer      user_data);
+
+struct _UserDirsMove {
+  /* Set by the caller, may be NULL */
+  UserDirsMoveProgressFunc progress;
+  UserDirsMoveWarningFunc warning;
+  gpointer user_data;
+
+  /* Filled in while copying */
+  gboolean copying;
+  guint64 n_files;
+  guint64 total_files;
+  guint64 bytes;
+  guint64 total_bytes;
+  gint64 elapsed; /* microseconds */
+};
+
+int user_dirs_move (UserDirsMove *move,
+                    int           old_dirfd,
+                    const char   *old_path,
+                    int           new_dirfd,
+                    const char   *new_path);
+
+#endif /* __USER_DIRS_MOVE_H__ */
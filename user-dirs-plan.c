@@ -0,0 +1,277 @@
+#include <config.h>
+
+#include <string.h>
+#include <glib.h>
+
+#include "user-dirs-fields.h"
+#include "user-dirs-plan.h"
+
+/* A plan is a text file. After the header come lines naming the home
+ * and the digest of user-dirs.dirs, optionally the locale to save, and
+ * then a line per step:
+ *
+ *   home <path>
+ *   config <sha256 digest>
+ *   locale <locale>
+ *   dir <name>
+ *   mkdir <path>
+ *   move <path> <new path>
+ *   set <name> <path>
+ *
+ * Fields are separated and escaped as in the desktop cache. Paths
+ * other than the home are relative to it, unless absolute.
+ */
+
+#define PLAN_HEADER "xdg-user-dirs plan 1\n"
+
+static const char *action_names[] = {
+  "dir",
+  "mkdir",
+  "move",
+  "set",
+};
+
+UserDirsPlan *
+user_dirs_plan_new (const char *home, const char *config_digest)
+{
+  UserDirsPlan *plan;
+
+  plan = g_new0 (UserDirsPlan, 1);
+  plan->arena = user_dirs_arena_new ();
+  plan->home = user_dirs_arena_strdup (plan->arena, home);
+  plan->config_digest = user_dirs_arena_strdup (plan->arena, config_digest);
+  plan->steps = g_array_new (FALSE, FALSE, sizeof (UserDirsPlanStep));
+  return plan;
+}
+
+void
+user_dirs_plan_free (UserDirsPlan *plan)
+{
+  g_array_free (plan->steps, TRUE);
+  user_dirs_arena_free (plan->arena);
+  g_free (plan);
+}
+
+/* name, path and new_path are copied, and may be NULL where the
+ * action doesn't use them
+ */
+void
+user_dirs_plan_add (UserDirsPlan       *plan,
+                    UserDirsPlanAction  action,
+                    const char         *name,
+                    const char         *path,
+                    const char         *new_path)
+{
+  UserDirsPlanStep step;
+
+  step.action = action;
+  step.name = name ? user_dirs_arena_strdup (plan->arena, name) : NULL;
+  step.path = path ? user_dirs_arena_strdup (plan->arena, path) : NULL;
+  step.new_path = new_path ? user_dirs_arena_strdup (plan->arena, new_path) : NULL;
+  g_array_append_val (plan->steps, step);
+}
+
+static void
+append_line (GString *contents, const char *tag, const char *field, const char *field2)
+{
+  g_string_append (contents, tag);
+  user_dirs_fields_append (contents, field);
+  if (field2 != NULL)
+    user_dirs_fields_append (contents, field2);
+  g_string_append_c (contents, '\n');
+}
+
+gboolean
+user_dirs_plan_save (UserDirsPlan *plan,
+                     const char   *plan_file,
+                     GError      **error)
+{
+  UserDirsPlanStep *step;
+  GString *contents;
+  const char *tag;
+  gboolean res;
+  guint i;
+
+  contents = g_string_new (PLAN_HEADER);
+  append_line (contents, "home", plan->home, NULL);
+  append_line (contents, "config", plan->config_digest, NULL);
+  if (plan->locale != NULL)
+    append_line (contents, "locale", plan->locale, NULL);
+
+  for (i = 0; i < plan->steps->len; i++)
+    {
+      step = &g_array_index (plan->steps, UserDirsPlanStep, i);
+      tag = action_names[step->action];
+      switch (step->action)
+        {
+        case USER_DIRS_PLAN_DIR:
+          append_line (contents, tag, step->name, NULL);
+          break;
+        case USER_DIRS_PLAN_MKDIR:
+          append_line (contents, tag, step->path, NULL);
+          break;
+        case USER_DIRS_PLAN_MOVE:
+          append_line (contents, tag, step->path, step->new_path);
+          break;
+        case USER_DIRS_PLAN_SET:
+          append_line (contents, tag, step->name, step->path);
+          break;
+        }
+    }
+
+  res = g_file_set_contents (plan_file, contents->str, contents->len, error);
+  g_string_free (contents, TRUE);
+  return res;
+}
+
+/* Returns the step's action and fills in its fields, or returns -1 if
+ * the line isn't a valid step. Only the first n_fields of fields are
+ * set.
+ */
+static int
+parse_step (const char *tag, char **fields, int n_fields, UserDirsPlanStep *step)
+{
+  int action;
+
+  for (action = 0; action < G_N_ELEMENTS (action_names); action++)
+    if (strcmp (tag, action_names[action]) == 0)
+      break;
+
+  memset (step, 0, sizeof (UserDirsPlanStep));
+  step->action = action;
+  switch (action)
+    {
+    case USER_DIRS_PLAN_DIR:
+      if (n_fields != 1)
+        return -1;
+      step->name = fields[0];
+      return action;
+    case USER_DIRS_PLAN_MKDIR:
+      if (n_fields != 1)
+        return -1;
+      step->path = fields[0];
+      return action;
+    case USER_DIRS_PLAN_MOVE:
+      if (n_fields != 2)
+        return -1;
+      step->path = fields[0];
+      step->new_path = fields[1];
+      return action;
+    case USER_DIRS_PLAN_SET:
+      if (n_fields != 2)
+        return -1;
+      step->name = fields[0];
+      step->path = fields[1];
+      return action;
+    default:
+      return -1;
+    }
+}
+
+static UserDirsPlan *
+plan_from_header (const char *home, const char *digest, const char *locale)
+{
+  UserDirsPlan *plan;
+
+  if (home == NULL || digest == NULL)
+    return NULL;
+
+  plan = user_dirs_plan_new (home, digest);
+  if (locale != NULL)
+    plan->locale = user_dirs_arena_strdup (plan->arena, locale);
+  return plan;
+}
+
+UserDirsPlan *
+user_dirs_plan_load (const char *plan_file,
+                     GError    **error)
+{
+  UserDirsPlan *plan;
+  UserDirsPlanStep step;
+  char *contents, *line, *next, *tag;
+  char *fields[3];
+  const char *home, *digest, *locale;
+  int n, line_number;
+
+  if (!g_file_get_contents (plan_file, &contents, NULL, error))
+    return NULL;
+
+  if (!g_str_has_prefix (contents, PLAN_HEADER))
+    {
+      g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+                   "%s is not a plan", plan_file);
+      g_free (contents);
+      return NULL;
+    }
+
+  plan = NULL;
+  home = digest = locale = NULL;
+  line_number = 1;
+  for (line = contents + strlen (PLAN_HEADER); *line != 0; line = next)
+    {
+      line_number++;
+      next = strchr (line, '\n');
+      if (next == NULL)
+        goto invalid;
+      *next++ = 0;
+
+      tag = user_dirs_fields_next (&line);
+      for (n = 0; n < 3 && (fields[n] = user_dirs_fields_next (&line)) != NULL; n++)
+        ;
+
+      /* The header lines come first */
+      if (plan == NULL && strcmp (tag, "home") == 0 && n == 1)
+        {
+          home = fields[0];
+          continue;
+        }
+      if (plan == NULL && strcmp (tag, "config") == 0 && n == 1)
+        {
+          digest = fields[0];
+          continue;
+        }
+      if (plan == NULL && strcmp (tag, "locale") == 0 && n == 1)
+        {
+          locale = fields[0];
+          continue;
+        }
+
+      if (plan == NULL && (plan = plan_from_header (home, digest, locale)) == NULL)
+        goto invalid;
+      if (parse_step (tag, fields, n, &step) < 0)
+        goto invalid;
+      user_dirs_plan_add (plan, step.action, step.name, step.path, step.new_path);
+    }
+
+  /* A plan without steps */
+  if (plan == NULL && (plan = plan_from_header (home, digest, locale)) == NULL)
+    goto invalid;
+
+  g_free (contents);
+  return plan;
+
+ invalid:
+  g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+               "%s: invalid line %d", plan_file, line_number);
+  if (plan != NULL)
+    user_dirs_plan_free (plan);
+  g_free (contents);
+  return NULL;
+}
+
+/* Returns the digest of config_file to store in a plan, "-" if it
+ * doesn't exist. Free with g_free().
+ */
+char *
+user_dirs_plan_digest (const char *config_file)
+{
+  char *contents, *digest;
+  gsize len;
+
+  if (!g_file_get_contents (config_file, &contents, &len, NULL))
+    return g_strdup ("-");
+
+  digest = g_compute_checksum_for_data (G_CHECKSUM_SHA256, (const guchar *) contents, len);
+  g_free (contents);
+  return digest;
+}
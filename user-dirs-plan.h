@@ -0,0 +1,55 @@
+#ifndef __USER_DIRS_PLAN_H__
+#define __USER_DIRS_PLAN_H__
+
+#include <glib.h>
+
+#include "user-dirs-arena.h"
+
+/* What an update would do to a home, written by --plan and carried
+ * out later by --apply. The steps for each default directory start
+ * with a DIR step; if one of its MKDIR or MOVE steps fails, the rest
+ * of them are skipped, like an update does.
+ *
+ * A plan is only valid for the home it was made for, and only as long
+ * as user-dirs.dirs stays the same, which its digest is kept for.
+ */
+
+typedef enum {
+  USER_DIRS_PLAN_DIR,   /* name: the steps for this directory follow */
+  USER_DIRS_PLAN_MKDIR, /* path */
+  USER_DIRS_PLAN_MOVE,  /* path to new_path */
+  USER_DIRS_PLAN_SET,   /* name to path in user-dirs.dirs */
+} UserDirsPlanAction;
+
+typedef struct {
+  UserDirsPlanAction action;
+  const char *name;
+  const char *path;
+  const char *new_path;
+} UserDirsPlanStep;
+
+typedef struct {
+  UserDirsArena *arena;
+  const char *home;
+  const char *config_digest; /* of user-dirs.dirs, "-" if there was none */
+  const char *locale;        /* to save in user-dirs.locale, or NULL */
+  GArray *steps;
+} UserDirsPlan;
+
+UserDirsPlan *user_dirs_plan_new    (const char          *home,
+                                     const char          *config_digest);
+void          user_dirs_plan_free   (UserDirsPlan        *plan);
+void          user_dirs_plan_add    (UserDirsPlan        *plan,
+                                     UserDirsPlanAction   action,
+                                     const char          *name,
+                                     const char          *path,
+                                     const char          *new_path);
+gboolean      user_dirs_plan_save   (UserDirsPlan        *plan,
+                                     const char          *plan_file,
+                                     GError             **error);
+UserDirsPlan *user_dirs_plan_load   (const char          *plan_file,
+                                     GError             **error);
+
+char         *user_dirs_plan_digest (const char          *config_file);
+
+#endif /* __USER_DIRS_PLAN_H__ */
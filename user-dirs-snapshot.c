@@ -0,0 +1,125 @@
+#include <config.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <string.h>
+#include <glib.h>
+
+#include "user-dirs-snapshot.h"
+#include "xdg-user-dirs-snapshot.h"
+
+static int
+compare_types (gconstpointer a, gconstpointer b, gpointer user_data)
+{
+  GPtrArray *types = user_data;
+  guint index_a = *(const guint32 *) a;
+  guint index_b = *(const guint32 *) b;
+
+  return strcmp (g_ptr_array_index (types, index_a),
+                 g_ptr_array_index (types, index_b));
+}
+
+static guint32
+add_string (GString *pool, gsize base, const char *str)
+{
+  guint32 offset;
+
+  offset = base + pool->len;
+  g_string_append_len (pool, str, strlen (str) + 1);
+  return offset;
+}
+
+/* Writes the binary snapshot of user-dirs.dirs to $XDG_RUNTIME_DIR.
+ * types and paths are the entries of config_file in file order, with
+ * absolute paths, as read from or written to the version of the file
+ * described by source. See xdg-user-dirs-snapshot.h for the format.
+ */
+void
+user_dirs_snapshot_save (const char        *config_file,
+                         const struct stat *source,
+                         const char        *home_dir,
+                         GPtrArray         *types,
+                         GPtrArray         *paths)
+{
+  XdgUserDirsSnapshotHeader header;
+  XdgUserDirsSnapshotEntry entry;
+  GPtrArray *unique_types, *unique_paths;
+  GHashTable *seen;
+  GArray *index;
+  GString *pool, *contents;
+  const char *runtime_dir;
+  char *snapshot_file, *old_contents;
+  gsize base, old_len;
+  guint32 i;
+
+  runtime_dir = g_getenv ("XDG_RUNTIME_DIR");
+  if (runtime_dir == NULL || !g_path_is_absolute (runtime_dir) ||
+      !g_file_test (runtime_dir, G_FILE_TEST_IS_DIR))
+    return;
+
+  /* The first entry of a type wins, like when parsing the file */
+  seen = g_hash_table_new (g_str_hash, g_str_equal);
+  unique_types = g_ptr_array_new ();
+  unique_paths = g_ptr_array_new ();
+  for (i = 0; i < types->len; i++)
+    {
+      if (!g_hash_table_add (seen, g_ptr_array_index (types, i)))
+        continue;
+      g_ptr_array_add (unique_types, g_ptr_array_index (types, i));
+      g_ptr_array_add (unique_paths, g_ptr_array_index (paths, i));
+    }
+  g_hash_table_destroy (seen);
+
+  index = g_array_sized_new (FALSE, FALSE, sizeof (guint32), unique_types->len);
+  for (i = 0; i < unique_types->len; i++)
+    g_array_append_val (index, i);
+  g_array_sort_with_data (index, compare_types, unique_types);
+
+  base = sizeof (header) +
+         unique_types->len * (sizeof (XdgUserDirsSnapshotEntry) + sizeof (guint32));
+  pool = g_string_new (NULL);
+  contents = g_string_new (NULL);
+
+  memset (&header, 0, sizeof (header));
+  memcpy (header.magic, XDG_USER_DIRS_SNAPSHOT_MAGIC, sizeof (header.magic));
+  header.version = XDG_USER_DIRS_SNAPSHOT_VERSION;
+  header.n_entries = unique_types->len;
+  /* The snapshot is only valid for this version of the text file */
+  header.source_dev = source->st_dev;
+  header.source_ino = source->st_ino;
+  header.source_size = source->st_size;
+  header.source_mtime_sec = source->st_mtim.tv_sec;
+  header.source_mtime_nsec = source->st_mtim.tv_nsec;
+  header.config_file = add_string (pool, base, config_file);
+  header.home_dir = add_string (pool, base, home_dir);
+  g_string_set_size (contents, sizeof (header));
+
+  for (i = 0; i < unique_types->len; i++)
+    {
+      entry.type = add_string (pool, base, g_ptr_array_index (unique_types, i));
+      entry.path = add_string (pool, base, g_ptr_array_index (unique_paths, i));
+      g_string_append_len (contents, (const char *) &entry, sizeof (entry));
+    }
+  g_string_append_len (contents, index->data, index->len * sizeof (guint32));
+  g_string_append_len (contents, pool->str, pool->len);
+
+  header.size = contents->len;
+  memcpy (contents->str, &header, sizeof (header));
+
+  /* Replace the file atomically, unless it is already up to date */
+  snapshot_file = g_build_filename (runtime_dir, XDG_USER_DIRS_SNAPSHOT_NAME, NULL);
+  if (!g_file_get_contents (snapshot_file, &old_contents, &old_len, NULL))
+    old_contents = NULL;
+
+  if (old_contents == NULL || old_len != contents->len ||
+      memcmp (old_contents, contents->str, old_len) != 0)
+    g_file_set_contents (snapshot_file, contents->str, contents->len, NULL);
+
+  g_free (old_contents);
+  g_free (snapshot_file);
+  g_string_free (contents, TRUE);
+  g_string_free (pool, TRUE);
+  g_array_free (index, TRUE);
+  g_ptr_array_free (unique_types, TRUE);
+  g_ptr_array_free (unique_paths, TRUE);
+}
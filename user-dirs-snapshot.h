@@ -0,0 +1,13 @@
+#ifndef __USER_DIRS_SNAPSHOT_H__
+#define __USER_DIRS_SNAPSHOT_H__
+
+#include <sys/stat.h>
+#include <glib.h>
+
+void user_dirs_snapshot_save (const char        *config_file,
+                              const struct stat *source,
+                              const char        *home_dir,
+                              GPtrArray         *types,
+                              GPtrArray         *paths);
+
+#endif /* __USER_DIRS_SNAPSHOT_H__ */
@@ -0,0 +1,212 @@
+#include <config.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+
+#include "user-dirs-stamp.h"
+
+/* The stamp records a fingerprint of everything an update run depends
+ * on, plus the directories it found configured. If none of it changed
+ * since the last run, running again would not change anything either,
+ * so a login can be handled with a few stat() calls instead of parsing
+ * every configuration file.
+ *
+ * Note that only the mtime of the application directories in
+ * XDG_DATA_DIRS is recorded, so adding or removing desktop files is
+ * noticed, but editing one in place is not.
+ */
+
+struct _UserDirsStamp {
+  char *stamp_file;
+  char *user_dirs_file;
+  GString *inputs;
+};
+
+static const char *locale_variables[] = {
+  "LANGUAGE", "LC_ALL", "LC_MESSAGES", "LC_CTYPE", "LANG", NULL
+};
+
+static void
+append_identity (GString *fingerprint, char tag, const char *path)
+{
+  struct stat statbuf;
+
+  if (stat (path, &statbuf) == 0)
+    g_string_append_printf (fingerprint, "%c %s %lu %lu %ld.%09ld %ld\n",
+                            tag, path,
+                            (gulong) statbuf.st_dev,
+                            (gulong) statbuf.st_ino,
+                            (long) statbuf.st_mtim.tv_sec,
+                            (long) statbuf.st_mtim.tv_nsec,
+                            (long) statbuf.st_size);
+  else
+    g_string_append_printf (fingerprint, "%c %s -\n", tag, path);
+}
+
+static void
+append_config_files (GString *fingerprint,
+                     const char *config_home,
+                     const char *filename)
+{
+  const char * const *config_paths;
+  char *path;
+  int i;
+
+  path = g_build_filename (config_home, filename, NULL);
+  append_identity (fingerprint, 'F', path);
+  g_free (path);
+
+  config_paths = g_get_system_config_dirs ();
+  for (i = 0; config_paths[i] != NULL; i++)
+    {
+      path = g_build_filename (config_paths[i], filename, NULL);
+      append_identity (fingerprint, 'F', path);
+      g_free (path);
+    }
+}
+
+static char *
+get_stamp_file (const char *config_home)
+{
+  const char *runtime_dir;
+
+  /* Prefer the runtime dir, it is local and cleared on reboot */
+  runtime_dir = g_getenv ("XDG_RUNTIME_DIR");
+  if (runtime_dir != NULL && g_path_is_absolute (runtime_dir) &&
+      g_file_test (runtime_dir, G_FILE_TEST_IS_DIR))
+    return g_build_filename (runtime_dir, "xdg-user-dirs.stamp", NULL);
+
+  return g_build_filename (config_home, "user-dirs.stamp", NULL);
+}
+
+/* Fingerprints the inputs of an update run. This should be called
+ * before the configuration is read, so that changes made during the
+ * run invalidate the saved stamp.
+ */
+UserDirsStamp *
+user_dirs_stamp_new (const char *config_home)
+{
+  UserDirsStamp *stamp;
+  const char * const *data_paths;
+  const char *value;
+  char *path;
+  int i;
+
+  stamp = g_new0 (UserDirsStamp, 1);
+  stamp->stamp_file = get_stamp_file (config_home);
+  stamp->user_dirs_file = g_build_filename (config_home, "user-dirs.dirs", NULL);
+  stamp->inputs = g_string_new (NULL);
+
+  g_string_append_printf (stamp->inputs, "V %s\n", VERSION);
+
+  for (i = 0; locale_variables[i] != NULL; i++)
+    {
+      value = g_getenv (locale_variables[i]);
+      g_string_append_printf (stamp->inputs, "L %s=%s\n",
+                              locale_variables[i], value ? value : "");
+    }
+
+  append_config_files (stamp->inputs, config_home, "user-dirs.conf");
+  append_config_files (stamp->inputs, config_home, "user-dirs.defaults");
+
+  data_paths = g_get_system_data_dirs ();
+  for (i = 0; data_paths[i] != NULL; i++)
+    {
+      path = g_build_filename (data_paths[i], "xdg-user-dirs", NULL);
+      append_identity (stamp->inputs, 'D', path);
+      g_free (path);
+    }
+
+  return stamp;
+}
+
+void
+user_dirs_stamp_free (UserDirsStamp *stamp)
+{
+  g_free (stamp->stamp_file);
+  g_free (stamp->user_dirs_file);
+  g_string_free (stamp->inputs, TRUE);
+  g_free (stamp);
+}
+
+static GString *
+get_fingerprint (UserDirsStamp *stamp)
+{
+  GString *fingerprint;
+
+  fingerprint = g_string_new (stamp->inputs->str);
+  append_identity (fingerprint, 'U', stamp->user_dirs_file);
+  return fingerprint;
+}
+
+/* Returns TRUE if the stamp is current and all the configured
+ * directories still exist.
+ */
+gboolean
+user_dirs_stamp_check (UserDirsStamp *stamp)
+{
+  GString *fingerprint;
+  char *contents;
+  char **lines;
+  char *path;
+  gboolean res;
+  int idx;
+
+  if (!g_file_get_contents (stamp->stamp_file, &contents, NULL, NULL))
+    return FALSE;
+
+  fingerprint = get_fingerprint (stamp);
+  res = g_str_has_prefix (contents, fingerprint->str);
+
+  if (res)
+    {
+      lines = g_strsplit (contents + fingerprint->len, "\n", -1);
+      for (idx = 0; res && lines[idx] != NULL; idx++)
+        {
+          if (lines[idx][0] == 0)
+            continue;
+
+          if (lines[idx][0] != 'E' || lines[idx][1] != ' ')
+            {
+              res = FALSE;
+              break;
+            }
+
+          path = g_strcompress (lines[idx] + 2);
+          res = g_file_test (path, G_FILE_TEST_IS_DIR);
+          g_free (path);
+        }
+      g_strfreev (lines);
+    }
+
+  g_string_free (fingerprint, TRUE);
+  g_free (contents);
+  return res;
+}
+
+/* Saves the stamp after a successful run. dir_paths are the absolute
+ * paths of the configured directories, which are checked for existence
+ * by the next user_dirs_stamp_check().
+ */
+void
+user_dirs_stamp_save (UserDirsStamp *stamp, GPtrArray *dir_paths)
+{
+  GString *contents;
+  char *escaped;
+  guint i;
+
+  contents = get_fingerprint (stamp);
+  for (i = 0; dir_paths != NULL && i < dir_paths->len; i++)
+    {
+      escaped = g_strescape (g_ptr_array_index (dir_paths, i), NULL);
+      g_string_append_printf (contents, "E %s\n", escaped);
+      g_free (escaped);
+    }
+
+  /* Failing to write the stamp only disables the fast path */
+  g_file_set_contents (stamp->stamp_file, contents->str, contents->len, NULL);
+  g_string_free (contents, TRUE);
+}
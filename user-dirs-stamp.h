@@ -0,0 +1,14 @@
+#ifndef __USER_DIRS_STAMP_H__
+#define __USER_DIRS_STAMP_H__
+
+#include <glib.h>
+
+typedef struct _UserDirsStamp UserDirsStamp;
+
+UserDirsStamp *user_dirs_stamp_new    (const char    *config_home);
+void           user_dirs_stamp_free   (UserDirsStamp *stamp);
+gboolean       user_dirs_stamp_check  (UserDirsStamp *stamp);
+void           user_dirs_stamp_save   (UserDirsStamp *stamp,
+                                       GPtrArray     *dir_paths);
+
+#endif /* __USER_DIRS_STAMP_H__ */
@@ -0,0 +1,338 @@
+#include <config.h>
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <glib.h>
+
+#include "user-dirs-stats.h"
+
+typedef struct {
+  gint64 time; /* microseconds */
+  guint64 ops[USER_DIRS_N_OPS];
+  gint64 read_syscalls; /* -1 if unknown */
+  gint64 write_syscalls;
+  guint64 allocations;
+} Sample;
+
+typedef struct {
+  guint calls;
+  int parent; /* phase running when this one was first begun, or -1 */
+  int depth;
+  Sample start;
+  Sample total; /* sum of the differences over all calls */
+} Phase;
+
+static const char *phase_names[USER_DIRS_N_PHASES] = {
+  "wait_for_lock",
+  "check_stamp",
+  "init_locale",
+  "load_all_configs",
+  "load_user_dirs",
+  "load_default_dirs",
+  "scan_desktop_files",
+  "create_default_dirs",
+  "prefetch",
+  "mkdir",
+  "rename",
+  "validate",
+  "save_user_dirs",
+  "save_locale",
+  "save_snapshot",
+};
+
+static const char *op_names[USER_DIRS_N_OPS] = {
+  "stat",
+  "open",
+  "mkdir",
+  "rename",
+};
+
+static gboolean enabled = FALSE;
+static Sample first;
+static Phase phases[USER_DIRS_N_PHASES];
+static UserDirsPhase order[USER_DIRS_N_PHASES]; /* in which phases began */
+static int n_order = 0;
+static UserDirsPhase running[USER_DIRS_N_PHASES];
+static int n_running = 0;
+static guint64 ops[USER_DIRS_N_OPS];
+static GPtrArray *arenas = NULL;
+static int proc_io_fd = -1;
+static gint64 proc_io_reads = 0;
+static gint64 deadline = -1; /* microseconds after the first sample */
+
+static gint64
+parse_proc_io_field (const char *buffer, const char *field)
+{
+  const char *p;
+
+  p = strstr (buffer, field);
+  if (p == NULL)
+    return -1;
+  return g_ascii_strtoll (p + strlen (field), NULL, 10);
+}
+
+/* Reading /proc/self/io is a read syscall itself, which the kernel
+ * counts once it is done, so the earlier ones are subtracted.
+ */
+static void
+read_proc_io (Sample *sample)
+{
+  char buffer[512];
+  ssize_t len;
+
+  sample->read_syscalls = -1;
+  sample->write_syscalls = -1;
+  if (proc_io_fd < 0)
+    return;
+
+  len = pread (proc_io_fd, buffer, sizeof (buffer) - 1, 0);
+  if (len <= 0)
+    return;
+  buffer[len] = 0;
+
+  sample->read_syscalls = parse_proc_io_field (buffer, "syscr: ");
+  sample->write_syscalls = parse_proc_io_field (buffer, "syscw: ");
+  if (sample->read_syscalls >= 0)
+    sample->read_syscalls -= proc_io_reads;
+  proc_io_reads++;
+}
+
+static void
+take_sample (Sample *sample)
+{
+  guint i;
+
+  sample->time = g_get_monotonic_time ();
+  memcpy (sample->ops, ops, sizeof (ops));
+  read_proc_io (sample);
+
+  sample->allocations = 0;
+  for (i = 0; i < arenas->len; i++)
+    sample->allocations += user_dirs_arena_n_allocations (g_ptr_array_index (arenas, i));
+}
+
+void
+user_dirs_stats_enable (void)
+{
+  int i;
+
+  for (i = 0; i < USER_DIRS_N_PHASES; i++)
+    phases[i].parent = -1;
+
+  arenas = g_ptr_array_new ();
+  proc_io_fd = open ("/proc/self/io", O_RDONLY | O_CLOEXEC);
+  enabled = TRUE;
+  take_sample (&first);
+}
+
+/* The arena must stay alive as long as phases are recorded */
+void
+user_dirs_stats_add_arena (UserDirsArena *arena)
+{
+  if (!enabled)
+    return;
+
+  g_ptr_array_add (arenas, arena);
+}
+
+void
+user_dirs_stats_begin (UserDirsPhase phase)
+{
+  Phase *p;
+
+  if (!enabled)
+    return;
+
+  p = &phases[phase];
+  if (p->calls++ == 0)
+    {
+      order[n_order++] = phase;
+      if (n_running > 0)
+        {
+          p->parent = running[n_running - 1];
+          p->depth = phases[p->parent].depth + 1;
+        }
+    }
+
+  running[n_running++] = phase;
+  take_sample (&p->start);
+}
+
+void
+user_dirs_stats_end (UserDirsPhase phase)
+{
+  Phase *p;
+  Sample now;
+  int i;
+
+  if (!enabled)
+    return;
+
+  take_sample (&now);
+
+  p = &phases[phase];
+  p->total.time += now.time - p->start.time;
+  for (i = 0; i < USER_DIRS_N_OPS; i++)
+    p->total.ops[i] += now.ops[i] - p->start.ops[i];
+  if (now.read_syscalls >= 0 && p->start.read_syscalls >= 0)
+    p->total.read_syscalls += now.read_syscalls - p->start.read_syscalls;
+  if (now.write_syscalls >= 0 && p->start.write_syscalls >= 0)
+    p->total.write_syscalls += now.write_syscalls - p->start.write_syscalls;
+  p->total.allocations += now.allocations - p->start.allocations;
+
+  g_assert (n_running > 0 && running[n_running - 1] == phase);
+  n_running--;
+}
+
+void
+user_dirs_stats_count (UserDirsOp op)
+{
+  if (!enabled)
+    return;
+
+  ops[op]++;
+}
+
+/* Reports whether the run took longer than budget milliseconds, as
+ * counted from user_dirs_stats_enable()
+ */
+void
+user_dirs_stats_set_deadline (guint budget)
+{
+  deadline = (gint64) budget * 1000;
+}
+
+static double
+overrun_ms (const Sample *total)
+{
+  return MAX (total->time - deadline, 0) / 1e3;
+}
+
+static void
+print_syscalls (FILE *file, gint64 value, gboolean json)
+{
+  if (first.read_syscalls < 0)
+    fprintf (file, json ? "null" : "%7s", "-");
+  else
+    fprintf (file, json ? "%" G_GINT64_FORMAT : "%7" G_GINT64_FORMAT, value);
+}
+
+static void
+print_json (FILE *file, const Sample *total, long max_rss)
+{
+  Phase *p;
+  int i, j;
+
+  fprintf (file, "{\"total_ms\":%.3f,\"max_rss_kb\":%ld", total->time / 1e3, max_rss);
+  for (j = 0; j < USER_DIRS_N_OPS; j++)
+    fprintf (file, ",\"%s\":%" G_GUINT64_FORMAT, op_names[j], total->ops[j]);
+  fprintf (file, ",\"read_syscalls\":");
+  print_syscalls (file, total->read_syscalls, TRUE);
+  fprintf (file, ",\"write_syscalls\":");
+  print_syscalls (file, total->write_syscalls, TRUE);
+  if (deadline >= 0)
+    fprintf (file, ",\"deadline_ms\":%.3f,\"overrun_ms\":%.3f",
+             deadline / 1e3, overrun_ms (total));
+  fprintf (file, ",\"phases\":[");
+
+  for (i = 0; i < n_order; i++)
+    {
+      p = &phases[order[i]];
+      fprintf (file, "%s{\"phase\":\"%s\",", i > 0 ? "," : "", phase_names[order[i]]);
+      if (p->parent >= 0)
+        fprintf (file, "\"parent\":\"%s\",", phase_names[p->parent]);
+      else
+        fprintf (file, "\"parent\":null,");
+      fprintf (file, "\"calls\":%u,\"wall_ms\":%.3f", p->calls, p->total.time / 1e3);
+      for (j = 0; j < USER_DIRS_N_OPS; j++)
+        fprintf (file, ",\"%s\":%" G_GUINT64_FORMAT, op_names[j], p->total.ops[j]);
+      fprintf (file, ",\"read_syscalls\":");
+      print_syscalls (file, p->total.read_syscalls, TRUE);
+      fprintf (file, ",\"write_syscalls\":");
+      print_syscalls (file, p->total.write_syscalls, TRUE);
+      fprintf (file, ",\"allocations\":%" G_GUINT64_FORMAT "}", p->total.allocations);
+    }
+
+  fprintf (file, "]}\n");
+}
+
+static void
+print_text_row (FILE *file, const char *name, int depth, guint calls,
+                const Sample *sample, gboolean with_allocations)
+{
+  int j;
+
+  fprintf (file, "%*s%-*s %5u %9.3f", depth * 2, "", 22 - depth * 2, name,
+           calls, sample->time / 1e3);
+  for (j = 0; j < USER_DIRS_N_OPS; j++)
+    fprintf (file, " %6" G_GUINT64_FORMAT, sample->ops[j]);
+  fprintf (file, " ");
+  print_syscalls (file, sample->read_syscalls, FALSE);
+  fprintf (file, " ");
+  print_syscalls (file, sample->write_syscalls, FALSE);
+  if (with_allocations)
+    fprintf (file, " %7" G_GUINT64_FORMAT, sample->allocations);
+  fprintf (file, "\n");
+}
+
+static void
+print_text (FILE *file, const Sample *total, long max_rss)
+{
+  Phase *p;
+  int i, j;
+
+  fprintf (file, "%-22s %5s %9s", "phase", "calls", "wall ms");
+  for (j = 0; j < USER_DIRS_N_OPS; j++)
+    fprintf (file, " %6s", op_names[j]);
+  fprintf (file, " %7s %7s %7s\n", "reads", "writes", "allocs");
+
+  for (i = 0; i < n_order; i++)
+    {
+      p = &phases[order[i]];
+      print_text_row (file, phase_names[order[i]], p->depth, p->calls, &p->total, TRUE);
+    }
+
+  print_text_row (file, "total", 0, 1, total, FALSE);
+  fprintf (file, "peak RSS %ld KiB\n", max_rss);
+  if (deadline >= 0 && total->time > deadline)
+    fprintf (file, "deadline %.3f ms, overrun by %.3f ms\n", deadline / 1e3, overrun_ms (total));
+  else if (deadline >= 0)
+    fprintf (file, "deadline %.3f ms, met\n", deadline / 1e3);
+}
+
+/* Prints the phases in the order they were first begun, and totals
+ * since user_dirs_stats_enable(). The counts of operations and
+ * syscalls include the time between phases.
+ */
+void
+user_dirs_stats_print (FILE *file, gboolean json)
+{
+  struct rusage usage;
+  Sample total;
+  int j;
+
+  if (!enabled)
+    return;
+
+  total.time = g_get_monotonic_time () - first.time;
+  for (j = 0; j < USER_DIRS_N_OPS; j++)
+    total.ops[j] = ops[j] - first.ops[j];
+  read_proc_io (&total);
+  if (total.read_syscalls >= 0)
+    total.read_syscalls -= first.read_syscalls;
+  if (total.write_syscalls >= 0)
+    total.write_syscalls -= first.write_syscalls;
+  total.allocations = 0;
+
+  if (getrusage (RUSAGE_SELF, &usage) != 0)
+    usage.ru_maxrss = 0;
+
+  if (json)
+    print_json (file, &total, usage.ru_maxrss);
+  else
+    print_text (file, &total, usage.ru_maxrss);
+}
@@ -0,0 +1,60 @@
+#ifndef __USER_DIRS_STATS_H__
+#define __USER_DIRS_STATS_H__
+
+#include <stdio.h>
+#include <glib.h>
+
+#include "user-dirs-arena.h"
+
+/* Wall time, file system operations and allocations of each phase of
+ * an xdg-user-dirs-update run, for --stats. Nothing is recorded until
+ * user_dirs_stats_enable() is called, and none of this is thread-safe,
+ * so it must not be enabled for runs with worker threads, e.g. --batch.
+ *
+ * Phases nest: a phase begun while another one is running is counted
+ * in both.
+ */
+
+typedef enum {
+  USER_DIRS_PHASE_WAIT_FOR_LOCK,
+  USER_DIRS_PHASE_CHECK_STAMP,
+  USER_DIRS_PHASE_INIT_LOCALE,
+  USER_DIRS_PHASE_LOAD_ALL_CONFIGS,
+  USER_DIRS_PHASE_LOAD_USER_DIRS,
+  USER_DIRS_PHASE_LOAD_DEFAULT_DIRS,
+  USER_DIRS_PHASE_SCAN_DESKTOP_FILES,
+  USER_DIRS_PHASE_CREATE_DEFAULT_DIRS,
+  USER_DIRS_PHASE_PREFETCH,
+  USER_DIRS_PHASE_MKDIR,
+  USER_DIRS_PHASE_RENAME,
+  USER_DIRS_PHASE_VALIDATE,
+  USER_DIRS_PHASE_SAVE_USER_DIRS,
+  USER_DIRS_PHASE_SAVE_LOCALE,
+  USER_DIRS_PHASE_SAVE_SNAPSHOT,
+  USER_DIRS_N_PHASES
+} UserDirsPhase;
+
+/* Operations counted where xdg-user-dirs-update issues them. One
+ * operation can take several syscalls, e.g. g_mkdir_with_parents()
+ * stats each ancestor, and a batch submitted to io_uring counts
+ * once. The read and write syscalls the kernel counted
+ * are reported as well, where /proc/self/io is available.
+ */
+typedef enum {
+  USER_DIRS_OP_STAT,
+  USER_DIRS_OP_OPEN,
+  USER_DIRS_OP_MKDIR,
+  USER_DIRS_OP_RENAME,
+  USER_DIRS_N_OPS
+} UserDirsOp;
+
+void user_dirs_stats_enable    (void);
+void user_dirs_stats_add_arena (UserDirsArena *arena);
+void user_dirs_stats_begin     (UserDirsPhase  phase);
+void user_dirs_stats_end       (UserDirsPhase  phase);
+void user_dirs_stats_count     (UserDirsOp     op);
+void user_dirs_stats_set_deadline (guint       budget);
+void user_dirs_stats_print     (FILE          *file,
+                                gboolean       json);
+
+#endif /* __USER_DIRS_STATS_H__ */
@@ -0,0 +1,119 @@
+#include <config.h>
+
+#include <glib.h>
+
+#include "user-dirs-table.h"
+#include "user-dirs-trie.h"
+
+Directory *
+directory_new (UserDirsArena *arena, const char *name, const char *path)
+{
+  Directory *dir;
+  dir = user_dirs_arena_alloc (arena, sizeof (Directory));
+  dir->name = user_dirs_arena_strdup (arena, name);
+  dir->path = user_dirs_arena_strdup (arena, path);
+  return dir;
+}
+
+UserDirsTable *
+user_dirs_table_new (UserDirsArena *arena)
+{
+  UserDirsTable *table;
+
+  table = g_new0 (UserDirsTable, 1);
+  table->arena = arena;
+  table->dirs = g_ptr_array_new ();
+  /* Keys are owned by the directories */
+  table->by_name = g_hash_table_new (g_str_hash, g_str_equal);
+  return table;
+}
+
+void
+user_dirs_table_free (UserDirsTable *table)
+{
+  g_hash_table_destroy (table->by_name);
+  g_ptr_array_free (table->dirs, TRUE);
+  g_free (table);
+}
+
+Directory *
+user_dirs_table_lookup (UserDirsTable *table, const char *name)
+{
+  return g_hash_table_lookup (table->by_name, name);
+}
+
+/* Appends dir, which must live at least as long as the table */
+void
+user_dirs_table_add (UserDirsTable *table, Directory *dir)
+{
+  g_ptr_array_add (table->dirs, dir);
+  if (!g_hash_table_contains (table->by_name, dir->name))
+    g_hash_table_insert (table->by_name, dir->name, dir);
+}
+
+/* Changes the path of the directory called name, or appends a new one */
+Directory *
+user_dirs_table_set (UserDirsTable *table, const char *name, const char *path)
+{
+  Directory *dir;
+
+  dir = user_dirs_table_lookup (table, name);
+  if (dir != NULL)
+    dir->path = user_dirs_arena_strdup (table->arena, path);
+  else
+    {
+      dir = directory_new (table->arena, name, path);
+      user_dirs_table_add (table, dir);
+    }
+
+  return dir;
+}
+
+typedef struct {
+  GCompareFunc compare_func;
+} SortData;
+
+static gint
+compare_dirs (gconstpointer a, gconstpointer b, gpointer user_data)
+{
+  SortData *data = user_data;
+
+  return data->compare_func (*(Directory **) a, *(Directory **) b);
+}
+
+/* Stable sort, compare_func gets passed two Directory pointers */
+void
+user_dirs_table_sort (UserDirsTable *table, GCompareFunc compare_func)
+{
+  SortData data = { compare_func };
+
+  g_ptr_array_sort_with_data (table->dirs, compare_dirs, &data);
+}
+
+static void
+append_dir (gpointer value, gpointer user_data)
+{
+  g_ptr_array_add (user_data, value);
+}
+
+/* Sorts parent directories before their children, and otherwise by
+ * the collation of their path components, see user_dirs_trie_foreach()
+ */
+void
+user_dirs_table_sort_by_path (UserDirsTable *table)
+{
+  UserDirsTrie *trie;
+  Directory *dir;
+  guint i;
+
+  trie = user_dirs_trie_new ();
+  for (i = 0; i < table->dirs->len; i++)
+    {
+      dir = g_ptr_array_index (table->dirs, i);
+      user_dirs_trie_insert (trie, dir->path, dir);
+    }
+
+  g_ptr_array_set_size (table->dirs, 0);
+  user_dirs_trie_foreach (trie, append_dir, table->dirs);
+  user_dirs_trie_free (trie);
+}
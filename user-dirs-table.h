@@ -0,0 +1,44 @@
+#ifndef __USER_DIRS_TABLE_H__
+#define __USER_DIRS_TABLE_H__
+
+#include <glib.h>
+
+#include "user-dirs-arena.h"
+
+typedef struct {
+  char *name;
+  char *path;
+} Directory;
+
+/* A list of directories in insertion order, indexed by name. If a name
+ * occurs more than once, lookups find the first one. The directories
+ * and their strings are allocated from the arena.
+ */
+typedef struct {
+  UserDirsArena *arena;
+  GPtrArray *dirs;
+  GHashTable *by_name;
+} UserDirsTable;
+
+Directory     *directory_new            (UserDirsArena   *arena,
+                                         const char      *name,
+                                         const char      *path);
+
+UserDirsTable *user_dirs_table_new      (UserDirsArena   *arena);
+void           user_dirs_table_free     (UserDirsTable   *table);
+Directory     *user_dirs_table_lookup   (UserDirsTable   *table,
+                                         const char      *name);
+void           user_dirs_table_add      (UserDirsTable   *table,
+                                         Directory       *dir);
+Directory     *user_dirs_table_set      (UserDirsTable   *table,
+                                         const char      *name,
+                                         const char      *path);
+void           user_dirs_table_sort     (UserDirsTable   *table,
+                                         GCompareFunc     compare_func);
+void           user_dirs_table_sort_by_path (UserDirsTable *table);
+
+#define user_dirs_table_size(table) ((table)->dirs->len)
+#define user_dirs_table_index(table, i) \
+  ((Directory *) g_ptr_array_index ((table)->dirs, (i)))
+
+#endif /* __USER_DIRS_TABLE_H__ */
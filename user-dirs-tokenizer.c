@@ -0,0 +1,456 @@
+/*
+  This file is not licenced under the GPL like the rest of the code.
+  Its is under the MIT license, to encourage reuse.
+
+  Copyright (c) 2007 Red Hat, Inc.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation files
+  (the "Software"), to deal in the Software without restriction,
+  including without limitation the rights to use, copy, modify, merge,
+  publish, distribute, sublicense, and/or sell copies of the Software,
+  and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions: 
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software. 
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+  BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+  ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#include <stdint.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "user-dirs-tokenizer.h"
+
+static int
+is_space (char c)
+{
+  return c == ' ' || c == '\t' || c == '\r' || c == '\f' || c == '\v';
+}
+
+#define ONES UINT64_C (0x0101010101010101)
+#define HIGHS UINT64_C (0x8080808080808080)
+
+static const unsigned char special[256] = {
+  ['"'] = 1, ['\\'] = 1, ['$'] = 1, ['`'] = 1, ['\n'] = 1,
+};
+
+/* Copies a run between special bytes, which are usually short enough
+ * that calling memmove() would cost more than the copy itself
+ */
+static inline char *
+copy_run (char *d, const char *s, size_t len)
+{
+  if (len >= 16)
+    {
+      memmove (d, s, len);
+      return d + len;
+    }
+
+  while (len-- > 0)
+    *d++ = *s++;
+  return d;
+}
+
+/* Non-zero if any byte of word is c */
+static inline uint64_t
+has_byte (uint64_t word, unsigned char c)
+{
+  uint64_t x = word ^ (ONES * c);
+
+  return (x - ONES) & ~x & HIGHS;
+}
+
+static inline const char *
+scan_special_scalar (const char *p,
+                     const char *end)
+{
+  while (p < end && !special[(unsigned char) *p])
+    p++;
+  return p;
+}
+
+/* 8 bytes at a time in a register */
+static inline const char *
+scan_special_swar (const char *p,
+                   const char *end)
+{
+  uint64_t word;
+
+  while (end - p >= 8)
+    {
+      memcpy (&word, p, 8);
+      if (has_byte (word, '"') | has_byte (word, '\\') | has_byte (word, '$') |
+          has_byte (word, '`') | has_byte (word, '\n'))
+        break;
+      p += 8;
+    }
+
+  return scan_special_scalar (p, end);
+}
+
+#ifdef __SSE2__
+static inline const char *
+scan_special_sse2 (const char *p,
+                   const char *end)
+{
+  const __m128i quote = _mm_set1_epi8 ('"');
+  const __m128i backslash = _mm_set1_epi8 ('\\');
+  const __m128i dollar = _mm_set1_epi8 ('$');
+  const __m128i backtick = _mm_set1_epi8 ('`');
+  const __m128i newline = _mm_set1_epi8 ('\n');
+  __m128i chunk, hits;
+  int mask;
+
+  while (end - p >= 16)
+    {
+      chunk = _mm_loadu_si128 ((const __m128i *) p);
+      hits = _mm_or_si128 (_mm_or_si128 (_mm_cmpeq_epi8 (chunk, quote),
+                                         _mm_cmpeq_epi8 (chunk, backslash)),
+                           _mm_or_si128 (_mm_cmpeq_epi8 (chunk, dollar),
+                                         _mm_cmpeq_epi8 (chunk, backtick)));
+      hits = _mm_or_si128 (hits, _mm_cmpeq_epi8 (chunk, newline));
+      mask = _mm_movemask_epi8 (hits);
+      if (mask != 0)
+        return p + __builtin_ctz (mask);
+      p += 16;
+    }
+
+  /* The rest in a register */
+  return scan_special_swar (p, end);
+}
+#endif
+
+static inline const char *
+scan_special (const char *p,
+              const char *end)
+{
+#ifdef __SSE2__
+  return scan_special_sse2 (p, end);
+#else
+  return scan_special_swar (p, end);
+#endif
+}
+
+void
+user_dirs_tokenizer_init (UserDirsTokenizer *tokenizer,
+                          const char *buffer,
+                          size_t len)
+{
+  tokenizer->p = buffer;
+  tokenizer->end = buffer + len;
+}
+
+/* Returns the next KEY=VALUE line, skipping comments and blank lines.
+ * The value has surrounding whitespace removed and may be empty.
+ * Returns 0 at the end of the buffer.
+ */
+int
+user_dirs_tokenizer_next (UserDirsTokenizer *tokenizer,
+                          UserDirsSlice *key,
+                          UserDirsSlice *value)
+{
+  const char *p, *line_end;
+
+  while (tokenizer->p < tokenizer->end)
+    {
+      p = tokenizer->p;
+      line_end = memchr (p, '\n', tokenizer->end - p);
+      if (line_end == NULL)
+        line_end = tokenizer->end;
+      tokenizer->p = line_end < tokenizer->end ? line_end + 1 : line_end;
+
+      while (p < line_end && is_space (*p))
+        p++;
+
+      /* Skip empty and comment lines */
+      if (p == line_end || *p == '#')
+        continue;
+
+      key->str = p;
+      while (p < line_end && !is_space (*p) && *p != '=')
+        p++;
+      key->len = p - key->str;
+
+      /* Skip whitespace and the = sign */
+      while (p < line_end && is_space (*p))
+        p++;
+      if (p < line_end && *p == '=')
+        p++;
+      while (p < line_end && is_space (*p))
+        p++;
+
+      while (line_end > p && is_space (line_end[-1]))
+        line_end--;
+
+      value->str = p;
+      value->len = line_end - p;
+      return 1;
+    }
+
+  return 0;
+}
+
+int
+user_dirs_slice_equal (const UserDirsSlice *slice,
+                       const char *str)
+{
+  return strncmp (slice->str, str, slice->len) == 0 && str[slice->len] == 0;
+}
+
+/* Turns a variable name like XDG_DESKTOP_DIR into the directory type,
+ * DESKTOP. Names of desktop files are kept as they are. Returns 0 if
+ * the key doesn't name a directory.
+ */
+int
+user_dirs_slice_dir_key (UserDirsSlice *key)
+{
+  if (key->len >= 8 &&
+      memcmp (key->str + key->len - 8, ".desktop", 8) == 0)
+    return 1;
+
+  if (key->len > 8 &&
+      memcmp (key->str, "XDG_", 4) == 0 &&
+      memcmp (key->str + key->len - 4, "_DIR", 4) == 0)
+    {
+      key->str += 4;
+      key->len -= 8;
+      return 1;
+    }
+
+  return 0;
+}
+
+/* Returns whether the directory type can be passed in the environment
+ * as XDG_<TYPE>_DIR. Names of desktop files can't, and XDG_RUNTIME_DIR
+ * is something else.
+ */
+int
+user_dirs_type_is_env (const char *type)
+{
+  const char *p;
+
+  if (*type == 0 || strcmp (type, "RUNTIME") == 0)
+    return 0;
+
+  for (p = type; *p; p++)
+    if (!((*p >= 'A' && *p <= 'Z') || (*p >= '0' && *p <= '9') || *p == '_'))
+      return 0;
+
+  return 1;
+}
+
+/* Extracts the path from a quoted user-dirs.dirs value, which must be
+ * "$HOME/..." or an absolute path. The resulting path is relative to
+ * the home directory unless absolute, and still shell escaped.
+ * Returns 0 if the value isn't valid.
+ */
+int
+user_dirs_slice_path (const UserDirsSlice *value,
+                      UserDirsSlice *path)
+{
+  const char *p, *end;
+
+  p = value->str;
+  end = p + value->len;
+
+  if (p == end || *p++ != '"')
+    return 0;
+
+  if (end - p >= 5 && memcmp (p, "$HOME", 5) == 0)
+    {
+      p += 5;
+      if (p < end && *p == '/')
+        {
+          /* "$HOME//x" is still below the home directory */
+          while (p < end && *p == '/')
+            p++;
+        }
+      else if (p < end && *p != '"')
+        return 0; /* Not ending after $HOME, nor followed by slash. Ignore */
+    }
+  else if (p == end || *p != '/')
+    return 0;
+
+  path->str = p;
+  for (;;)
+    {
+      p = scan_special (p, end);
+      if (p == end || *p == '"')
+        break;
+      if (*p == '\\' && p + 1 < end)
+        p++;
+      p++;
+    }
+  path->len = p - path->str;
+
+  return 1;
+}
+
+/* Removes shell escaping, writing a NUL terminated string of at most
+ * slice->len bytes to dest. dest may be the start of the slice itself.
+ * Returns the length of the result.
+ */
+size_t
+user_dirs_unescape (const UserDirsSlice *slice,
+                    char *dest)
+{
+  const char *s, *end, *run_end;
+  char *d;
+
+  s = slice->str;
+  end = s + slice->len;
+  d = dest;
+  while (s < end)
+    {
+      /* dest may overlap the slice, but never ahead of it */
+      run_end = scan_special (s, end);
+      d = copy_run (d, s, run_end - s);
+      s = run_end;
+      if (s == end)
+        break;
+
+      if (*s == '\\' && s + 1 < end)
+        s++;
+      *d++ = *s++;
+    }
+  *d = 0;
+
+  return d - dest;
+}
+
+/* Parses the contents of user-dirs.dirs, calling func with the
+ * unescaped path of each entry. Paths are either absolute or relative
+ * to the home directory. The strings passed to func are NUL terminated
+ * in place, so unlike the rest of the tokenizer this modifies the
+ * buffer, which needs room for one more byte after len.
+ */
+void
+user_dirs_parse_dirs (char *buffer,
+                      size_t len,
+                      UserDirsParseFunc func,
+                      void *user_data)
+{
+  UserDirsTokenizer tokenizer;
+  UserDirsSlice key, value, path;
+  char *type, *dest;
+
+  user_dirs_tokenizer_init (&tokenizer, buffer, len);
+  while (user_dirs_tokenizer_next (&tokenizer, &key, &value))
+    {
+      if (!user_dirs_slice_dir_key (&key) ||
+          !user_dirs_slice_path (&value, &path))
+        continue;
+
+      /* Both are slices of our own buffer, and neither the byte
+       * after the key nor the unescaped path overlap the other.
+       */
+      type = (char *) key.str;
+      type[key.len] = 0;
+      dest = (char *) path.str;
+      user_dirs_unescape (&path, dest);
+
+      func (type, dest, user_data);
+    }
+}
+
+/* Puts a backslash before $, ` and backslashes for use in a double
+ * quoted shell string, writing a NUL terminated string of at most
+ * len * 2 bytes to dest. Returns the length of the result.
+ */
+size_t
+user_dirs_escape (const char *str,
+                  size_t len,
+                  char *dest)
+{
+  const char *end, *run_end;
+  char *d;
+
+  end = str + len;
+  d = dest;
+  while (str < end)
+    {
+      run_end = scan_special (str, end);
+      d = copy_run (d, str, run_end - str);
+      str = run_end;
+      if (str == end)
+        break;
+
+      if (*str == '$' || *str == '`' || *str == '\\')
+        *d++ = '\\';
+      *d++ = *str++;
+    }
+  *d = 0;
+
+  return d - dest;
+}
+
+/* Returns the first of ", \, $, ` or newline in [p, end), or end */
+const char *
+user_dirs_scan_special (const char *p,
+                        const char *end)
+{
+  return scan_special (p, end);
+}
+
+const char *
+user_dirs_scan_special_scalar (const char *p,
+                               const char *end)
+{
+  return scan_special_scalar (p, end);
+}
+
+const char *
+user_dirs_scan_special_swar (const char *p,
+                             const char *end)
+{
+  return scan_special_swar (p, end);
+}
+
+#ifdef __SSE2__
+const char *
+user_dirs_scan_special_sse2 (const char *p,
+                             const char *end)
+{
+  return scan_special_sse2 (p, end);
+}
+#endif
+
+/* Returns whether str has no bytes above 127 */
+int
+user_dirs_is_ascii (const char *str,
+                    size_t len)
+{
+  const char *end = str + len;
+  uint64_t word, bits = 0;
+
+#ifdef __SSE2__
+  __m128i acc = _mm_setzero_si128 ();
+
+  for (; end - str >= 16; str += 16)
+    acc = _mm_or_si128 (acc, _mm_loadu_si128 ((const __m128i *) str));
+  if (_mm_movemask_epi8 (acc) != 0)
+    return 0;
+#endif
+
+  for (; end - str >= 8; str += 8)
+    {
+      memcpy (&word, str, 8);
+      bits |= word;
+    }
+  for (; str < end; str++)
+    bits |= (unsigned char) *str;
+
+  return (bits & UINT64_C (0x8080808080808080)) == 0;
+}
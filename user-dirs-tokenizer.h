@@ -0,0 +1,98 @@
+/*
+  This file is not licenced under the GPL like the rest of the code.
+  Its is under the MIT license, to encourage reuse.
+
+  Copyright (c) 2007 Red Hat, Inc.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation files
+  (the "Software"), to deal in the Software without restriction,
+  including without limitation the rights to use, copy, modify, merge,
+  publish, distribute, sublicense, and/or sell copies of the Software,
+  and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions: 
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software. 
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+  BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+  ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#ifndef __USER_DIRS_TOKENIZER_H__
+#define __USER_DIRS_TOKENIZER_H__
+
+#include <stddef.h>
+
+/* All configuration files of xdg-user-dirs share the same line based
+ * syntax: KEY=VALUE with optional whitespace around the = sign, and
+ * lines starting with # being comments. The tokenizer walks over a
+ * buffer (read or mmap()ed, it doesn't need to be NUL terminated) and
+ * returns slices into it, without allocating or modifying anything.
+ */
+
+typedef struct {
+  const char *str;
+  size_t len;
+} UserDirsSlice;
+
+typedef struct {
+  const char *p;
+  const char *end;
+} UserDirsTokenizer;
+
+/* Called by user_dirs_parse_dirs(), like XdgUserDirsFunc */
+typedef void (* UserDirsParseFunc) (const char *type,
+                                    const char *path,
+                                    void       *user_data);
+
+void   user_dirs_tokenizer_init (UserDirsTokenizer   *tokenizer,
+                                 const char          *buffer,
+                                 size_t               len);
+int    user_dirs_tokenizer_next (UserDirsTokenizer   *tokenizer,
+                                 UserDirsSlice       *key,
+                                 UserDirsSlice       *value);
+
+int    user_dirs_slice_equal    (const UserDirsSlice *slice,
+                                 const char          *str);
+int    user_dirs_slice_dir_key  (UserDirsSlice       *key);
+int    user_dirs_type_is_env    (const char          *type);
+int    user_dirs_slice_path     (const UserDirsSlice *value,
+                                 UserDirsSlice       *path);
+size_t user_dirs_unescape       (const UserDirsSlice *slice,
+                                 char                *dest);
+size_t user_dirs_escape         (const char          *str,
+                                 size_t               len,
+                                 char                *dest);
+void   user_dirs_parse_dirs     (char                *buffer,
+                                 size_t               len,
+                                 UserDirsParseFunc    func,
+                                 void                *user_data);
+
+/* Scanners for the bytes that matter when quoting and escaping, 16 at
+ * a time with SSE2 where available, one by one otherwise.
+ */
+const char *user_dirs_scan_special (const char   *p,
+                                    const char   *end);
+int         user_dirs_is_ascii     (const char   *str,
+                                    size_t        len);
+
+/* The scanners user_dirs_scan_special() is built from, for the tests
+ * to compare with each other
+ */
+const char *user_dirs_scan_special_scalar (const char *p,
+                                           const char *end);
+const char *user_dirs_scan_special_swar   (const char *p,
+                                           const char *end);
+#ifdef __SSE2__
+const char *user_dirs_scan_special_sse2   (const char *p,
+                                           const char *end);
+#endif
+
+#endif /* __USER_DIRS_TOKENIZER_H__ */
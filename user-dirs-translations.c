@@ -0,0 +1,164 @@
+#include <config.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "user-dirs-translations.h"
+
+/* Defines msgids[], sorted, and catalogs[], sorted by name, with each
+ * catalog's strings indexed like msgids and NULL if not translated.
+ */
+#include "user-dirs-translations-table.h"
+
+static int
+compare_string (const void *key, const void *elem)
+{
+  return strcmp (key, *(const char * const *) elem);
+}
+
+static int
+compare_catalog (const void *key, const void *elem)
+{
+  return strcmp (key, ((const Catalog *) elem)->name);
+}
+
+static int
+find_catalog (const char *name)
+{
+  const Catalog *catalog;
+
+  catalog = bsearch (name, catalogs, N_CATALOGS, sizeof (Catalog), compare_catalog);
+  if (catalog == NULL)
+    return -1;
+  return catalog - catalogs;
+}
+
+static void
+add_catalog (UserDirsLocale *locale, int catalog)
+{
+  int i;
+
+  if (catalog < 0 || locale->n_catalogs == USER_DIRS_MAX_CATALOGS)
+    return;
+
+  for (i = 0; i < locale->n_catalogs; i++)
+    if (locale->catalogs[i] == catalog)
+      return;
+
+  locale->catalogs[locale->n_catalogs++] = catalog;
+}
+
+/* Adds the catalogs for a locale name of the form
+ * language[_territory][.codeset][@modifier], from the most to the least
+ * specific one. The codeset is ignored, all catalogs are UTF-8.
+ */
+static void
+add_locale (UserDirsLocale *locale, const char *name, size_t len)
+{
+  char buffer[64], variant[64];
+  const char *territory, *codeset, *modifier, *end;
+  size_t language_len, territory_len, modifier_len;
+
+  if (len == 0 || len >= sizeof (buffer))
+    return;
+  memcpy (buffer, name, len);
+  buffer[len] = 0;
+  end = buffer + len;
+
+  modifier = strchr (buffer, '@');
+  if (modifier == NULL)
+    modifier = end;
+  codeset = memchr (buffer, '.', modifier - buffer);
+  if (codeset == NULL)
+    codeset = modifier;
+  territory = memchr (buffer, '_', codeset - buffer);
+  if (territory == NULL)
+    territory = codeset;
+
+  language_len = territory - buffer;
+  territory_len = codeset - territory;
+  modifier_len = end - modifier;
+
+  /* language_territory@modifier */
+  memcpy (variant, buffer, language_len + territory_len);
+  memcpy (variant + language_len + territory_len, modifier, modifier_len);
+  variant[language_len + territory_len + modifier_len] = 0;
+  add_catalog (locale, find_catalog (variant));
+
+  /* language@modifier, as in gettext the modifier counts for more
+   * than the territory
+   */
+  memcpy (variant + language_len, modifier, modifier_len);
+  variant[language_len + modifier_len] = 0;
+  add_catalog (locale, find_catalog (variant));
+
+  /* language_territory */
+  memcpy (variant + language_len, territory, territory_len);
+  variant[language_len + territory_len] = 0;
+  add_catalog (locale, find_catalog (variant));
+
+  /* language */
+  variant[language_len] = 0;
+  add_catalog (locale, find_catalog (variant));
+}
+
+/* language is a colon separated list of locales like $LANGUAGE, and
+ * may be NULL. messages_locale is the locale as returned by
+ * setlocale (LC_MESSAGES, NULL). As with gettext, a non-empty language
+ * replaces messages_locale, unless that is C, which disables
+ * translation altogether.
+ */
+void
+user_dirs_locale_init (UserDirsLocale *locale,
+                       const char *language,
+                       const char *messages_locale)
+{
+  const char *p, *end;
+
+  locale->n_catalogs = 0;
+
+  /* Like gettext, don't translate at all in the C locale */
+  if (messages_locale == NULL ||
+      strcmp (messages_locale, "C") == 0 ||
+      strcmp (messages_locale, "POSIX") == 0 ||
+      strncmp (messages_locale, "C.", 2) == 0)
+    return;
+
+  if (language == NULL || *language == 0)
+    {
+      add_locale (locale, messages_locale, strlen (messages_locale));
+      return;
+    }
+
+  for (p = language; *p; p = *end ? end + 1 : end)
+    {
+      end = strchr (p, ':');
+      if (end == NULL)
+        end = p + strlen (p);
+      add_locale (locale, p, end - p);
+    }
+}
+
+/* Returns msgid itself if there is no translation */
+const char *
+user_dirs_locale_translate (const UserDirsLocale *locale,
+                            const char *msgid)
+{
+  const char * const *found;
+  const char *translated;
+  int i, index;
+
+  found = bsearch (msgid, msgids, N_MSGIDS, sizeof (char *), compare_string);
+  if (found == NULL)
+    return msgid;
+  index = found - msgids;
+
+  for (i = 0; i < locale->n_catalogs; i++)
+    {
+      translated = catalogs[locale->catalogs[i]].strings[index];
+      if (translated != NULL)
+        return translated;
+    }
+
+  return msgid;
+}
@@ -0,0 +1,26 @@
+#ifndef __USER_DIRS_TRANSLATIONS_H__
+#define __USER_DIRS_TRANSLATIONS_H__
+
+/* Translations of the directory names in translate.c, compiled in at
+ * build time from the po files. Unlike gettext() these don't depend on
+ * the process locale, so jobs for different locales can translate
+ * concurrently, and nothing needs to be loaded at runtime.
+ */
+
+#define USER_DIRS_MAX_CATALOGS 8
+
+/* The catalogs to search, in order, like gettext() would for a locale
+ * and $LANGUAGE: the entries of $LANGUAGE if set, the locale otherwise.
+ */
+typedef struct {
+  int n_catalogs;
+  int catalogs[USER_DIRS_MAX_CATALOGS];
+} UserDirsLocale;
+
+void        user_dirs_locale_init      (UserDirsLocale       *locale,
+                                        const char           *language,
+                                        const char           *messages_locale);
+const char *user_dirs_locale_translate (const UserDirsLocale *locale,
+                                        const char           *msgid);
+
+#endif /* __USER_DIRS_TRANSLATIONS_H__ */
@@ -0,0 +1,284 @@
+#include <config.h>
+
+#include <string.h>
+#include <glib.h>
+
+#include "user-dirs-arena.h"
+#include "user-dirs-trie.h"
+
+typedef struct _Node Node;
+
+struct _Node {
+  char *name;
+  char *collate_key; /* computed when the node is first sorted */
+  Node *parent;
+  GHashTable *children; /* name -> Node, NULL until there are any */
+  GPtrArray *values;    /* in insertion order, NULL if none */
+};
+
+struct _UserDirsTrie {
+  UserDirsArena *arena;
+  Node *root;
+  GPtrArray *nodes; /* all of them, also those taken out of the tree */
+};
+
+static Node *
+node_new (UserDirsTrie *trie, Node *parent, const char *name)
+{
+  Node *node;
+
+  node = user_dirs_arena_alloc (trie->arena, sizeof (Node));
+  memset (node, 0, sizeof (Node));
+  node->name = user_dirs_arena_strdup (trie->arena, name);
+  node->parent = parent;
+  g_ptr_array_add (trie->nodes, node);
+
+  if (parent != NULL)
+    {
+      if (parent->children == NULL)
+        parent->children = g_hash_table_new (g_str_hash, g_str_equal);
+      g_hash_table_insert (parent->children, node->name, node);
+    }
+
+  return node;
+}
+
+UserDirsTrie *
+user_dirs_trie_new (void)
+{
+  UserDirsTrie *trie;
+
+  trie = g_new0 (UserDirsTrie, 1);
+  trie->arena = user_dirs_arena_new ();
+  trie->nodes = g_ptr_array_new ();
+  trie->root = node_new (trie, NULL, "");
+  return trie;
+}
+
+void
+user_dirs_trie_free (UserDirsTrie *trie)
+{
+  Node *node;
+  guint i;
+
+  for (i = 0; i < trie->nodes->len; i++)
+    {
+      node = g_ptr_array_index (trie->nodes, i);
+      if (node->children != NULL)
+        g_hash_table_destroy (node->children);
+      if (node->values != NULL)
+        g_ptr_array_free (node->values, TRUE);
+    }
+
+  g_ptr_array_free (trie->nodes, TRUE);
+  user_dirs_arena_free (trie->arena);
+  g_free (trie);
+}
+
+/* Returns the node for path, creating it and its parents if create
+ * is set, or NULL if there is none.
+ */
+static Node *
+find_node (UserDirsTrie *trie, const char *path, gboolean create)
+{
+  Node *node, *child;
+  char *copy, *component, *end;
+
+  node = trie->root;
+  if (*path == 0)
+    return node;
+
+  copy = g_strdup (path);
+  component = copy;
+  while (node != NULL)
+    {
+      end = strchr (component, '/');
+      if (end != NULL)
+        *end = 0;
+
+      child = NULL;
+      if (node->children != NULL)
+        child = g_hash_table_lookup (node->children, component);
+      if (child == NULL && create)
+        child = node_new (trie, node, component);
+      node = child;
+
+      if (end == NULL)
+        break;
+      component = end + 1;
+    }
+
+  g_free (copy);
+  return node;
+}
+
+void
+user_dirs_trie_insert (UserDirsTrie *trie, const char *path, gpointer value)
+{
+  Node *node;
+
+  node = find_node (trie, path, TRUE);
+  if (node->values == NULL)
+    node->values = g_ptr_array_new ();
+  g_ptr_array_add (node->values, value);
+}
+
+/* Returns whether value was stored at path */
+gboolean
+user_dirs_trie_remove (UserDirsTrie *trie, const char *path, gpointer value)
+{
+  Node *node;
+
+  node = find_node (trie, path, FALSE);
+  if (node == NULL || node->values == NULL)
+    return FALSE;
+
+  return g_ptr_array_remove (node->values, value);
+}
+
+static gint
+compare_nodes (gconstpointer a, gconstpointer b)
+{
+  Node *node_a = *(Node **) a;
+  Node *node_b = *(Node **) b;
+  int res;
+
+  /* Different names can collate equally, so fall back to their bytes
+   * to make the order total.
+   */
+  res = strcmp (node_a->collate_key, node_b->collate_key);
+  if (res == 0)
+    res = strcmp (node_a->name, node_b->name);
+  return res;
+}
+
+/* Returns the children of node sorted by the collation of their names,
+ * or NULL if there are none.
+ */
+static GPtrArray *
+sorted_children (UserDirsTrie *trie, Node *node)
+{
+  GPtrArray *children;
+  GHashTableIter iter;
+  gpointer value;
+  Node *child;
+  char *key;
+
+  if (node->children == NULL || g_hash_table_size (node->children) == 0)
+    return NULL;
+
+  children = g_ptr_array_sized_new (g_hash_table_size (node->children));
+  g_hash_table_iter_init (&iter, node->children);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+      child = value;
+      if (child->collate_key == NULL)
+        {
+          key = g_utf8_collate_key (child->name, -1);
+          child->collate_key = user_dirs_arena_strdup (trie->arena, key);
+          g_free (key);
+        }
+      g_ptr_array_add (children, child);
+    }
+
+  g_ptr_array_sort (children, compare_nodes);
+  return children;
+}
+
+typedef struct {
+  UserDirsTrie *trie;
+  GFunc func;
+  UserDirsTrieTakeFunc take_func;
+  gpointer user_data;
+  GString *rest;
+} Walk;
+
+static void
+walk (Walk *data, Node *node)
+{
+  GPtrArray *children;
+  gsize len;
+  guint i;
+
+  if (node->values != NULL)
+    for (i = 0; i < node->values->len; i++)
+      {
+        if (data->func != NULL)
+          data->func (g_ptr_array_index (node->values, i), data->user_data);
+        else
+          data->take_func (g_ptr_array_index (node->values, i),
+                           data->rest->str, data->user_data);
+      }
+
+  children = sorted_children (data->trie, node);
+  if (children == NULL)
+    return;
+
+  len = data->rest->len;
+  for (i = 0; i < children->len; i++)
+    {
+      Node *child = g_ptr_array_index (children, i);
+
+      g_string_append_c (data->rest, '/');
+      g_string_append (data->rest, child->name);
+      walk (data, child);
+      g_string_truncate (data->rest, len);
+    }
+
+  g_ptr_array_free (children, TRUE);
+}
+
+/* Calls func on every value, parents before their children. Siblings
+ * are ordered by the collation of their names, values at the same
+ * path by when they were inserted.
+ */
+void
+user_dirs_trie_foreach (UserDirsTrie *trie, GFunc func, gpointer user_data)
+{
+  Walk data = { trie, func, NULL, user_data, NULL };
+
+  data.rest = g_string_new (NULL);
+  walk (&data, trie->root);
+  g_string_free (data.rest, TRUE);
+}
+
+/* Removes the values at path and under it, and calls func on each of
+ * them in the same order as user_dirs_trie_foreach(). func may insert
+ * them again elsewhere, also under path.
+ *
+ * The empty path contains everything, so only the values at the root
+ * itself are taken.
+ */
+void
+user_dirs_trie_take (UserDirsTrie *trie, const char *path,
+                     UserDirsTrieTakeFunc func, gpointer user_data)
+{
+  Walk data = { trie, NULL, func, user_data, NULL };
+  GPtrArray *values;
+  Node *node;
+  guint i;
+
+  node = find_node (trie, path, FALSE);
+  if (node == NULL)
+    return;
+
+  if (node == trie->root)
+    {
+      values = node->values;
+      node->values = NULL;
+      if (values == NULL)
+        return;
+      for (i = 0; i < values->len; i++)
+        func (g_ptr_array_index (values, i), "", user_data);
+      g_ptr_array_free (values, TRUE);
+      return;
+    }
+
+  /* Detached first, so func can't insert anything into it */
+  g_hash_table_remove (node->parent->children, node->name);
+  node->parent = NULL;
+
+  data.rest = g_string_new (NULL);
+  walk (&data, node);
+  g_string_free (data.rest, TRUE);
+}
@@ -0,0 +1,37 @@
+#ifndef __USER_DIRS_TRIE_H__
+#define __USER_DIRS_TRIE_H__
+
+#include <glib.h>
+
+/* Values stored by path, in a tree with one node per path component,
+ * so that everything under a path can be found without looking at
+ * anything else. Paths are split at every '/', the empty path is the
+ * root. Several values can be stored at the same path.
+ */
+
+typedef struct _UserDirsTrie UserDirsTrie;
+
+/* rest is the part of the value's path after the one it was taken
+ * from, either empty or starting with '/'
+ */
+typedef void (* UserDirsTrieTakeFunc) (gpointer    value,
+                                       const char *rest,
+                                       gpointer    user_data);
+
+UserDirsTrie *user_dirs_trie_new     (void);
+void          user_dirs_trie_free    (UserDirsTrie         *trie);
+void          user_dirs_trie_insert  (UserDirsTrie         *trie,
+                                      const char           *path,
+                                      gpointer              value);
+gboolean      user_dirs_trie_remove  (UserDirsTrie         *trie,
+                                      const char           *path,
+                                      gpointer              value);
+void          user_dirs_trie_foreach (UserDirsTrie         *trie,
+                                      GFunc                 func,
+                                      gpointer              user_data);
+void          user_dirs_trie_take    (UserDirsTrie         *trie,
+                                      const char           *path,
+                                      UserDirsTrieTakeFunc  func,
+                                      gpointer              user_data);
+
+#endif /* __USER_DIRS_TRIE_H__ */
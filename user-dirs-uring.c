@@ -0,0 +1,320 @@
+#include <config.h>
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <glib.h>
+
+#include "user-dirs-uring.h"
+
+#ifdef ENABLE_IO_URING
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+/* Enough for all directories of a home in one go, usually */
+#define RING_ENTRIES 32
+
+struct _UserDirsUring {
+  int fd;
+  unsigned int entries;
+
+  void *sq_ring;
+  gsize sq_ring_size;
+  unsigned int *sq_head;
+  unsigned int *sq_tail;
+  unsigned int *sq_mask;
+  unsigned int *sq_array;
+  struct io_uring_sqe *sqes;
+  gsize sqes_size;
+
+  void *cq_ring; /* may be the same mapping as sq_ring */
+  gsize cq_ring_size;
+  unsigned int *cq_head;
+  unsigned int *cq_tail;
+  unsigned int *cq_mask;
+  struct io_uring_cqe *cqes;
+};
+
+typedef struct {
+  int opcode;
+  const int *dirfds;
+  const char * const *paths;
+  struct statx *statx_bufs;
+  int mode;
+} Batch;
+
+static int
+sys_io_uring_setup (unsigned int entries, struct io_uring_params *params)
+{
+  return syscall (__NR_io_uring_setup, entries, params);
+}
+
+static int
+sys_io_uring_enter (int fd, unsigned int to_submit, unsigned int min_complete,
+                    unsigned int flags)
+{
+  return syscall (__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int
+sys_io_uring_register (int fd, unsigned int opcode, void *arg, unsigned int nr_args)
+{
+  return syscall (__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+/* statx needs Linux 5.6 and mkdirat 5.15 */
+static gboolean
+supports_operations (int fd)
+{
+  struct io_uring_probe *probe;
+  gsize size;
+  gboolean res;
+
+  size = sizeof (struct io_uring_probe) + 256 * sizeof (struct io_uring_probe_op);
+  probe = g_malloc0 (size);
+  res = sys_io_uring_register (fd, IORING_REGISTER_PROBE, probe, 256) == 0 &&
+        probe->last_op >= IORING_OP_MKDIRAT &&
+        probe->last_op >= IORING_OP_STATX &&
+        (probe->ops[IORING_OP_STATX].flags & IO_URING_OP_SUPPORTED) &&
+        (probe->ops[IORING_OP_MKDIRAT].flags & IO_URING_OP_SUPPORTED);
+  g_free (probe);
+  return res;
+}
+
+UserDirsUring *
+user_dirs_uring_new (void)
+{
+  struct io_uring_params params;
+  UserDirsUring *ring;
+  int fd;
+
+  memset (&params, 0, sizeof (params));
+  fd = sys_io_uring_setup (RING_ENTRIES, &params);
+  if (fd < 0)
+    return NULL;
+
+  if (!supports_operations (fd))
+    {
+      close (fd);
+      return NULL;
+    }
+
+  ring = g_new0 (UserDirsUring, 1);
+  ring->fd = fd;
+  ring->entries = params.sq_entries;
+  ring->sq_ring = MAP_FAILED;
+  ring->cq_ring = MAP_FAILED;
+  ring->sqes = MAP_FAILED;
+
+  ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof (unsigned int);
+  ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof (struct io_uring_cqe);
+  if (params.features & IORING_FEAT_SINGLE_MMAP)
+    ring->sq_ring_size = ring->cq_ring_size = MAX (ring->sq_ring_size, ring->cq_ring_size);
+
+  ring->sq_ring = mmap (NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+  if (ring->sq_ring == MAP_FAILED)
+    goto fail;
+
+  if (params.features & IORING_FEAT_SINGLE_MMAP)
+    ring->cq_ring = ring->sq_ring;
+  else
+    {
+      ring->cq_ring = mmap (NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+      if (ring->cq_ring == MAP_FAILED)
+        goto fail;
+    }
+
+  ring->sqes_size = params.sq_entries * sizeof (struct io_uring_sqe);
+  ring->sqes = mmap (NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+  if (ring->sqes == MAP_FAILED)
+    goto fail;
+
+  ring->sq_head = (unsigned int *) ((char *) ring->sq_ring + params.sq_off.head);
+  ring->sq_tail = (unsigned int *) ((char *) ring->sq_ring + params.sq_off.tail);
+  ring->sq_mask = (unsigned int *) ((char *) ring->sq_ring + params.sq_off.ring_mask);
+  ring->sq_array = (unsigned int *) ((char *) ring->sq_ring + params.sq_off.array);
+  ring->cq_head = (unsigned int *) ((char *) ring->cq_ring + params.cq_off.head);
+  ring->cq_tail = (unsigned int *) ((char *) ring->cq_ring + params.cq_off.tail);
+  ring->cq_mask = (unsigned int *) ((char *) ring->cq_ring + params.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *) ((char *) ring->cq_ring + params.cq_off.cqes);
+
+  return ring;
+
+ fail:
+  user_dirs_uring_free (ring);
+  return NULL;
+}
+
+void
+user_dirs_uring_free (UserDirsUring *ring)
+{
+  if (ring->sqes != MAP_FAILED)
+    munmap (ring->sqes, ring->sqes_size);
+  if (ring->cq_ring != MAP_FAILED && ring->cq_ring != ring->sq_ring)
+    munmap (ring->cq_ring, ring->cq_ring_size);
+  if (ring->sq_ring != MAP_FAILED)
+    munmap (ring->sq_ring, ring->sq_ring_size);
+  close (ring->fd);
+  g_free (ring);
+}
+
+static void
+prepare (struct io_uring_sqe *sqe, const Batch *batch, guint i)
+{
+  memset (sqe, 0, sizeof (*sqe));
+  sqe->opcode = batch->opcode;
+  sqe->fd = batch->dirfds[i];
+  sqe->addr = (guintptr) batch->paths[i];
+  sqe->user_data = i;
+
+  if (batch->opcode == IORING_OP_STATX)
+    {
+      sqe->len = STATX_TYPE;
+      sqe->off = (guintptr) &batch->statx_bufs[i];
+    }
+  else
+    sqe->len = batch->mode;
+}
+
+/* Submits the operations a ring full at a time and waits for them.
+ * Returns FALSE if the ring stopped working, in which case some of
+ * them may have been done.
+ */
+static gboolean
+run_batch (UserDirsUring *ring, const Batch *batch, guint n, int *results)
+{
+  struct io_uring_cqe *cqe;
+  guint start, count, submitted, reaped, i;
+  unsigned int tail, head, index;
+  int res;
+
+  for (start = 0; start < n; start += count)
+    {
+      count = MIN (n - start, ring->entries);
+
+      tail = *ring->sq_tail;
+      for (i = start; i < start + count; i++)
+        {
+          index = tail & *ring->sq_mask;
+          prepare (&ring->sqes[index], batch, i);
+          ring->sq_array[index] = index;
+          tail++;
+        }
+      __atomic_store_n (ring->sq_tail, tail, __ATOMIC_RELEASE);
+
+      for (submitted = 0; submitted < count; submitted += res)
+        {
+          res = sys_io_uring_enter (ring->fd, count - submitted, 0, 0);
+          if (res < 0 && errno == EINTR)
+            res = 0;
+          else if (res <= 0)
+            return FALSE;
+        }
+
+      reaped = 0;
+      while (reaped < count)
+        {
+          head = *ring->cq_head;
+          if (head == __atomic_load_n (ring->cq_tail, __ATOMIC_ACQUIRE))
+            {
+              if (sys_io_uring_enter (ring->fd, 0, 1, IORING_ENTER_GETEVENTS) < 0 &&
+                  errno != EINTR)
+                return FALSE;
+              continue;
+            }
+
+          cqe = &ring->cqes[head & *ring->cq_mask];
+          if (cqe->user_data < n)
+            results[cqe->user_data] = cqe->res;
+          __atomic_store_n (ring->cq_head, head + 1, __ATOMIC_RELEASE);
+          reaped++;
+        }
+    }
+
+  return TRUE;
+}
+
+gboolean
+user_dirs_uring_statx (UserDirsUring      *ring,
+                       const int          *dirfds,
+                       const char * const *paths,
+                       guint               n_paths,
+                       mode_t             *types,
+                       int                *results)
+{
+  Batch batch = { IORING_OP_STATX, dirfds, paths, NULL, 0 };
+  gboolean res;
+  guint i;
+
+  batch.statx_bufs = g_new0 (struct statx, n_paths);
+  res = run_batch (ring, &batch, n_paths, results);
+
+  /* On failure the kernel may still write to the buffers */
+  if (!res)
+    return FALSE;
+
+  for (i = 0; i < n_paths; i++)
+    types[i] = results[i] == 0 ? batch.statx_bufs[i].stx_mode & S_IFMT : 0;
+  g_free (batch.statx_bufs);
+
+  return TRUE;
+}
+
+gboolean
+user_dirs_uring_mkdirat (UserDirsUring      *ring,
+                         const int          *dirfds,
+                         const char * const *paths,
+                         guint               n_paths,
+                         int                 mode,
+                         int                *results)
+{
+  Batch batch = { IORING_OP_MKDIRAT, dirfds, paths, NULL, mode };
+
+  return run_batch (ring, &batch, n_paths, results);
+}
+
+#else /* !ENABLE_IO_URING */
+
+UserDirsUring *
+user_dirs_uring_new (void)
+{
+  return NULL;
+}
+
+void
+user_dirs_uring_free (UserDirsUring *ring)
+{
+}
+
+gboolean
+user_dirs_uring_statx (UserDirsUring      *ring,
+                       const int          *dirfds,
+                       const char * const *paths,
+                       guint               n_paths,
+                       mode_t             *types,
+                       int                *results)
+{
+  return FALSE;
+}
+
+gboolean
+user_dirs_uring_mkdirat (UserDirsUring      *ring,
+                         const int          *dirfds,
+                         const char * const *paths,
+                         guint               n_paths,
+                         int                 mode,
+                         int                *results)
+{
+  return FALSE;
+}
+
+#endif /* ENABLE_IO_URING */
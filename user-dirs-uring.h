@@ -0,0 +1,36 @@
+#ifndef __USER_DIRS_URING_H__
+#define __USER_DIRS_URING_H__
+
+#include <sys/types.h>
+#include <glib.h>
+
+/* Runs batches of independent file system operations through
+ * io_uring, so that all of them are in flight at once instead of
+ * waiting for one round trip after another on network file systems.
+ *
+ * user_dirs_uring_new() returns NULL if io_uring is not available,
+ * because it wasn't enabled at build time, the kernel lacks one of the
+ * operations or it is blocked, and callers do the operations one at a
+ * time then. Each path is looked up from the descriptor at the same
+ * index, like with the *at() syscalls. Results are 0 or a negative
+ * errno, like the kernel's.
+ */
+
+typedef struct _UserDirsUring UserDirsUring;
+
+UserDirsUring *user_dirs_uring_new     (void);
+void           user_dirs_uring_free    (UserDirsUring      *ring);
+gboolean       user_dirs_uring_statx   (UserDirsUring      *ring,
+                                        const int          *dirfds,
+                                        const char * const *paths,
+                                        guint               n_paths,
+                                        mode_t             *types,
+                                        int                *results);
+gboolean       user_dirs_uring_mkdirat (UserDirsUring      *ring,
+                                        const int          *dirfds,
+                                        const char * const *paths,
+                                        guint               n_paths,
+                                        int                 mode,
+                                        int                *results);
+
+#endif /* __USER_DIRS_URING_H__ */
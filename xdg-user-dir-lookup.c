@@ -1,6 +1,8 @@
 /*
   This file is not licenced under the GPL like the rest of the code.
-  Its is under the MIT license, to encourage reuse by cut-and-paste.
+  Its is under the MIT license, to encourage reuse. The lookup
+  functions that used to be here for cut-and-paste are now available
+  from libxdg-user-dirs.
 
   Copyright (c) 2007 Red Hat, Inc.
 
@@ -28,190 +30,176 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <glib.h>
 
-static char *
-user_dirs_key_from_string (char *string,
-                           int len)
-{
-  if (len < 0)
-    len = strlen (string);
+#include "xdg-user-dirs.h"
+#include "user-dirs-tokenizer.h"
+
+/* Only libxdg-user-dirs and libc are used here, so that the lookup
+ * starts quickly and can be linked statically, see
+ * --enable-static-lookup.
+ */
 
-  string[len] = '\0';
+typedef enum {
+  FORMAT_LINES,
+  FORMAT_NUL,
+  FORMAT_JSON,
+  FORMAT_EXPORT
+} OutputFormat;
 
-  if (g_str_has_suffix (string, ".desktop"))
-    return string;
+typedef struct {
+  OutputFormat format;
+  int n_printed;
+} PrintAll;
 
-  if (g_str_has_prefix (string, "XDG_") &&
-      g_str_has_suffix (string, "_DIR"))
+static void
+print_json_string (const char *str)
+{
+  putchar ('"');
+  for (; *str; str++)
     {
-      string[len - 4] = '\0';
-      return string + 4;
+      if (*str == '"' || *str == '\\')
+        printf ("\\%c", *str);
+      else if ((unsigned char) *str < 0x20)
+        printf ("\\u%04x", *str);
+      else
+        putchar (*str);
     }
-
-  return NULL;
+  putchar ('"');
 }
 
-/**
- * xdg_user_dir_lookup_with_fallback:
- * @type: a string specifying the type of directory
- * @fallback: value to use if the directory isn't specified by the user
- * @returns: a newly allocated absolute pathname
- *
- * Looks up a XDG user directory of the specified type.
- * Example of types are "DESKTOP" and "DOWNLOAD".
- *
- * In case the user hasn't specified any directory for the specified
- * type the value returned is @fallback.
- *
- * The return value is newly allocated and must be freed with
- * free(). The return value is never NULL if @fallback != NULL, unless
- * out of memory.
- **/
-static char *
-xdg_user_dir_lookup_with_fallback (const char *type, const char *fallback)
+static void
+print_shell_string (const char *str)
 {
-  const char *home_dir, *config_home;
-  char *config_file;
-  char *buffer;
-  char *user_dir;
-  char *key, *key_end;
-  char *value, *value_end;
-  char *p;
-  char **lines;
-  int idx;
-  gboolean relative;
-  gboolean res;
-  
-  home_dir = g_get_home_dir ();
-  if (home_dir == NULL)
-    goto error;
-
-  config_home = g_get_user_config_dir ();
-  config_file = g_build_filename (config_home, "user-dirs.dirs", NULL);
-  res = g_file_get_contents (config_file, &buffer, NULL, NULL);
-  g_free (config_file);
-
-  if (!res)
-    goto error;
-
-  user_dir = NULL;
-  lines = g_strsplit (buffer, "\n", -1);
-  g_free (buffer);
-
-  for (idx = 0; lines[idx] != NULL; idx++)
+  putchar ('\'');
+  for (; *str; str++)
     {
-      p = lines[idx];
-      while (g_ascii_isspace (*p))
-	p++;
-
-      key = p;
-      while (*p && !g_ascii_isspace (*p) && * p != '=')
-	p++;
-
-      if (*p == 0)
-	continue;
-
-      key_end = p++;
-      key = user_dirs_key_from_string (key, key_end - key);
-      if (g_strcmp0 (key, type) != 0)
-        continue;
-
-      while (g_ascii_isspace (*p))
-	p++;
-
-      if (*p != '"')
-	continue;
-      p++;
-      
-      relative = FALSE;
-      if (g_str_has_prefix (p, "$HOME/"))
-	{
-	  p += 6;
-	  relative = TRUE;
-	}
-      else if (*p != '/')
-	continue;
-      value = p;
-
-      while (*p)
-	{
-	  if (*p == '"')
-	    break;
-	  if (*p == '\\' && *(p+1) != 0)
-	    p++;
-
-	  p++;
-	}
-
-      value_end = p;
-      *value_end = 0;
-      
-      if (relative)
-        user_dir = g_build_filename (home_dir, value, NULL);
+      if (*str == '\'')
+        fputs ("'\\''", stdout);
       else
-        user_dir = g_strdup (value);
+        putchar (*str);
+    }
+  putchar ('\'');
+}
 
+static void
+print_dir (OutputFormat format,
+           int with_type,
+           int first,
+           const char *type,
+           const char *path)
+{
+  switch (format)
+    {
+    case FORMAT_LINES:
+    case FORMAT_NUL:
+      if (with_type)
+        printf ("%s=", type);
+      fputs (path, stdout);
+      putchar (format == FORMAT_NUL ? '\0' : '\n');
+      break;
+    case FORMAT_JSON:
+      printf (first ? "{\n  " : ",\n  ");
+      print_json_string (type);
+      printf (": ");
+      print_json_string (path);
+      break;
+    case FORMAT_EXPORT:
+      /* The output is meant for eval, and types come from the command
+       * line or user-dirs.dirs, so only those that make valid variable
+       * names are printed. Desktop file ids don't, and RUNTIME would
+       * overwrite XDG_RUNTIME_DIR.
+       */
+      if (!user_dirs_type_is_env (type))
+        break;
+      printf ("export XDG_%s_DIR=", type);
+      print_shell_string (path);
+      putchar ('\n');
       break;
     }
-  g_strfreev (lines);
+}
 
-  if (user_dir)
-    return user_dir;
+static void
+print_all_dir (const char *type, const char *path, void *user_data)
+{
+  PrintAll *data = user_data;
 
- error:
-  if (fallback)
-    return strdup (fallback);
-  return NULL;
+  print_dir (data->format, 1, data->n_printed++ == 0, type, path);
 }
 
-/**
- * xdg_user_dir_lookup:
- * @type: a string specifying the type of directory
- * @returns: a newly allocated absolute pathname
- *
- * Looks up a XDG user directory of the specified type.
- * Example of types are "DESKTOP" and "DOWNLOAD".
- *
- * The return value is always != NULL (unless out of memory),
- * and if a directory
- * for the type is not specified by the user the default
- * is the home directory. Except for DESKTOP which defaults
- * to ~/Desktop.
- *
- * The return value is newly allocated and must be freed with
- * free().
- **/
-static char *
-xdg_user_dir_lookup (const char *type)
+static void
+usage (const char *argv0)
 {
-  char *dir;
-  const char *home_dir;
-	  
-  dir = xdg_user_dir_lookup_with_fallback (type, NULL);
-  if (dir != NULL)
-    return dir;
-
-  home_dir = g_get_home_dir ();
-  if (home_dir == NULL)
-    return strdup ("/tmp");
-  
-  /* Special case desktop for historical compatibility */
-  if (strcmp (type, "DESKTOP") == 0)
-    return g_build_filename (home_dir, "Desktop", NULL);
-
-  return strdup (home_dir);
+  fprintf (stderr,
+           "Usage %s [--format=lines|nul|json|export] <dir-type>...\n"
+           "       %s [--format=lines|nul|json|export] --all\n",
+           argv0, argv0);
+  exit (1);
 }
 
 int
 main (int argc, char *argv[])
 {
-  if (argc != 2)
+  OutputFormat format = FORMAT_LINES;
+  PrintAll data;
+  const char *format_name;
+  char *path;
+  int all = 0, n_types = 0;
+  int arg;
+
+  for (arg = 1; arg < argc; arg++)
     {
-      g_printerr ("Usage %s <dir-type>\n", argv[0]);
-      exit (1);
+      if (strcmp (argv[arg], "--all") == 0)
+        all = 1;
+      else if (strncmp (argv[arg], "--format=", strlen ("--format=")) == 0)
+        {
+          format_name = argv[arg] + strlen ("--format=");
+          if (strcmp (format_name, "lines") == 0)
+            format = FORMAT_LINES;
+          else if (strcmp (format_name, "nul") == 0)
+            format = FORMAT_NUL;
+          else if (strcmp (format_name, "json") == 0)
+            format = FORMAT_JSON;
+          else if (strcmp (format_name, "export") == 0)
+            format = FORMAT_EXPORT;
+          else
+            usage (argv[0]);
+        }
+      else if (argv[arg][0] == '-')
+        usage (argv[0]);
+      else
+        n_types++;
     }
-  
-  printf ("%s\n", xdg_user_dir_lookup (argv[1]));
+
+  if (all == (n_types > 0))
+    usage (argv[0]);
+
+  /* libxdg-user-dirs keeps the parsed file in memory, so all types are
+   * resolved with a single read of user-dirs.dirs.
+   */
+  if (all)
+    {
+      data.format = format;
+      data.n_printed = 0;
+      xdg_user_dirs_foreach (print_all_dir, &data);
+
+      if (format == FORMAT_JSON)
+        printf (data.n_printed > 0 ? "\n}\n" : "{}\n");
+    }
+  else
+    {
+      n_types = 0;
+      for (arg = 1; arg < argc; arg++)
+        {
+          if (argv[arg][0] == '-')
+            continue;
+          path = xdg_user_dir_lookup (argv[arg]);
+          print_dir (format, 0, n_types++ == 0, argv[arg], path);
+          free (path);
+        }
+
+      if (format == FORMAT_JSON)
+        printf ("\n}\n");
+    }
+
   return 0;
 }
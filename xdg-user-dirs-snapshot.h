@@ -0,0 +1,72 @@
+/*
+  This file is not licenced under the GPL like the rest of the code.
+  Its is under the MIT license, to encourage reuse.
+
+  Copyright (c) 2007 Red Hat, Inc.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation files
+  (the "Software"), to deal in the Software without restriction,
+  including without limitation the rights to use, copy, modify, merge,
+  publish, distribute, sublicense, and/or sell copies of the Software,
+  and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions: 
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software. 
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+  BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+  ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#ifndef __XDG_USER_DIRS_SNAPSHOT_H__
+#define __XDG_USER_DIRS_SNAPSHOT_H__
+
+#include <stdint.h>
+
+/* The snapshot is a binary copy of user-dirs.dirs with all paths
+ * resolved, kept in $XDG_RUNTIME_DIR so that it can be mmap()ed and
+ * used without any parsing. It is written by xdg-user-dirs-update
+ * next to the text file, which stays the source of truth: the
+ * snapshot records the identity of the user-dirs.dirs it was
+ * generated from and is ignored if that doesn't match anymore.
+ *
+ * Layout, in host byte order:
+ *   XdgUserDirsSnapshotHeader
+ *   XdgUserDirsSnapshotEntry entries[n_entries], in file order
+ *   uint32_t index[n_entries], entry numbers sorted by type
+ *   NUL-terminated strings, referenced by offset from the start
+ * The file always ends with a NUL byte.
+ */
+
+#define XDG_USER_DIRS_SNAPSHOT_NAME "xdg-user-dirs.snapshot"
+#define XDG_USER_DIRS_SNAPSHOT_MAGIC "XDGUDSNP"
+#define XDG_USER_DIRS_SNAPSHOT_VERSION 1
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t n_entries;
+  uint64_t source_dev;
+  uint64_t source_ino;
+  uint64_t source_size;
+  int64_t source_mtime_sec;
+  int64_t source_mtime_nsec;
+  uint32_t config_file; /* user-dirs.dirs path */
+  uint32_t home_dir;
+  uint32_t size; /* of the whole file */
+  uint32_t reserved;
+} XdgUserDirsSnapshotHeader;
+
+typedef struct {
+  uint32_t type;
+  uint32_t path; /* absolute */
+} XdgUserDirsSnapshotEntry;
+
+#endif /* __XDG_USER_DIRS_SNAPSHOT_H__ */
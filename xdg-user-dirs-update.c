@@ -4,7 +4,13 @@
 
 #include <sys/types.h>
 #include <sys/stat.h>
-#include <libintl.h>
+#include <sys/file.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#ifdef HAVE_SYS_INOTIFY_H
+#include <sys/inotify.h>
+#endif
 #include <locale.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -12,15 +18,27 @@
 #include <unistd.h>
 #include <stdarg.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <grp.h>
 #include <iconv.h>
 #include <langinfo.h>
+#include <poll.h>
+#include <pwd.h>
 #include <glib.h>
 #include <glib/gstdio.h>
 
-typedef struct {
-  char *name;
-  char *path;
-} Directory;
+#include "user-dirs-arena.h"
+#include "user-dirs-desktop-cache.h"
+#include "user-dirs-io.h"
+#include "user-dirs-plan.h"
+#include "user-dirs-snapshot.h"
+#include "user-dirs-stamp.h"
+#include "user-dirs-stats.h"
+#include "user-dirs-table.h"
+#include "user-dirs-tokenizer.h"
+#include "user-dirs-translations.h"
+#include "user-dirs-trie.h"
+#include "xdg-user-dirs.h"
 
 Directory backwards_compat_dirs[] = {
   { "DESKTOP", "Desktop" },
@@ -29,14 +47,54 @@ Directory backwards_compat_dirs[] = {
   { NULL}
 };
 
-static GList *default_dirs = NULL;
-static GList *user_dirs = NULL;
-
-/* Config: */
-static gboolean conf_enabled = TRUE;
-static char *conf_filename_encoding = NULL; /* NULL => utf8 */
+/* Parsed user-dirs.conf and user-dirs.defaults. In batch mode one
+ * Config is shared read-only by all jobs, unless a home has its own
+ * configuration files.
+ */
+typedef struct {
+  UserDirsArena *arena;
+  gboolean enabled;
+  char *filename_encoding; /* NULL => utf8 */
+  gboolean sync; /* flush saved files to disk before replacing the old ones */
+  guint time_budget; /* milliseconds the login may wait for, 0 for no limit */
+  UserDirsTable *default_dirs; /* sorted parents first, see load_default_dirs */
+  GHashTable *app_dirs; /* desktop id => AppDir, named per job */
+} Config;
+
+/* A directory from a .desktop file. Its default path uses the
+ * untranslated name, the one created is named in the job's language.
+ */
+typedef struct {
+  const char *parent; /* path of the default directory it is in */
+  UserDirsDesktopEntry *entry;
+} AppDir;
 
-static iconv_t filename_converter = (iconv_t)(-1);
+/* The state for updating a single home directory. All strings are
+ * allocated from the arena, and released together with it.
+ */
+typedef struct {
+  UserDirsArena *arena;
+  Config *config;
+  Config *private_config; /* owned, if the home overrides the system config */
+  char *home_dir;
+  char *config_home;
+  UserDirsRoot *home_root; /* relative paths are looked up from these */
+  UserDirsRoot *config_root;
+  const char *label; /* message prefix in batch mode, NULL otherwise */
+  uid_t uid;
+  gid_t gid;
+  gboolean switch_user;
+  const char *locale_name; /* LC_MESSAGES locale to name new dirs for */
+  UserDirsLocale locale;
+  char **languages; /* owned, the same locale for picking .desktop names */
+  UserDirsTable *user_dirs;
+  struct stat user_dirs_stat; /* of the user-dirs.dirs user_dirs match */
+  gboolean user_dirs_stat_valid;
+  iconv_t filename_converter;
+  gboolean filename_converter_keeps_ascii; /* ASCII converts to itself */
+  UserDirsPlan *plan; /* collects what would be done instead, with --plan */
+  gboolean files_changed; /* a configuration file was replaced */
+} Job;
 
 /* Args */
 static char *arg_dummy_file = NULL;
@@ -44,74 +102,55 @@ static char *arg_set_dir = NULL;
 static char *arg_set_value = NULL;
 static gboolean arg_force = FALSE;
 static gboolean arg_move = FALSE;
-
-static Directory *
-directory_new (const char *name, const char *path)
-{
-  Directory *dir;
-  dir = g_new0 (Directory, 1);
-  dir->name = g_strdup (name);
-  dir->path = g_strdup (path);
-  return dir;
-}
+static gboolean arg_no_fastpath = FALSE;
+static gboolean arg_watch = FALSE;
+static gboolean arg_stats = FALSE;
+static gboolean arg_stats_json = FALSE;
+static char *arg_stats_file = NULL;
+static gboolean arg_update_desktop_cache = FALSE;
+static gboolean arg_env_generator = FALSE;
+static char *arg_plan_file = NULL;
+static char *arg_apply_file = NULL;
+static gboolean arg_batch = FALSE;
+static char *arg_batch_file = NULL;
+static int arg_jobs = 0;
+static GPtrArray *arg_batch_entries = NULL;
+
+static int batch_failures = 0; /* only changed atomically */
 
 static void
-remove_trailing_whitespace (char *s)
-{
-  int len;
-
-  len = strlen (s);
-  while (len > 0 && g_ascii_isspace (s[len-1]))
-    {
-      s[len-1] = 0;
-      len--;
-    }
-}
-
-static char *
-shell_unescape (char *escaped)
+job_message (Job *job, FILE *stream, const char *format, ...)
 {
-  char *unescaped;
-  char *d;
+  va_list args;
+  char *message;
 
-  unescaped = g_malloc (strlen (escaped) + 1);
+  va_start (args, format);
+  message = g_strdup_vprintf (format, args);
+  va_end (args);
 
-  d = unescaped;
+  /* Write whole lines so output of concurrent jobs doesn't interleave */
+  if (job->label)
+    fprintf (stream, "%s: %s", job->label, message);
+  else
+    fputs (message, stream);
 
-  while (*escaped)
-    {
-      if (*escaped == '\\' && *(escaped + 1) != 0)
-	escaped++;
-      *d++ = *escaped++;
-    }
-  *d = 0;
-  return unescaped;
+  g_free (message);
 }
 
 static char *
-shell_escape (char *unescaped)
+shell_escape (UserDirsArena *arena, const char *unescaped)
 {
   char *escaped;
-  char *d;
-
-  escaped = g_malloc (strlen (unescaped) * 2 + 1);
-
-  d = escaped;
+  size_t len;
 
-  while (*unescaped)
-    {
-      if (*unescaped == '$' ||
-	  *unescaped == '`' ||
-	  *unescaped == '\\')
-	*d++ = '\\';
-      *d++ = *unescaped++;
-    }
-  *d = 0;
+  len = strlen (unescaped);
+  escaped = user_dirs_arena_alloc (arena, len * 2 + 1);
+  user_dirs_escape (unescaped, len, escaped);
   return escaped;
 }
 
 static char *
-filename_from_utf8 (const char *utf8_path)
+filename_from_utf8 (Job *job, const char *utf8_path)
 {
   size_t res, len;
   const char *in;
@@ -119,10 +158,13 @@ filename_from_utf8 (const char *utf8_path)
   size_t in_left, out_left, outbuf_size;
   int done;
   
-  if (filename_converter == (iconv_t)(-1))
-    return strdup (utf8_path);
+  if (job->filename_converter == (iconv_t)(-1))
+    return user_dirs_arena_strdup (job->arena, utf8_path);
 
+  /* Nearly all paths are ASCII, which most encodings leave as is */
   len = strlen (utf8_path);
+  if (job->filename_converter_keeps_ascii && user_dirs_is_ascii (utf8_path, len))
+    return user_dirs_arena_strndup (job->arena, utf8_path, len);
   outbuf_size = len + 1;
 
   done = 0;
@@ -130,28 +172,22 @@ filename_from_utf8 (const char *utf8_path)
     {
       in = utf8_path;
       in_left = len;
-      out = malloc (outbuf_size);
+      out = user_dirs_arena_alloc (job->arena, outbuf_size);
       out_left = outbuf_size - 1;
       outp = out;
   
-      res = iconv (filename_converter,
+      res = iconv (job->filename_converter,
 		   (ICONV_CONST char **)&in, &in_left,
 		   &outp, &out_left);
       if (res == (size_t)(-1) &&  errno == E2BIG)
-	{
-	  free (out);
-	  outbuf_size *= 2;
-	}
+	outbuf_size *= 2;
       else
 	done = 1;
     }
   while (!done);
 
   if (res == (size_t)(-1))
-    {
-      free (out);
-      return NULL;
-    }
+    return NULL;
 
   /* zero terminate */
   *outp = 0;
@@ -159,160 +195,217 @@ filename_from_utf8 (const char *utf8_path)
 }
 
 static char *
-get_user_config_file (const char *filename)
+get_user_config_file (Job *job, const char *filename)
+{
+  return user_dirs_arena_build_filename (job->arena, job->config_home, filename, NULL);
+}
+
+/* The system configuration directories are opened once, and shared
+ * by all jobs. Missing ones are left out.
+ */
+static UserDirsRoot **
+get_system_config_roots (void)
 {
-  const gchar *config_home;
-  config_home = g_get_user_config_dir ();
-  return g_build_filename (config_home, filename, NULL);
+  static gsize roots = 0;
+  const char * const *config_paths;
+  UserDirsRoot **new_roots;
+  int i, n;
+
+  if (g_once_init_enter (&roots))
+    {
+      config_paths = g_get_system_config_dirs ();
+      new_roots = g_new0 (UserDirsRoot *, g_strv_length ((char **) config_paths) + 1);
+      for (i = 0, n = 0; config_paths[i] != NULL; i++)
+        {
+          new_roots[n] = user_dirs_root_new (config_paths[i]);
+          user_dirs_stats_count (USER_DIRS_OP_OPEN);
+          if (user_dirs_root_open (new_roots[n]))
+            n++;
+          else
+            user_dirs_root_free (new_roots[n]);
+        }
+      new_roots[n] = NULL;
+      g_once_init_leave (&roots, (gsize) new_roots);
+    }
+
+  return (UserDirsRoot **) roots;
 }
 
+/* config_home is NULL to only look at the system configuration */
 static GList *
-get_config_files (char *filename)
+get_config_files (const char *config_home, char *filename)
 {
   int i;
   char *file;
-  const char * const *config_paths;
+  UserDirsRoot **roots;
   GList *paths;
 
   paths = NULL;
 
-  file = get_user_config_file (filename);
-  if (file)
+  if (config_home)
     {
+      file = g_build_filename (config_home, filename, NULL);
+      user_dirs_stats_count (USER_DIRS_OP_STAT);
       if (g_file_test (file, G_FILE_TEST_IS_REGULAR))
         paths = g_list_prepend (paths, file);
       else
 	g_free (file);
     }
 
-  config_paths = g_get_system_config_dirs ();
-  for (i = 0; config_paths[i] != NULL; i++)
+  roots = get_system_config_roots ();
+  for (i = 0; roots[i] != NULL; i++)
     {
-      file = g_build_filename (config_paths[i], filename, NULL);
-      if (g_file_test (file, G_FILE_TEST_IS_REGULAR))
-        paths = g_list_prepend (paths, file);
-      else
-	g_free (file);
+      user_dirs_stats_count (USER_DIRS_OP_STAT);
+      if (user_dirs_root_is_regular (roots[i], filename))
+        paths = g_list_prepend (paths,
+                                g_build_filename (user_dirs_root_get_path (roots[i]),
+                                                  filename, NULL));
     }
   
   return g_list_reverse (paths);
 }
 
 static gboolean
-is_true (const char *str)
+is_true (const UserDirsSlice *value)
 {
-  while (g_ascii_isspace (*str))
-    str++;
-  
-  if (*str == '1' ||
-      g_str_has_prefix (str, "True") ||
-      g_str_has_prefix (str, "true"))
+  if (value->len == 0)
+    return FALSE;
+
+  if (value->str[0] == '1' ||
+      (value->len >= 4 && memcmp (value->str, "True", 4) == 0) ||
+      (value->len >= 4 && memcmp (value->str, "true", 4) == 0))
     return TRUE;
   return FALSE;
 }
 
 static void
-load_config (char *path)
+load_config (Config *config, char *path)
 {
-  char *buffer, *p;
-  char *encoding;
-  char **lines;
-  int idx;
-  gboolean res;
-
-  res = g_file_get_contents (path, &buffer, NULL, NULL);
-  if (!res)
+  GMappedFile *file;
+  UserDirsTokenizer tokenizer;
+  UserDirsSlice key, value;
+  char *encoding, *budget;
+  guint64 ms;
+
+  user_dirs_stats_count (USER_DIRS_OP_OPEN);
+  file = g_mapped_file_new (path, FALSE, NULL);
+  if (file == NULL)
     return;
 
-  lines = g_strsplit (buffer, "\n", -1);
-  g_free (buffer);
-
-  for (idx = 0; lines[idx] != NULL; idx++)
+  user_dirs_tokenizer_init (&tokenizer,
+                            g_mapped_file_get_contents (file),
+                            g_mapped_file_get_length (file));
+  while (user_dirs_tokenizer_next (&tokenizer, &key, &value))
     {
-      p = lines[idx];
-
-      /* Skip whitespace */
-      while (g_ascii_isspace (*p))
-	p++;
-
-      /* Skip comment lines */      
-      if (*p == '#')
-	continue;
-
-      remove_trailing_whitespace (p);
-
-      if (g_str_has_prefix (p, "enabled="))
+      if (user_dirs_slice_equal (&key, "enabled"))
+	config->enabled = is_true (&value);
+      else if (user_dirs_slice_equal (&key, "sync"))
+	config->sync = is_true (&value);
+      else if (user_dirs_slice_equal (&key, "time_budget"))
 	{
-	  p += strlen ("enabled=");
-	  conf_enabled = is_true (p);
+          budget = g_strndup (value.str, value.len);
+          ms = g_ascii_strtoull (budget, NULL, 10);
+          config->time_budget = MIN (ms, G_MAXUINT);
+          g_free (budget);
 	}
-      if (g_str_has_prefix (p, "filename_encoding="))
+      else if (user_dirs_slice_equal (&key, "filename_encoding"))
 	{
-	  p += strlen ("filename_encoding=");
-
-	  while (g_ascii_isspace (*p))
-	    p++;
-
-          remove_trailing_whitespace (p);  
-          encoding = g_ascii_strup (p, -1);
-          g_free (conf_filename_encoding);
+          encoding = g_ascii_strup (value.str, value.len);
+          g_free (config->filename_encoding);
   
 	  if (strcmp (encoding, "UTF8") == 0 ||
 	      strcmp (encoding, "UTF-8") == 0)
-	    conf_filename_encoding = NULL;
+	    config->filename_encoding = NULL;
 	  else if (strcmp (encoding, "LOCALE") == 0)
-	    conf_filename_encoding = g_strdup (nl_langinfo (CODESET));
+	    config->filename_encoding = g_strdup (nl_langinfo (CODESET));
 	  else
-	    conf_filename_encoding = g_strdup (encoding);
+	    config->filename_encoding = g_strdup (encoding);
 
           g_free (encoding);
 	}
     }
 
-  g_strfreev (lines);
+  g_mapped_file_unref (file);
 }
 
-static gboolean
-load_all_configs (void)
+static Config *
+config_new (void)
+{
+  Config *config;
+
+  config = g_new0 (Config, 1);
+  config->arena = user_dirs_arena_new ();
+  config->enabled = TRUE;
+  config->default_dirs = user_dirs_table_new (config->arena);
+  config->app_dirs = g_hash_table_new (g_str_hash, g_str_equal);
+  return config;
+}
+
+static void
+config_free (Config *config)
+{
+  user_dirs_table_free (config->default_dirs);
+  g_hash_table_destroy (config->app_dirs);
+  user_dirs_arena_free (config->arena);
+  g_free (config->filename_encoding);
+  g_free (config);
+}
+
+static void
+load_all_configs (Config *config, const char *config_home)
 {
   GList *paths, *l;
   
-  paths = get_config_files ("user-dirs.conf");
+  paths = get_config_files (config_home, "user-dirs.conf");
 
   /* Load config files in reverse */
   for (l = g_list_last (paths); l != NULL; l = l->prev)
-    load_config (l->data);
+    load_config (config, l->data);
 
   g_list_foreach (paths, (GFunc) g_free, NULL);
   g_list_free (paths);
+}
+
+/* Only the system configuration can bound the login, as reading the
+ * home may be what blocks
+ */
+static guint
+get_time_budget (void)
+{
+  Config *config;
+  guint budget;
+
+  config = config_new ();
+  load_all_configs (config, NULL);
+  budget = config->time_budget;
+  config_free (config);
+  return budget;
+}
+
+/* iconv descriptors can't be shared between threads, so each job
+ * opens its own.
+ */
+static gboolean
+open_filename_converter (Job *job)
+{
+  const char *encoding;
 
-  if (conf_filename_encoding)
+  encoding = job->config->filename_encoding;
+  if (encoding)
     {
-      filename_converter = iconv_open (conf_filename_encoding, "UTF-8");
-      if (filename_converter == (iconv_t)(-1))
+      job->filename_converter = iconv_open (encoding, "UTF-8");
+      if (job->filename_converter == (iconv_t)(-1))
 	{
-	  g_printerr ("Can't convert from UTF-8 to %s\n", conf_filename_encoding);
+	  job_message (job, stderr, "Can't convert from UTF-8 to %s\n", encoding);
 	  return FALSE;
 	}
+      job->filename_converter_keeps_ascii =
+        user_dirs_converter_keeps_ascii (job->filename_converter);
     }
 
   return TRUE;
 }
 
-static int
-compare_dir_name (const Directory *dir, const char *name)
-{
-  return strcmp (dir->name, name);
-}
-
-static Directory *
-find_dir (GList *dirs, const char *name)
-{
-  GList *l;
-  l = g_list_find_custom (dirs, name, (GCompareFunc) compare_dir_name);
-  return (l != NULL) ? l->data : NULL;
-}
-
 /* modifies the input string */
 static char *
 user_dirs_key_from_string (char *string,
@@ -336,592 +429,806 @@ user_dirs_key_from_string (char *string,
   return NULL;
 }
 
-static char *
-user_dirs_key_to_string (char *key)
+static const char *
+user_dirs_key_to_string (UserDirsArena *arena, const char *key)
 {
   if (g_str_has_suffix (key, ".desktop"))
-    return g_strdup (key);
+    return key;
 
-  return g_strdup_printf ("XDG_%s_DIR", key);
+  return user_dirs_arena_strconcat (arena, "XDG_", key, "_DIR", NULL);
 }
 
 static Directory *
-get_dir_for_desktop_file (char *desktop_file_path)
+get_dir_for_desktop_entry (Config                     *config,
+                           const UserDirsDesktopEntry *entry)
 {
-  GKeyFile *keyfile;
-  char *special_dir_path;
-  Directory *retval;
-  char *desktop_id;
+  static const char * const no_languages[] = { NULL };
   char *parent_name, *parent_val;
-  Directory *parent_dir;
-  char *translated_name;
-  gboolean res;
-
-  keyfile = g_key_file_new ();
-  desktop_id = g_path_get_basename (desktop_file_path);
-  special_dir_path = NULL;
-
-  res = g_key_file_load_from_file (keyfile, desktop_file_path,
-                                   G_KEY_FILE_NONE,
-                                   NULL);
-  if (!res)
-    goto out;
-
-  parent_val = g_key_file_get_string (keyfile,
-                                      G_KEY_FILE_DESKTOP_TYPE_DIRECTORY,
-                                      "Parent",
-                                      NULL);
-  if (!parent_val)
-    goto out;
+  Directory *parent_dir, *dir;
+  const char *name;
+  AppDir *app_dir;
 
+  parent_val = user_dirs_arena_strdup (config->arena, entry->parent);
   parent_name = user_dirs_key_from_string (parent_val, -1);
   if (!parent_name)
-    goto out;
+    return NULL;
 
-  parent_dir = find_dir (default_dirs, parent_name);
+  parent_dir = user_dirs_table_lookup (config->default_dirs, parent_name);
   if (!parent_dir)
-    goto out;
+    return NULL;
 
-  translated_name = g_key_file_get_locale_string (keyfile,
-                                                  G_KEY_FILE_DESKTOP_TYPE_DIRECTORY,
-                                                  G_KEY_FILE_DESKTOP_KEY_NAME,
-                                                  NULL, NULL);
-  if (!translated_name)
-    goto out;
+  name = user_dirs_desktop_entry_get_name (entry, no_languages);
+  if (!name)
+    return NULL;
 
-  special_dir_path = g_build_filename (parent_dir->path, translated_name, NULL);
-  g_key_file_free (keyfile);
+  dir = directory_new (config->arena, entry->desktop_id,
+                       user_dirs_arena_build_filename (config->arena,
+                                                       parent_dir->path,
+                                                       name,
+                                                       NULL));
 
- out:
-  if (special_dir_path != NULL)
-    retval = directory_new (desktop_id, special_dir_path);
-  else
-    retval = NULL;
+  app_dir = user_dirs_arena_alloc (config->arena, sizeof (AppDir));
+  app_dir->parent = parent_dir->path;
+  app_dir->entry = user_dirs_desktop_entry_copy (entry, config->arena);
+  g_hash_table_insert (config->app_dirs, dir->name, app_dir);
 
-  g_free (desktop_id);
-  g_free (special_dir_path);
-  return retval;
+  return dir;
 }
 
-static GList *
-load_default_application_dirs (void)
+static char *
+get_user_desktop_cache_file (void)
 {
-  const char * const * data_paths;
-  GList *app_dirs = NULL;
-  int idx;
+  return g_build_filename (g_get_user_cache_dir (), "xdg-user-dirs",
+                           "desktop-files.cache", NULL);
+}
+
+/* The xdg-user-dirs directory of each data directory, in order */
+static char **
+get_application_dir_paths (guint *n_dirs)
+{
+  const char * const *data_paths;
+  char **paths;
+  guint i, n;
 
   data_paths = g_get_system_data_dirs ();
+  n = g_strv_length ((char **) data_paths);
+  paths = g_new0 (char *, n + 1);
+  for (i = 0; i < n; i++)
+    paths[i] = g_build_filename (data_paths[i], "xdg-user-dirs", NULL);
 
-  for (idx = 0; data_paths[idx] != NULL; idx++)
-    {
-      char *path;
-      GDir *dir;
-      const gchar *basename;
+  *n_dirs = n;
+  return paths;
+}
 
-      path = g_build_filename (data_paths[idx], "xdg-user-dirs", NULL);
-      if (!g_file_test (path, G_FILE_TEST_IS_DIR))
-        {
-          g_free (path);
-          continue;
-        }
+/* The .desktop files are looked up in the cache, which only needs a
+ * stat() per data directory if none of them changed. The cache in the
+ * user's cache directory is preferred, as it is updated as needed,
+ * then the system one from --update-desktop-cache.
+ *
+ * The directories are looked up together, so that changed files in
+ * all of them can be parsed in parallel. The results are then merged
+ * in $XDG_DATA_DIRS order, so that the first file with a desktop id
+ * wins as before.
+ */
+static void
+load_default_application_dirs (Config *config, UserDirsTable *app_dirs,
+                               gboolean use_user_cache)
+{
+  UserDirsDesktopCache *cache;
+  GPtrArray **entries;
+  char *user_cache_file;
+  char **dir_paths;
+  guint n_dirs, idx, i;
+
+  dir_paths = get_application_dir_paths (&n_dirs);
+  entries = g_new0 (GPtrArray *, n_dirs);
+
+  cache = user_dirs_desktop_cache_new ();
+  user_cache_file = NULL;
+  if (use_user_cache)
+    {
+      user_cache_file = get_user_desktop_cache_file ();
+      user_dirs_desktop_cache_load (cache, user_cache_file);
+    }
+  user_dirs_desktop_cache_load (cache, DESKTOP_CACHE_DIR "/desktop-files.cache");
+  user_dirs_desktop_cache_lookup (cache, (const char * const *) dir_paths, n_dirs, entries);
 
-      dir = g_dir_open (path, 0, NULL);
-      if (!dir)
-        {
-          g_free (path);
-          continue;
-        }
+  for (idx = 0; idx < n_dirs; idx++)
+    {
+      if (entries[idx] == NULL)
+        continue;
 
-      while ((basename = g_dir_read_name (dir)) != NULL)
+      for (i = 0; i < entries[idx]->len; i++)
         {
+          UserDirsDesktopEntry *entry;
           Directory *new_dir;
-          char *desktop_file_path;
-
-          if (!g_str_has_suffix (basename, ".desktop"))
-            continue;
 
-          if (find_dir (app_dirs, basename))
+          entry = g_ptr_array_index (entries[idx], i);
+          if (user_dirs_table_lookup (app_dirs, entry->desktop_id))
             continue;
 
-          desktop_file_path = g_build_filename (path, basename, NULL);
-          new_dir = get_dir_for_desktop_file (desktop_file_path);
+          new_dir = get_dir_for_desktop_entry (config, entry);
 
           if (new_dir != NULL)
-            app_dirs = g_list_prepend (app_dirs, new_dir);
-
-          g_free (desktop_file_path);
+            user_dirs_table_add (app_dirs, new_dir);
         }
-      
-      g_free (path);
-      g_dir_close (dir);
     }
 
-  return app_dirs;
+  /* Failing to save the cache only means parsing again next time */
+  if (user_cache_file && user_dirs_desktop_cache_is_dirty (cache))
+    user_dirs_desktop_cache_save (cache, user_cache_file, NULL);
+
+  g_free (user_cache_file);
+  user_dirs_desktop_cache_free (cache);
+  g_free (entries);
+  g_strfreev (dir_paths);
+}
+
+/* Rebuilds the system cache from scratch, for packages to run after
+ * adding or removing .desktop files in $XDG_DATA_DIRS/xdg-user-dirs
+ */
+static int
+update_desktop_cache (void)
+{
+  UserDirsDesktopCache *cache;
+  GPtrArray **entries;
+  GError *error = NULL;
+  char **dir_paths;
+  guint n_dirs;
+  int res;
+
+  dir_paths = get_application_dir_paths (&n_dirs);
+  entries = g_new0 (GPtrArray *, n_dirs);
+  cache = user_dirs_desktop_cache_new ();
+  user_dirs_desktop_cache_lookup (cache, (const char * const *) dir_paths, n_dirs, entries);
+
+  res = 0;
+  if (!user_dirs_desktop_cache_save (cache, DESKTOP_CACHE_DIR "/desktop-files.cache", &error))
+    {
+      g_printerr ("Can't save the desktop file cache: %s\n", error->message);
+      g_error_free (error);
+      res = 1;
+    }
+
+  user_dirs_desktop_cache_free (cache);
+  g_free (entries);
+  g_strfreev (dir_paths);
+  return res;
+}
+
+typedef struct {
+  const char *home_dir;
+  GHashTable *seen;
+} PrintEnvironment;
+
+static void
+print_environment_dir (const char *type, const char *path, void *user_data)
+{
+  PrintEnvironment *data = user_data;
+  const char *end = path + strlen (path);
+
+  /* As in the library, the first entry of a type counts */
+  if (g_hash_table_contains (data->seen, type))
+    return;
+  g_hash_table_add (data->seen, g_strdup (type));
+
+  /* The rest fall back to user-dirs.dirs: quotes, backslashes and
+   * dollar signs would need escaping that environment.d doesn't
+   * handle the same way everywhere.
+   */
+  if (!user_dirs_type_is_env (type) || user_dirs_scan_special (path, end) != end)
+    return;
+
+  if (*path == '/')
+    printf ("XDG_%s_DIR=\"%s\"\n", type, path);
+  else if (*path == 0)
+    printf ("XDG_%s_DIR=\"%s\"\n", type, data->home_dir);
+  else
+    printf ("XDG_%s_DIR=\"%s/%s\"\n", type, data->home_dir, path);
+}
+
+/* Prints the directories in user-dirs.dirs as XDG_<TYPE>_DIR="path"
+ * lines, for systemd to run as a user environment generator or to
+ * save in environment.d. Lookups with libxdg-user-dirs use them
+ * instead of reading user-dirs.dirs.
+ *
+ * The file is read directly, as the library would prefer what is
+ * already in the environment.
+ */
+static int
+print_environment (void)
+{
+  PrintEnvironment data;
+  char *user_config_file;
+  const char *end;
+
+  data.home_dir = g_get_home_dir ();
+  end = data.home_dir + strlen (data.home_dir);
+  if (user_dirs_scan_special (data.home_dir, end) != end)
+    return 0;
+
+  data.seen = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  user_config_file = g_build_filename (g_get_user_config_dir (), "user-dirs.dirs", NULL);
+  xdg_user_dirs_parse_file (user_config_file, print_environment_dir, &data);
+  g_free (user_config_file);
+  g_hash_table_destroy (data.seen);
+  return 0;
 }
 
 static gboolean
-load_default_dirs (void)
+load_default_dirs (Config *config, const char *config_home)
 {
-  char *buffer, *p;
-  char *key, *key_end, *value;
-  char **lines;
-  int idx;
-  Directory *dir;
+  GMappedFile *file;
+  UserDirsTokenizer tokenizer;
+  UserDirsSlice key, value;
+  UserDirsTable *app_dirs;
+  char *name, *path;
   GList *paths;
   gboolean res;
+  guint i;
 
   res = FALSE;
-  paths = get_config_files ("user-dirs.defaults");
+  paths = get_config_files (config_home, "user-dirs.defaults");
   if (paths == NULL)
     {
       g_printerr ("No default user directories\n");
       goto out;
     }
 
-  res = g_file_get_contents (paths->data, &buffer, NULL, NULL);  
-  if (!res)
+  user_dirs_stats_count (USER_DIRS_OP_OPEN);
+  file = g_mapped_file_new (paths->data, FALSE, NULL);
+  if (file == NULL)
     {
       g_printerr ("Can't open %s\n", (char *) paths->data);
       goto out;
     }
+  res = TRUE;
 
-  lines = g_strsplit (buffer, "\n", -1);
-  g_free (buffer);
-
-  for (idx = 0; lines[idx] != NULL; idx++)
+  user_dirs_tokenizer_init (&tokenizer,
+                            g_mapped_file_get_contents (file),
+                            g_mapped_file_get_length (file));
+  while (user_dirs_tokenizer_next (&tokenizer, &key, &value))
     {
-      p = lines[idx];
-
-      /* Skip whitespace */
-      while (g_ascii_isspace (*p))
-	p++;
-
-      /* Skip comment lines */
-      if (*p == '#')
+      if (key.len == 0 || value.len == 0)
 	continue;
 
-      key = p;
-      while (*p && !g_ascii_isspace (*p) && * p != '=')
-	p++;
-
-      key_end = p;
-
-      while (g_ascii_isspace (*p))
-	p++;
-      if (*p == '=')
-	p++;
-      while (g_ascii_isspace (*p))
-	p++;
-      
-      value = p;
-
-      *key_end = 0;
-
-      if (*key == 0 || *value == 0)
-	continue;
-      
-      dir = directory_new (key, value);
-      default_dirs = g_list_prepend (default_dirs, dir);
+      /* The last definition wins */
+      name = user_dirs_arena_strndup (config->arena, key.str, key.len);
+      path = user_dirs_arena_strndup (config->arena, value.str, value.len);
+      user_dirs_table_set (config->default_dirs, name, path);
     }
 
-  g_strfreev (lines);
+  g_mapped_file_unref (file);
 
  out:
   g_list_foreach (paths, (GFunc) g_free, NULL);
   g_list_free (paths);
 
   /* now load default application-provided dirs */
-  default_dirs = g_list_concat (default_dirs, load_default_application_dirs ());
+  app_dirs = user_dirs_table_new (config->arena);
+  user_dirs_stats_begin (USER_DIRS_PHASE_SCAN_DESKTOP_FILES);
+  load_default_application_dirs (config, app_dirs,
+                                 config_home != NULL && !arg_batch && arg_dummy_file == NULL);
+  user_dirs_stats_end (USER_DIRS_PHASE_SCAN_DESKTOP_FILES);
+  for (i = 0; i < user_dirs_table_size (app_dirs); i++)
+    {
+      Directory *dir = user_dirs_table_index (app_dirs, i);
+      user_dirs_table_set (config->default_dirs, dir->name, dir->path);
+    }
+  user_dirs_table_free (app_dirs);
+
+  /* Sort directories so that parent dirs come first than their children.
+   * This makes it easier to move subdirectories - see create_default_dirs.
+   */
+  user_dirs_table_sort_by_path (config->default_dirs);
   
   return res;
 }
 
 static void
-load_user_dirs (void)
+add_user_dir (const char *type, const char *path, void *user_data)
 {
-  char *buffer, *p;
-  char *key, *key_end, *value, *value_end;
-  char *unescaped;
-  char **lines;
-  int idx;
-  Directory *dir;
-  char *user_config_file;
-  gboolean res;
+  Job *job = user_data;
 
-  user_config_file = get_user_config_file ("user-dirs.dirs");
-  res = g_file_get_contents (user_config_file, &buffer, NULL, NULL);
-  g_free (user_config_file);
+  user_dirs_table_add (job->user_dirs, directory_new (job->arena, type, path));
+}
 
-  if (!res)
+static void
+load_user_dirs (Job *job)
+{
+  char *contents;
+  gsize len;
+
+  job->user_dirs_stat_valid = FALSE;
+  user_dirs_stats_count (USER_DIRS_OP_OPEN);
+  contents = user_dirs_root_read_file (job->config_root, "user-dirs.dirs",
+                                       &len, &job->user_dirs_stat);
+  if (contents == NULL)
     return;
 
-  lines = g_strsplit (buffer, "\n", -1);
-  g_free (buffer);
-
-  for (idx = 0; lines[idx] != NULL; idx++)
-    {
-      p = lines[idx];
-
-      /* Skip whitespace */
-      while (g_ascii_isspace (*p))
-	p++;
-
-      /* Skip comment lines */
-      if (*p == '#')
-	continue;
-
-      key = p;
-      while (*p && !g_ascii_isspace (*p) && * p != '=')
-	p++;
-
-      if (*p == 0)
-	continue;
-
-      key_end = p++;
-      key = user_dirs_key_from_string (key, key_end - key);
-      if (key == NULL)
-        continue;
-
-      while (g_ascii_isspace (*p))
-        p++;
-      if (*p == '=')
-	p++;
-      while (g_ascii_isspace (*p))
-	p++;
-
-      if (*p++ != '"')
-	continue;	
-
-      if (g_str_has_prefix (p, "$HOME"))
-	{
-	  p += 5;
-	  if (*p == '/')
-	    p++;
-	  else if (*p != '"' && *p != 0)
-	    continue; /* Not ending after $HOME, nor followed by slash. Ignore */
-	}
-      else if (*p != '/')
-	continue;
-      value = p;
+  user_dirs_parse_dirs (contents, len, add_user_dir, job);
+  job->user_dirs_stat_valid = TRUE;
+  g_free (contents);
+}
 
-      while (*p)
-	{
-	  if (*p == '"')
-	    break;
-	  if (*p == '\\' && *(p+1) != 0)
-	    p++;
+/* Returns whether the file could be saved, or was the same already.
+ * path is relative to root, which may be NULL. statbuf may be NULL.
+ */
+static gboolean
+save_file (Job *job, UserDirsRoot *root, const char *path,
+           GString *contents, int mode, struct stat *statbuf)
+{
+  int res;
 
-	  p++;
-	}
+  user_dirs_stats_count (USER_DIRS_OP_OPEN);
+  res = user_dirs_root_replace_file (root, path, contents->str, contents->len,
+                                     mode, job->config->sync, statbuf);
+  if (res > 0)
+    {
+      user_dirs_stats_count (USER_DIRS_OP_OPEN);
+      user_dirs_stats_count (USER_DIRS_OP_RENAME);
+      job->files_changed = TRUE;
+    }
 
-      value_end = p;
-      *value_end = 0;
+  return res >= 0;
+}
 
-      unescaped = shell_unescape (value);
-      dir = directory_new (key, unescaped);
-      user_dirs = g_list_prepend (user_dirs, dir);
-      g_free (unescaped);      
-    }
+/* The locale without its encoding part */
+static char *
+get_locale_to_save (Job *job)
+{
+  const char *dot;
 
-  user_dirs = g_list_reverse (user_dirs);
-  g_strfreev (lines);
+  dot = strchr (job->locale_name, '.');
+  if (dot == NULL)
+    return user_dirs_arena_strdup (job->arena, job->locale_name);
+  return user_dirs_arena_strndup (job->arena, job->locale_name, dot - job->locale_name);
 }
 
 static void
-save_locale (void)
+save_locale (Job *job, const char *locale)
 {
-  char *user_locale_file;
-  char *locale, *dot;
-
-  user_locale_file = get_user_config_file ("user-dirs.locale");
-  
-  locale = g_strdup (setlocale (LC_MESSAGES, NULL));
-  /* Skip encoding part */
-  dot = strchr (locale, '.');
-  if (dot)
-    *dot = 0;
+  GString *contents;
 
-  if (!g_file_set_contents (user_locale_file, locale, -1, NULL))
-    g_printerr ("Can't save user-dirs.locale\n");
+  contents = g_string_new (locale);
 
-  g_free (user_locale_file);
-  g_free (locale);
+  if (!save_file (job, job->config_root, "user-dirs.locale", contents, 0666, NULL))
+    job_message (job, stderr, "Can't save user-dirs.locale\n");
+  g_string_free (contents, TRUE);
 }
 
 static gboolean
-save_user_dirs (const char *dummy_file)
+save_user_dirs (Job *job, const char *dummy_file)
 {
-  FILE *file;
+  GString *contents;
+  UserDirsRoot *root;
   char *user_config_file;
-  char *tmp_file;
-  GList *l;
   Directory *user_dir;
-  int tmp_fd;
+  guint i;
+  int mkdir_res;
   gboolean res;
+  const char *slash;
   char *dir;
 
   res = TRUE;
 
-  tmp_file = NULL;
-  if (dummy_file)
-    user_config_file = g_strdup (dummy_file);
-  else
-    user_config_file = get_user_config_file ("user-dirs.dirs");
+  /* Until it is known which version of the file matches user_dirs */
+  job->user_dirs_stat_valid = FALSE;
 
-  dir = g_path_get_dirname (user_config_file);  
-  if (g_mkdir_with_parents (dir, 0700) < 0)
+  user_dirs_stats_count (USER_DIRS_OP_MKDIR);
+  if (dummy_file)
     {
-      g_printerr ("Can't save user-dirs.dirs, failed to create directory\n");
-      res = FALSE;
-      goto out;
+      root = NULL;
+      user_config_file = user_dirs_arena_strdup (job->arena, dummy_file);
+      slash = strrchr (user_config_file, G_DIR_SEPARATOR);
+      if (slash == NULL)
+        dir = ".";
+      else
+        dir = user_dirs_arena_strndup (job->arena, user_config_file,
+                                       MAX (slash - user_config_file, 1));
+      mkdir_res = g_mkdir_with_parents (dir, 0700);
     }
-
-  tmp_file = g_strconcat (user_config_file, "XXXXXX", NULL);  
-  tmp_fd = mkstemp (tmp_file);
-  if (tmp_fd == -1)
+  else
     {
-      g_printerr ("Can't save user-dirs.dirs\n");
-      res = FALSE;
-      goto out;
+      root = job->config_root;
+      user_config_file = "user-dirs.dirs";
+      mkdir_res = user_dirs_root_mkdir_with_parents (root, "", 0700);
     }
-  
-  file = fdopen (tmp_fd, "w");
-  if (file == NULL)
+  if (mkdir_res < 0)
     {
-      unlink (tmp_file);
-      g_printerr ("Can't save user-dirs.dirs\n");
+      job_message (job, stderr, "Can't save user-dirs.dirs, failed to create directory\n");
       res = FALSE;
       goto out;
     }
 
-  fprintf (file, "# This file is written by xdg-user-dirs-update\n");
-  fprintf (file, "# If you want to change or add directories, just edit the line you're\n");
-  fprintf (file, "# interested in. All local changes will be retained on the next run.\n");
-  fprintf (file, "# Format for general directories is XDG_xxx_DIR=\"$HOME/yyy\", where yyy is a shell-escaped\n");
-  fprintf (file, "# homedir-relative path, or XDG_xxx_DIR=\"/yyy\", where /yyy is an\n");
-  fprintf (file, "# absolute path.\n");
-  fprintf (file, "# Format for desktop-file speficic directories is\n");
-  fprintf (file, "# xxx.desktop=\"yyy\" where xxx.desktop is a valid directory\"\n");
-  fprintf (file, "# keyfile in $XDG_DATA_DIRS/xdg-user-dirs.\n");
-  fprintf (file, "# No other format is supported.\n");
-  fprintf (file, "# \n");
-
-  for (l = user_dirs; l != NULL; l = l->next)
+  contents = g_string_sized_new (1024);
+  g_string_append (contents,
+                   "# This file is written by xdg-user-dirs-update\n"
+                   "# If you want to change or add directories, just edit the line you're\n"
+                   "# interested in. All local changes will be retained on the next run.\n"
+                   "# Format for general directories is XDG_xxx_DIR=\"$HOME/yyy\", where yyy is a shell-escaped\n"
+                   "# homedir-relative path, or XDG_xxx_DIR=\"/yyy\", where /yyy is an\n"
+                   "# absolute path.\n"
+                   "# Format for desktop-file speficic directories is\n"
+                   "# xxx.desktop=\"yyy\" where xxx.desktop is a valid directory\"\n"
+                   "# keyfile in $XDG_DATA_DIRS/xdg-user-dirs.\n"
+                   "# No other format is supported.\n"
+                   "# \n");
+
+  for (i = 0; i < user_dirs_table_size (job->user_dirs); i++)
     {
-      char *escaped, *name;
-      const char *relative_prefix;
+      const char *name, *escaped, *relative_prefix;
 
-      user_dir = l->data;
+      user_dir = user_dirs_table_index (job->user_dirs, i);
 
-      name = user_dirs_key_to_string (user_dir->name);
-      escaped = shell_escape (user_dir->path);
+      name = user_dirs_key_to_string (job->arena, user_dir->name);
+      escaped = shell_escape (job->arena, user_dir->path);
       if (g_path_is_absolute (escaped))
         relative_prefix = "";
       else
         relative_prefix = "$HOME/";
 
-      fprintf (file, "%s=\"%s%s\"\n",
-               name,
-               relative_prefix,
-               escaped);
-      g_free (escaped);
-      g_free (name);
+      g_string_append_printf (contents, "%s=\"%s%s\"\n",
+                              name,
+                              relative_prefix,
+                              escaped);
     }
 
-  fclose (file);
-
-  if (rename (tmp_file, user_config_file) == -1)
+  if (!save_file (job, root, user_config_file, contents, 0600,
+                  dummy_file ? NULL : &job->user_dirs_stat))
     {
-      unlink (tmp_file);
-      g_printerr ("Can't save user-dirs.dirs\n");
+      job_message (job, stderr, "Can't save user-dirs.dirs\n");
       res = FALSE;
     }
+  else if (dummy_file == NULL)
+    job->user_dirs_stat_valid = TRUE;
+  g_string_free (contents, TRUE);
 
  out:
-  g_free (dir);
-  g_free (tmp_file);
-  g_free (user_config_file);
   return res;
 }
 
-
 static char *
-localize_path_name (const char *path)
+localize_path_name (Job *job, const char *path)
 {
-  char *res;
+  GPtrArray *elements;
   const char *element, *element_end;
-  char *element_copy;
-  char *translated;
-  gboolean has_slash;
+  char *element_copy, *res, *p;
+  const char *translated;
+  gsize len;
+  guint i;
 
-  res = g_strdup ("");
+  /* Translated elements, each preceded by a slash or "" */
+  elements = g_ptr_array_new ();
+  len = 0;
 
   while (*path)
     {
-      has_slash = FALSE;
+      if (*path == '/')
+        g_ptr_array_add (elements, "/");
+      else
+        g_ptr_array_add (elements, "");
       while (*path == '/')
-	{
-	  path++;
-	  has_slash = TRUE;
-	}
+	path++;
 
       element = path;
       while (*path && *path != '/')
 	path++;
       element_end = path;
 
-      element_copy = g_strndup (element, element_end - element);
-      translated = gettext (element_copy);
+      element_copy = user_dirs_arena_strndup (job->arena, element, element_end - element);
+      translated = user_dirs_locale_translate (&job->locale, element_copy);
+      g_ptr_array_add (elements, (char *) translated);
 
-      res = g_realloc (res, strlen (res) + 1 + strlen (translated) + 1);
-      if (has_slash)
-	strcat (res, "/");
-      strcat (res, translated);
-      
-      g_free (element_copy);
+      len += 1 + strlen (translated);
     }
-  
+
+  res = user_dirs_arena_alloc (job->arena, len + 1);
+  p = res;
+  for (i = 0; i < elements->len; i++)
+    p = g_stpcpy (p, g_ptr_array_index (elements, i));
+
+  g_ptr_array_free (elements, TRUE);
   return res;
 }
 
 static char *
-make_path_absolute (const char *path)
+make_path_absolute (Job *job, const char *path)
 {
   if (g_path_is_absolute (path))
-    return g_strdup (path);
+    return user_dirs_arena_strdup (job->arena, path);
   else
-    return g_build_filename (g_get_home_dir (), path, NULL);
+    return user_dirs_arena_build_filename (job->arena, job->home_dir, path, NULL);
 }
 
 static gboolean
-validate_user_dir_path (Directory *user_dir)
+validate_user_dir_path (Job *job, Directory *user_dir)
 {
-  char *path_name;
   gboolean path_valid = TRUE;
 
-  path_name = make_path_absolute (user_dir->path);
-
   /* If the path doesn't exist, reset it to an empty value.
    * By spec, it will be treated as the home directory itself.
    */
-  if (!g_file_test (path_name, G_FILE_TEST_IS_DIR))
+  user_dirs_stats_count (USER_DIRS_OP_STAT);
+  if (!user_dirs_root_is_dir (job->home_root, user_dir->path))
     {
-      g_printerr ("%s was removed, reassigning %s to homedir\n",
-                  path_name, user_dir->name);
-      g_free (user_dir->path);
-      user_dir->path = g_strdup ("");
+      job_message (job, stderr, "%s was removed, reassigning %s to homedir\n",
+                   make_path_absolute (job, user_dir->path), user_dir->name);
+      user_dir->path = user_dirs_arena_strdup (job->arena, "");
       path_valid = FALSE;
     }
  
-  g_free (path_name);
   return path_valid;
 }
 
-static char *
-get_backwards_compat_path (Directory *default_dir,
-                           char **relative_path_name_out)
+static Directory *
+find_backwards_compat_dir (Directory *default_dir)
 {
-  Directory *compat_dir;
-  char *path_name, *relative_path_name;
   int idx;
 
-  path_name = NULL;
-  relative_path_name = NULL;
-  compat_dir = NULL;
-
   for (idx = 0; backwards_compat_dirs[idx].name != NULL; idx++)
     {
-      if (compare_dir_name (default_dir, backwards_compat_dirs[idx].name) == 0)
-        {
-          compat_dir = &backwards_compat_dirs[idx];
-          break;
-        }
+      if (strcmp (default_dir->name, backwards_compat_dirs[idx].name) == 0)
+        return &backwards_compat_dirs[idx];
     }
 
-  if (compat_dir)
+  return NULL;
+}
+
+/* Returns the home-relative path of an existing directory by an old
+ * name, or NULL
+ */
+static char *
+get_backwards_compat_path (Job *job, Directory *default_dir)
+{
+  Directory *compat_dir;
+
+  compat_dir = find_backwards_compat_dir (default_dir);
+  if (compat_dir == NULL)
+    return NULL;
+
+  user_dirs_stats_count (USER_DIRS_OP_STAT);
+  if (!user_dirs_root_is_dir (job->home_root, compat_dir->path))
+    return NULL;
+
+  return compat_dir->path;
+}
+
+/* Returns the home-relative path */
+static char *
+get_translated_path_name (Job *job, Directory *default_dir)
+{
+  char *relative_path_name, *translated_name;
+  const char *name;
+  AppDir *app_dir;
+
+  app_dir = g_hash_table_lookup (job->config->app_dirs, default_dir->name);
+  if (app_dir != NULL)
     {
-      path_name = g_build_filename (g_get_home_dir (), compat_dir->path, NULL);
-      if (g_file_test (path_name, G_FILE_TEST_IS_DIR))
-        {
-          relative_path_name = g_strdup (compat_dir->path);
-        }
-      else
+      name = user_dirs_desktop_entry_get_name (app_dir->entry,
+                                               (const char * const *) job->languages);
+      translated_name = user_dirs_arena_build_filename (job->arena,
+                                                        localize_path_name (job, app_dir->parent),
+                                                        name, NULL);
+    }
+  else
+    translated_name = localize_path_name (job, default_dir->path);
+  relative_path_name = filename_from_utf8 (job, translated_name);
+
+  if (relative_path_name == NULL)
+    relative_path_name = translated_name;
+
+  return relative_path_name;
+}
+
+/* Does the lookups create_default_dirs() needs, and creates the
+ * directories that are new to user-dirs.dirs, in a batch each where
+ * the kernel allows, instead of one round trip after another. When
+ * moving, directories are created in order, as a new one could be
+ * inside of one that is moved.
+ */
+static void
+prefetch_default_dirs (Job *job, gboolean force, gboolean for_dummy_file)
+{
+  GPtrArray *paths;
+  Directory *user_dir, *default_dir, *compat_dir;
+  char *path;
+  guint i;
+
+  if (!user_dirs_root_can_prefetch (job->home_root))
+    return;
+
+  paths = g_ptr_array_new ();
+  for (i = 0; i < user_dirs_table_size (job->config->default_dirs); i++)
+    {
+      default_dir = user_dirs_table_index (job->config->default_dirs, i);
+      user_dir = user_dirs_table_lookup (job->user_dirs, default_dir->name);
+      compat_dir = find_backwards_compat_dir (default_dir);
+
+      if (user_dir != NULL && !force)
+        g_ptr_array_add (paths, user_dir->path);
+      else if (user_dir == NULL && !force && compat_dir != NULL)
+        g_ptr_array_add (paths, compat_dir->path);
+    }
+  user_dirs_stats_count (USER_DIRS_OP_STAT);
+  user_dirs_root_prefetch_types (job->home_root, (const char * const *) paths->pdata,
+                                 paths->len);
+
+  if (!for_dummy_file && !arg_move)
+    {
+      g_ptr_array_set_size (paths, 0);
+      for (i = 0; i < user_dirs_table_size (job->config->default_dirs); i++)
         {
-          g_free (path_name);
-          path_name = NULL;
+          default_dir = user_dirs_table_index (job->config->default_dirs, i);
+          if (user_dirs_table_lookup (job->user_dirs, default_dir->name) != NULL)
+            continue;
+
+          path = NULL;
+          if (!force)
+            path = get_backwards_compat_path (job, default_dir);
+          if (path == NULL)
+            path = get_translated_path_name (job, default_dir);
+          g_ptr_array_add (paths, path);
         }
+      user_dirs_stats_count (USER_DIRS_OP_MKDIR);
+      user_dirs_root_prefetch_mkdirs (job->home_root, (const char * const *) paths->pdata,
+                                      paths->len, 0755);
     }
 
-  if (relative_path_name_out != NULL)
-    *relative_path_name_out = relative_path_name;
-  else
-    g_free (relative_path_name);
+  g_ptr_array_free (paths, TRUE);
+}
 
-  return path_name;
+static void
+move_progress (UserDirsMove *move, gboolean done, gpointer user_data)
+{
+  Job *job = user_data;
+  double mib, total_mib, seconds, rate;
+
+  mib = move->bytes / (1024.0 * 1024.0);
+  total_mib = move->total_bytes / (1024.0 * 1024.0);
+  seconds = move->elapsed / (double) G_USEC_PER_SEC;
+  rate = seconds > 0 ? mib / seconds : 0;
+
+  if (done)
+    job_message (job, stdout, "Copied %" G_GUINT64_FORMAT " files, %.1f MiB in %.1f s (%.1f MiB/s)\n",
+                 move->n_files, mib, seconds, rate);
+  else
+    job_message (job, stdout, "Copying %" G_GUINT64_FORMAT " of %" G_GUINT64_FORMAT " files, "
+                 "%.1f of %.1f MiB (%.1f MiB/s)\n",
+                 move->n_files, move->total_files, mib, total_mib, rate);
 }
 
-static char *
-get_translated_path_name (Directory *default_dir,
-                          char **relative_path_name_out)
+static void
+move_warning (UserDirsMove *move, const char *message, gpointer user_data)
 {
-  char *path_name, *relative_path_name, *translated_name;
+  job_message (user_data, stderr, "%s\n", message);
+}
 
-  translated_name = localize_path_name (default_dir->path);
-  relative_path_name = filename_from_utf8 (translated_name);
+/* Directories on another file system, such as a separately mounted
+ * Music volume, are copied, and the original is only removed once
+ * the copy is complete. Failures are reported, the original is never
+ * given up silently.
+ */
+static int
+move_user_dir (Job *job, const char *old_path, const char *new_path)
+{
+  UserDirsMove move = { move_progress, move_warning, job, };
+  int res, saved_errno;
 
-  if (relative_path_name == NULL)
-    relative_path_name = g_strdup (translated_name);
-  g_free (translated_name);
+  /* A directory set to $HOME itself stays where it is */
+  if (*old_path == 0)
+    {
+      errno = EBUSY;
+      return -1;
+    }
 
-  path_name = make_path_absolute (relative_path_name);
+  res = user_dirs_root_move (job->home_root, &move, old_path, new_path);
+  if (res == 0)
+    return 0;
 
-  if (relative_path_name_out != NULL)
-    *relative_path_name_out = relative_path_name;
+  saved_errno = errno;
+  if (saved_errno == ENOTEMPTY || saved_errno == EEXIST)
+    job_message (job, stderr, "Not moving %s to %s, which isn't empty\n",
+                 old_path, new_path);
   else
-    g_free (relative_path_name);
+    job_message (job, stderr, "Can't move %s to %s: %s\n",
+                 old_path, new_path, g_strerror (saved_errno));
 
-  return path_name;
+  errno = saved_errno;
+  return -1;
 }
 
+/* Records what create_default_dirs() would do to the directories for
+ * default_dir, failing where it would. Whether the old directory is
+ * there to be moved is checked now, and again by --apply.
+ */
 static int
-default_dirs_compare (gconstpointer a,
-                      gconstpointer b)
+plan_default_dir (Job *job, Directory *default_dir,
+                  const char *old_path, const char *new_path)
 {
-  Directory *dir_a = (Directory *) a;
-  Directory *dir_b = (Directory *) b;
+  gboolean move = FALSE;
 
-  /* The second directory is first's parent,
-   * so sort it before.
-   */
-  if (g_str_has_prefix (dir_a->path, dir_b->path))
-    return 1;
+  if (arg_move && old_path != NULL)
+    {
+      user_dirs_stats_count (USER_DIRS_OP_STAT);
+      move = user_dirs_root_exists (job->home_root, old_path);
+    }
 
-  /* The first directory is second's parent,
-   * so sort it before.
-   */
-  if (g_str_has_prefix (dir_b->path, dir_a->path))
-    return -1;
+  /* See move_user_dir() */
+  if (move && *old_path == 0)
+    {
+      errno = EBUSY;
+      return -1;
+    }
+
+  user_dirs_plan_add (job->plan, USER_DIRS_PLAN_DIR, default_dir->name, NULL, NULL);
+  user_dirs_plan_add (job->plan, USER_DIRS_PLAN_MKDIR, NULL, new_path, NULL);
+  if (move)
+    user_dirs_plan_add (job->plan, USER_DIRS_PLAN_MOVE, NULL, old_path, new_path);
+  return 0;
+}
 
-  return g_utf8_collate (dir_a->path, dir_b->path);
+/* Indexes the user dirs by path, so that a move only needs to look at
+ * the directories under the moved one. Once created, the index has to
+ * be kept up to date with the paths.
+ */
+static UserDirsTrie *
+index_user_dir_paths (Job *job)
+{
+  UserDirsTrie *paths;
+  Directory *dir;
+  guint i;
+
+  paths = user_dirs_trie_new ();
+  for (i = 0; i < user_dirs_table_size (job->user_dirs); i++)
+    {
+      dir = user_dirs_table_index (job->user_dirs, i);
+      user_dirs_trie_insert (paths, dir->path, dir);
+    }
+
+  return paths;
+}
+
+typedef struct {
+  Job *job;
+  UserDirsTrie *paths;
+  const char *new_path;
+} Rewrite;
+
+static void
+rewrite_user_dir (gpointer value, const char *rest, gpointer user_data)
+{
+  Rewrite *rewrite = user_data;
+  Directory *dir = value;
+
+  dir->path = user_dirs_arena_build_filename (rewrite->job->arena,
+                                              rewrite->new_path, rest, NULL);
+  user_dirs_trie_insert (rewrite->paths, dir->path, dir);
+  if (rewrite->job->plan != NULL)
+    user_dirs_plan_add (rewrite->job->plan, USER_DIRS_PLAN_SET, dir->name, dir->path, NULL);
 }
 
 static gboolean
-create_default_dirs (gboolean force, gboolean for_dummy_file)
+create_default_dirs (Job *job, gboolean force, gboolean for_dummy_file)
 {
-  GList *sorted_dirs, *l;
+  guint i;
   Directory *user_dir, *default_dir;
-  char *old_relative_path_name, *path_name, *relative_path_name;
+  char *old_relative_path_name, *relative_path_name;
   gboolean user_dirs_changed = FALSE;
+  UserDirsTrie *paths = NULL; /* the user dirs by path, once one is moved */
 
-  /* Sort directories so that parent dirs come first than their children.
-   * This makes it easier to move subdirectories - see comment below.
-   */
-  sorted_dirs = g_list_sort (default_dirs, default_dirs_compare);
+  user_dirs_stats_begin (USER_DIRS_PHASE_PREFETCH);
+  prefetch_default_dirs (job, force, for_dummy_file);
+  user_dirs_stats_end (USER_DIRS_PHASE_PREFETCH);
 
-  for (l = sorted_dirs; l != NULL; l = l->next)
+  /* The default dirs are sorted so that parent dirs come first than
+   * their children. This makes it easier to move subdirectories - see
+   * comment below.
+   */
+  for (i = 0; i < user_dirs_table_size (job->config->default_dirs); i++)
     {
-      default_dir = l->data;
-      user_dir = find_dir (user_dirs, default_dir->name);
+      default_dir = user_dirs_table_index (job->config->default_dirs, i);
+      user_dir = user_dirs_table_lookup (job->user_dirs, default_dir->name);
 
       if (user_dir != NULL && !force)
         {
@@ -929,12 +1236,27 @@ create_default_dirs (gboolean force, gboolean for_dummy_file)
            * don't re-create it, but make sure to validate its
            * path first.
            */
-          user_dirs_changed |= !validate_user_dir_path (user_dir);
+          user_dirs_stats_begin (USER_DIRS_PHASE_VALIDATE);
+          old_relative_path_name = user_dir->path;
+          if (!validate_user_dir_path (job, user_dir))
+            {
+              user_dirs_changed = TRUE;
+              if (job->plan != NULL)
+                {
+                  user_dirs_plan_add (job->plan, USER_DIRS_PLAN_DIR, user_dir->name, NULL, NULL);
+                  user_dirs_plan_add (job->plan, USER_DIRS_PLAN_SET, user_dir->name, user_dir->path, NULL);
+                }
+              if (paths != NULL)
+                {
+                  user_dirs_trie_remove (paths, old_relative_path_name, user_dir);
+                  user_dirs_trie_insert (paths, user_dir->path, user_dir);
+                }
+            }
+          user_dirs_stats_end (USER_DIRS_PHASE_VALIDATE);
           continue;
         }
 
       old_relative_path_name = NULL;
-      path_name = NULL;
       relative_path_name = NULL;
 
       if (user_dir == NULL && !force)
@@ -942,104 +1264,94 @@ create_default_dirs (gboolean force, gboolean for_dummy_file)
           /* New default dir. Check if its an old named dir. We want to
            * reuse that if it exists.
            */
-          path_name = get_backwards_compat_path (default_dir, &relative_path_name);
+          relative_path_name = get_backwards_compat_path (job, default_dir);
         }
 
-      if (path_name == NULL)
+      if (relative_path_name == NULL)
         {
           /* Get the default translated path name for this dir */
-          path_name = get_translated_path_name (default_dir, &relative_path_name);
+          relative_path_name = get_translated_path_name (job, default_dir);
         }
 
+      /* Stays valid when user_dir->path changes, the arena keeps it */
       if (user_dir != NULL)
-        old_relative_path_name = g_strdup (user_dir->path);
+        old_relative_path_name = user_dir->path;
 
       if (g_strcmp0 (relative_path_name, old_relative_path_name) != 0)
         {
           gint res = 0;
 
+          if (job->plan != NULL)
+            res = plan_default_dir (job, default_dir, old_relative_path_name, relative_path_name);
+
 	  /* Don't touch directories if we're writing a dummy output file */
-          if (!for_dummy_file)
+          else if (!for_dummy_file)
             {
-              res = g_mkdir_with_parents (path_name, 0755);
+              user_dirs_stats_begin (USER_DIRS_PHASE_MKDIR);
+              user_dirs_stats_count (USER_DIRS_OP_MKDIR);
+              res = user_dirs_root_mkdir_with_parents (job->home_root, relative_path_name, 0755);
+              user_dirs_stats_end (USER_DIRS_PHASE_MKDIR);
               if (res >= 0 && arg_move && (old_relative_path_name != NULL))
                 {
-                  char *old_path_name;
-
-                  old_path_name = make_path_absolute (old_relative_path_name);
-                  if (g_file_test (old_path_name, G_FILE_TEST_EXISTS))
+                  user_dirs_stats_begin (USER_DIRS_PHASE_RENAME);
+                  user_dirs_stats_count (USER_DIRS_OP_STAT);
+                  if (user_dirs_root_exists (job->home_root, old_relative_path_name))
                     {
-                      res = g_rename (old_path_name, path_name);
-                      g_free (old_path_name);
+                      user_dirs_stats_count (USER_DIRS_OP_RENAME);
+                      res = move_user_dir (job, old_relative_path_name, relative_path_name);
                     }
+                  user_dirs_stats_end (USER_DIRS_PHASE_RENAME);
                 }
             }
 
           if (res < 0 && errno != EEXIST && errno != ENOTEMPTY)
-            {
-              g_free (old_relative_path_name);
-              g_free (relative_path_name);
-              g_free (path_name);
-              continue;
-            }
+            continue;
 
           user_dirs_changed = TRUE;
           if (user_dir == NULL)
             {
               /* This is a new directory altogether */
-              printf ("Creating new directory %s for %s\n", default_dir->name, relative_path_name);
-              user_dir = directory_new (default_dir->name, relative_path_name);
-              user_dirs = g_list_append (user_dirs, user_dir);
+              job_message (job, stdout, "Creating new directory %s for %s\n",
+                           default_dir->name, relative_path_name);
+              user_dir = directory_new (job->arena, default_dir->name, relative_path_name);
+              user_dirs_table_add (job->user_dirs, user_dir);
+              if (paths != NULL)
+                user_dirs_trie_insert (paths, user_dir->path, user_dir);
+              if (job->plan != NULL)
+                user_dirs_plan_add (job->plan, USER_DIRS_PLAN_SET, user_dir->name, user_dir->path, NULL);
             }
           else
             {
-              GList *m;
-              Directory *dir;
-              const char *p;
-              char *new_full_path;
+              Rewrite rewrite = { job, NULL, relative_path_name };
 
               /* We forced an update; update all the other paths that contain
                * the old path to the one we just renamed to
                */
-              printf ("Moving %s directory from %s to %s\n",
-                      default_dir->name, old_relative_path_name, relative_path_name);
-
-              for (m = user_dirs; m != NULL; m = m->next)
-                {
-                  dir = m->data;
-                  if (!g_str_has_prefix (dir->path, old_relative_path_name))
-                    continue;
+              job_message (job, stdout, "Moving %s directory from %s to %s\n",
+                           default_dir->name, old_relative_path_name, relative_path_name);
 
-                  p = dir->path + strlen (old_relative_path_name);
-                  if (*p != G_DIR_SEPARATOR && *p != '\0')
-                    continue;
-
-                  new_full_path = g_build_filename (relative_path_name, p, NULL);
-                  g_free (dir->path);
-                  dir->path = new_full_path;
-                }
+              if (paths == NULL)
+                paths = index_user_dir_paths (job);
+              rewrite.paths = paths;
+              user_dirs_trie_take (paths, old_relative_path_name, rewrite_user_dir, &rewrite);
             }
         }
-
-      g_free (old_relative_path_name);
-      g_free (relative_path_name);
-      g_free (path_name);
     }
 
-  g_list_free (sorted_dirs);
+  if (paths != NULL)
+    user_dirs_trie_free (paths);
 
   return user_dirs_changed;
 }
 
 static gboolean
-set_one_directory (const char *set_dir, const char *set_value)
+set_one_directory (Job *job, const char *set_dir, const char *set_value)
 {
-  Directory *dir;
   char *path;
   const gchar *home;
   /* Set a key */
 
-  home = g_get_home_dir ();
+  home = job->home_dir;
 
   path = (char *) set_value;
   if (g_str_has_prefix (path, home))
@@ -1049,136 +1361,1542 @@ set_one_directory (const char *set_dir, const char *set_value)
         path++;
     }
 
-  dir = find_dir (user_dirs, set_dir);
-  if (dir != NULL)
+  user_dirs_table_set (job->user_dirs, set_dir, path);
+
+  return save_user_dirs (job, arg_dummy_file);
+}
+
+static gboolean
+update_user_dirs (Job *job)
+{
+  gboolean was_empty, user_dirs_changed, saved;
+
+  was_empty = (user_dirs_table_size (job->user_dirs) == 0);
+  user_dirs_stats_begin (USER_DIRS_PHASE_CREATE_DEFAULT_DIRS);
+  user_dirs_changed = create_default_dirs (job, arg_force,
+                                           arg_dummy_file != NULL || job->plan != NULL);
+  user_dirs_stats_end (USER_DIRS_PHASE_CREATE_DEFAULT_DIRS);
+
+  if (job->plan != NULL)
     {
-      g_free (dir->path);
-      dir->path = g_strdup (path);
+      if (user_dirs_changed && (arg_force || was_empty))
+        job->plan->locale = get_locale_to_save (job);
+      return TRUE;
     }
-  else
-    {
-      Directory *new_dir;
 
-      new_dir = directory_new (set_dir, path);
-      user_dirs = g_list_append (user_dirs, new_dir);
+  if (user_dirs_changed)
+    {
+      user_dirs_stats_begin (USER_DIRS_PHASE_SAVE_USER_DIRS);
+      saved = save_user_dirs (job, arg_dummy_file);
+      user_dirs_stats_end (USER_DIRS_PHASE_SAVE_USER_DIRS);
+      if (!saved)
+        return FALSE;
+	  
+      if ((arg_force || was_empty) && arg_dummy_file == NULL)
+        {
+          user_dirs_stats_begin (USER_DIRS_PHASE_SAVE_LOCALE);
+          save_locale (job, get_locale_to_save (job));
+          user_dirs_stats_end (USER_DIRS_PHASE_SAVE_LOCALE);
+        }
     }
 
-  return save_user_dirs (arg_dummy_file);
+  return TRUE;
 }
 
-static void
-parse_argv (int argc, char *argv[])
+/* Carries out a plan made by --plan, if it is for this home and
+ * user-dirs.dirs hasn't changed since. As in create_default_dirs(),
+ * if creating or moving a directory fails, it keeps its old path.
+ */
+static gboolean
+apply_plan (Job *job, const char *plan_file)
 {
-  int i;
+  UserDirsPlan *plan;
+  UserDirsPlanStep *step;
+  GError *error = NULL;
+  char *digest;
+  gboolean skip = FALSE, changed = FALSE, res = FALSE;
+  int step_res;
+  guint i;
+
+  plan = user_dirs_plan_load (plan_file, &error);
+  if (plan == NULL)
+    {
+      job_message (job, stderr, "Can't load plan: %s\n", error->message);
+      g_error_free (error);
+      return FALSE;
+    }
 
-  for (i = 1; i < argc; i++)
+  if (strcmp (plan->home, job->home_dir) != 0)
     {
-      if (strcmp (argv[i], "--help") == 0)
+      job_message (job, stderr, "%s is a plan for %s, not %s\n",
+                   plan_file, plan->home, job->home_dir);
+      goto out;
+    }
+
+  user_dirs_stats_count (USER_DIRS_OP_OPEN);
+  digest = user_dirs_plan_digest (get_user_config_file (job, "user-dirs.dirs"));
+  if (strcmp (digest, plan->config_digest) != 0)
+    {
+      job_message (job, stderr, "user-dirs.dirs changed since %s was made\n", plan_file);
+      g_free (digest);
+      goto out;
+    }
+  g_free (digest);
+
+  for (i = 0; i < plan->steps->len; i++)
+    {
+      step = &g_array_index (plan->steps, UserDirsPlanStep, i);
+      if (step->action == USER_DIRS_PLAN_DIR)
         {
-          printf ("Usage: xdg-user-dirs-update [--force] [--move] [--dummy-output <path>] [--set DIR path]\n");
-          exit (0);
+          skip = FALSE;
+          continue;
         }
-      else if (strcmp (argv[i], "--force") == 0)
-        arg_force = TRUE;
-      else if (strcmp (argv[i], "--move") == 0)
-        arg_move = TRUE;
-      else if (strcmp (argv[i], "--dummy-output") == 0 && i + 1 < argc)
-        arg_dummy_file = argv[++i];
-      else if (strcmp (argv[i], "--set") == 0 && i + 2 < argc)
-        {
-          arg_set_dir = argv[++i];
-          arg_set_value = argv[++i];
+      if (skip)
+        continue;
 
-          if (!g_path_is_absolute (arg_set_value))
+      switch (step->action)
+        {
+        case USER_DIRS_PLAN_MKDIR:
+          user_dirs_stats_count (USER_DIRS_OP_MKDIR);
+          step_res = user_dirs_root_mkdir_with_parents (job->home_root, step->path, 0755);
+          if (step_res < 0 && errno != EEXIST)
             {
-              printf ("directory value must be absolute path (was %s)\n", arg_set_value);
-              exit (1);
+              job_message (job, stderr, "Can't create %s: %s\n",
+                           step->path, g_strerror (errno));
+              skip = TRUE;
             }
+          break;
+        case USER_DIRS_PLAN_MOVE:
+          user_dirs_stats_count (USER_DIRS_OP_STAT);
+          if (!user_dirs_root_exists (job->home_root, step->path))
+            break;
+          user_dirs_stats_count (USER_DIRS_OP_RENAME);
+          step_res = move_user_dir (job, step->path, step->new_path);
+          if (step_res < 0 && errno != EEXIST && errno != ENOTEMPTY)
+            skip = TRUE;
+          break;
+        case USER_DIRS_PLAN_SET:
+          user_dirs_table_set (job->user_dirs, step->name, step->path);
+          changed = TRUE;
+          break;
+        default:
+          break;
         }
-      else
+    }
+
+  res = TRUE;
+  if (changed)
+    {
+      user_dirs_stats_begin (USER_DIRS_PHASE_SAVE_USER_DIRS);
+      res = save_user_dirs (job, NULL);
+      user_dirs_stats_end (USER_DIRS_PHASE_SAVE_USER_DIRS);
+      if (res && plan->locale != NULL)
         {
-          printf ("Invalid argument %s\n", argv[i]);
-          exit (1);
+          user_dirs_stats_begin (USER_DIRS_PHASE_SAVE_LOCALE);
+          save_locale (job, plan->locale);
+          user_dirs_stats_end (USER_DIRS_PHASE_SAVE_LOCALE);
         }
     }
+
+ out:
+  user_dirs_plan_free (plan);
+  return res;
+}
+
+static gboolean
+save_plan (Job *job)
+{
+  GError *error = NULL;
+
+  if (!user_dirs_plan_save (job->plan, arg_plan_file, &error))
+    {
+      job_message (job, stderr, "Can't save plan: %s\n", error->message);
+      g_error_free (error);
+      return FALSE;
+    }
+
+  return TRUE;
 }
 
+/* Publishes the binary snapshot of user-dirs.dirs for readers in
+ * this session; a no-op if it is already current.
+ */
 static void
-init_locale (void)
+save_snapshot (Job *job)
 {
-  char *locale_dir = NULL;
+  GPtrArray *types, *paths;
+  Directory *user_dir;
+  char *user_config_file;
+  guint i;
 
-  setlocale (LC_ALL, "");
-  
-  if (g_file_test (LOCALEDIR, G_FILE_TEST_IS_DIR))
+  /* Without knowing which version of the file the directories came
+   * from, a snapshot could serve them for another one
+   */
+  if (!job->user_dirs_stat_valid)
+    return;
+
+  types = g_ptr_array_new ();
+  paths = g_ptr_array_new ();
+  for (i = 0; i < user_dirs_table_size (job->user_dirs); i++)
     {
-      locale_dir = g_strdup (LOCALEDIR);
+      user_dir = user_dirs_table_index (job->user_dirs, i);
+      g_ptr_array_add (types, user_dir->name);
+      g_ptr_array_add (paths, make_path_absolute (job, user_dir->path));
     }
-  else
+
+  user_config_file = get_user_config_file (job, "user-dirs.dirs");
+  user_dirs_stats_begin (USER_DIRS_PHASE_SAVE_SNAPSHOT);
+  user_dirs_snapshot_save (user_config_file, &job->user_dirs_stat,
+                           job->home_dir, types, paths);
+  user_dirs_stats_end (USER_DIRS_PHASE_SAVE_SNAPSHOT);
+
+  g_ptr_array_free (types, TRUE);
+  g_ptr_array_free (paths, TRUE);
+}
+
+/* The directories create_default_dirs() validates on each run. The
+ * strings belong to the job's arena.
+ */
+static GPtrArray *
+get_validated_dir_paths (Job *job)
+{
+  GPtrArray *paths;
+  Directory *default_dir, *user_dir;
+  guint i;
+
+  paths = g_ptr_array_new ();
+  for (i = 0; i < user_dirs_table_size (job->config->default_dirs); i++)
     {
-      /* In case LOCALEDIR does not exist, e.g. xdg-user-dirs is installed in
-       * a different location than the one determined at compile time, look
-       * through the XDG_DATA_DIRS environment variable for alternate locations
-       * of the locale files */
-      const char * const * data_paths;
-      int i;
+      default_dir = user_dirs_table_index (job->config->default_dirs, i);
+      user_dir = user_dirs_table_lookup (job->user_dirs, default_dir->name);
+      if (user_dir != NULL)
+        g_ptr_array_add (paths, make_path_absolute (job, user_dir->path));
+    }
 
-      data_paths = g_get_system_data_dirs ();
-      for (i = 0; data_paths[i] != NULL; i++)
-        {
-          char *dir = NULL;
-          dir = g_build_filename (data_paths[i], "locale", NULL);
-          if (g_file_test (dir, G_FILE_TEST_IS_DIR))
-            {
-              locale_dir = dir;
-              break;
-            }
+  return paths;
+}
 
-          g_free (dir);
-        }
+static void
+job_clear (Job *job)
+{
+  user_dirs_table_free (job->user_dirs);
+  user_dirs_root_free (job->home_root);
+  user_dirs_root_free (job->config_root);
+  if (job->filename_converter != (iconv_t)(-1))
+    iconv_close (job->filename_converter);
+  if (job->private_config)
+    config_free (job->private_config);
+  g_strfreev (job->languages);
+  user_dirs_arena_free (job->arena);
+}
+
+static void
+job_free (Job *job)
+{
+  job_clear (job);
+  g_free (job);
+}
+
+/* Moves what the job still needs to a new arena and releases the old
+ * one, with all the temporary strings that accumulated in it. Used by
+ * long running processes.
+ */
+static void
+job_renew_arena (Job *job, gboolean keep_user_dirs)
+{
+  UserDirsArena *old_arena;
+  UserDirsTable *old_user_dirs;
+  Directory *dir;
+  guint i;
+
+  old_arena = job->arena;
+  old_user_dirs = job->user_dirs;
+
+  job->arena = user_dirs_arena_new ();
+  job->home_dir = user_dirs_arena_strdup (job->arena, job->home_dir);
+  job->config_home = user_dirs_arena_strdup (job->arena, job->config_home);
+  if (job->label != NULL)
+    job->label = job->home_dir;
+
+  job->user_dirs = user_dirs_table_new (job->arena);
+  for (i = 0; keep_user_dirs && i < user_dirs_table_size (old_user_dirs); i++)
+    {
+      dir = user_dirs_table_index (old_user_dirs, i);
+      user_dirs_table_add (job->user_dirs,
+                           directory_new (job->arena, dir->name, dir->path));
     }
 
-  bindtextdomain (GETTEXT_PACKAGE, locale_dir);
-  g_free (locale_dir);
+  job->locale_name = user_dirs_arena_strdup (job->arena, job->locale_name);
 
-  bind_textdomain_codeset (GETTEXT_PACKAGE, "UTF-8");
-  textdomain (GETTEXT_PACKAGE);
+  user_dirs_table_free (old_user_dirs);
+  user_dirs_arena_free (old_arena);
 }
 
-int
-main (int argc, char *argv[])
+static void
+add_locale_variants (GPtrArray *names, const char *locale_name)
 {
-  gboolean was_empty, user_dirs_changed;
-  
-  init_locale ();
-  parse_argv (argc, argv);
+  char **variants;
+  guint i;
 
-  if (!load_all_configs ())
-    return 1;
+  variants = g_get_locale_variants (locale_name);
+  for (i = 0; variants[i] != NULL; i++)
+    g_ptr_array_add (names, variants[i]);
+  g_free (variants);
+}
 
-  load_user_dirs ();
+/* The locales to pick names from .desktop files by, like
+ * g_get_language_names() but for the given locale, and in the order
+ * user_dirs_locale_init() searches the translations.
+ */
+static char **
+get_language_names (const char *language, const char *locale_name)
+{
+  GPtrArray *names;
+  char **locales;
+  guint i;
 
-  if (arg_set_dir != NULL)
-    return !set_one_directory (arg_set_dir, arg_set_value);
+  names = g_ptr_array_new ();
 
-  /* default: update */
-  if (!conf_enabled)
-    return 0;
+  /* Nothing is translated in the C locale */
+  if (locale_name != NULL &&
+      strcmp (locale_name, "C") != 0 &&
+      strcmp (locale_name, "POSIX") != 0 &&
+      strncmp (locale_name, "C.", 2) != 0)
+    {
+      if (language != NULL && *language != 0)
+        {
+          locales = g_strsplit (language, ":", -1);
+          for (i = 0; locales[i] != NULL; i++)
+            if (*locales[i] != 0)
+              add_locale_variants (names, locales[i]);
+          g_strfreev (locales);
+        }
+      else
+        add_locale_variants (names, locale_name);
+    }
+  g_ptr_array_add (names, NULL);
 
-  if (!load_default_dirs ())
-    return 1;
-      
-  was_empty = (user_dirs == NULL);
-  user_dirs_changed = create_default_dirs (arg_force, (arg_dummy_file != NULL));
+  return (char **) g_ptr_array_free (names, FALSE);
+}
 
-  if (user_dirs_changed)
+/* The locale new directories get named in. language is a list of
+ * locales like $LANGUAGE, or NULL.
+ */
+static void
+job_set_locale (Job *job, const char *language, const char *locale_name)
+{
+  job->locale_name = user_dirs_arena_strdup (job->arena, locale_name);
+  user_dirs_locale_init (&job->locale, language, locale_name);
+  g_strfreev (job->languages);
+  job->languages = get_language_names (language, locale_name);
+}
+
+/* Other users' locale is not known. Use the one their directories were
+ * created in, if recorded.
+ */
+static void
+job_load_locale (Job *job)
+{
+  char *contents;
+  gsize len;
+
+  contents = user_dirs_root_read_file (job->config_root, "user-dirs.locale",
+                                       &len, NULL);
+  if (contents == NULL)
+    return;
+
+  g_strstrip (contents);
+  if (*contents != 0)
+    job_set_locale (job, NULL, contents);
+  g_free (contents);
+}
+
+/* An entry is either an absolute home directory, which is updated on
+ * behalf of its owner, or a user name.
+ */
+static Job *
+batch_job_new (Config *config, const char *entry)
+{
+  Job *job;
+  struct stat statbuf;
+  struct passwd pwd, *result;
+  char buffer[4096];
+
+  job = g_new0 (Job, 1);
+  job->arena = user_dirs_arena_new ();
+  job->config = config;
+  job->filename_converter = (iconv_t)(-1);
+
+  if (g_path_is_absolute (entry))
     {
-      if (!save_user_dirs (arg_dummy_file))
-        return 1;
-	  
-      if ((arg_force || was_empty) && arg_dummy_file == NULL)
-        save_locale ();
+      if (stat (entry, &statbuf) != 0 || !S_ISDIR (statbuf.st_mode))
+        {
+          g_printerr ("%s: Not a home directory\n", entry);
+          user_dirs_arena_free (job->arena);
+          g_free (job);
+          return NULL;
+        }
+      job->home_dir = user_dirs_arena_strdup (job->arena, entry);
+      job->uid = statbuf.st_uid;
+      job->gid = statbuf.st_gid;
+    }
+  else
+    {
+      if (getpwnam_r (entry, &pwd, buffer, sizeof (buffer), &result) != 0 ||
+          result == NULL)
+        {
+          g_printerr ("%s: No such user\n", entry);
+          user_dirs_arena_free (job->arena);
+          g_free (job);
+          return NULL;
+        }
+      job->home_dir = user_dirs_arena_strdup (job->arena, pwd.pw_dir);
+      job->uid = pwd.pw_uid;
+      job->gid = pwd.pw_gid;
     }
 
-  return 0;
+  /* Other users' XDG_CONFIG_HOME is not known, use the default */
+  job->config_home = user_dirs_arena_build_filename (job->arena, job->home_dir,
+                                                     ".config", NULL);
+  job->home_root = user_dirs_root_new (job->home_dir);
+  job->config_root = user_dirs_root_new (job->config_home);
+  job->label = job->home_dir;
+  job->switch_user = (geteuid () == 0 && job->uid != 0);
+  job->user_dirs = user_dirs_table_new (job->arena);
+  job_set_locale (job, g_getenv ("LANGUAGE"), setlocale (LC_MESSAGES, NULL));
+
+  return job;
+}
+
+/* Homes with their own user-dirs.conf or user-dirs.defaults can't use
+ * the shared system configuration.
+ */
+static gboolean
+job_load_private_config (Job *job)
+{
+  gboolean has_private;
+
+  has_private = user_dirs_root_is_regular (job->config_root, "user-dirs.conf") ||
+                user_dirs_root_is_regular (job->config_root, "user-dirs.defaults");
+
+  if (!has_private)
+    return TRUE;
+
+  job->private_config = config_new ();
+  job->config = job->private_config;
+  load_all_configs (job->config, job->config_home);
+  if (!job->config->enabled)
+    return TRUE;
+
+  return load_default_dirs (job->config, job->config_home);
+}
+
+static gboolean
+batch_job_update (Job *job)
+{
+  gboolean res;
+
+  res = job_load_private_config (job) &&
+        open_filename_converter (job);
+  if (res && job->config->enabled)
+    {
+      job_load_locale (job);
+      load_user_dirs (job);
+      res = update_user_dirs (job);
+    }
+
+  return res;
+}
+
+/* Runs in a worker thread, when all homes are updated as ourselves */
+static void
+batch_job_run (gpointer data, gpointer user_data)
+{
+  Job *job = data;
+
+  if (!batch_job_update (job))
+    g_atomic_int_inc (&batch_failures);
+
+  job_free (job);
+}
+
+/* Becomes the owner of the home for good, with their supplementary
+ * groups instead of root's, so that nothing in the home is done with
+ * more rights than they have themselves.
+ */
+static gboolean
+job_become_user (Job *job)
+{
+  struct passwd pwd, *result;
+  char buffer[4096];
+  int res;
+
+  if (getpwuid_r (job->uid, &pwd, buffer, sizeof (buffer), &result) == 0 &&
+      result != NULL)
+    res = initgroups (pwd.pw_name, job->gid);
+  else
+    res = setgroups (1, &job->gid);
+
+  /* Getting root back must be impossible */
+  if (res != 0 || setgid (job->gid) != 0 || setuid (job->uid) != 0 ||
+      setuid (0) == 0)
+    {
+      job_message (job, stderr, "Can't switch to uid %d\n", (int) job->uid);
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+/* Updates the home in a child process, which can switch users without
+ * affecting the other jobs. Only called from the main thread, while no
+ * other threads are running.
+ */
+static gboolean
+batch_job_fork (Job *job)
+{
+  gboolean res;
+  pid_t pid;
+
+  fflush (stdout);
+  fflush (stderr);
+  pid = fork ();
+  if (pid < 0)
+    {
+      job_message (job, stderr, "Can't start a process: %s\n", g_strerror (errno));
+      job_free (job);
+      return FALSE;
+    }
+
+  if (pid == 0)
+    {
+      res = (!job->switch_user || job_become_user (job)) &&
+            batch_job_update (job);
+      fflush (stdout);
+      fflush (stderr);
+      _exit (res ? 0 : 1);
+    }
+
+  job_free (job);
+  return TRUE;
+}
+
+/* Waits for one of the children started by batch_job_fork() */
+static void
+batch_wait_child (void)
+{
+  int status;
+
+  while (waitpid (-1, &status, 0) < 0)
+    {
+      if (errno != EINTR)
+        return;
+    }
+
+  if (!WIFEXITED (status) || WEXITSTATUS (status) != 0)
+    g_atomic_int_inc (&batch_failures);
+}
+
+static void
+add_batch_entries_from_file (const char *filename)
+{
+  char *buffer;
+  char **lines;
+  char *p;
+  int idx;
+
+  if (strcmp (filename, "-") == 0)
+    filename = "/dev/stdin";
+
+  if (!g_file_get_contents (filename, &buffer, NULL, NULL))
+    {
+      g_printerr ("Can't read %s\n", filename);
+      exit (1);
+    }
+
+  lines = g_strsplit (buffer, "\n", -1);
+  g_free (buffer);
+
+  for (idx = 0; lines[idx] != NULL; idx++)
+    {
+      p = g_strstrip (lines[idx]);
+      if (*p == 0 || *p == '#')
+	continue;
+      g_ptr_array_add (arg_batch_entries, g_strdup (p));
+    }
+
+  g_strfreev (lines);
+}
+
+/* Shown with G_MESSAGES_DEBUG=all, covers the arenas freed so far */
+static void
+log_allocation_stats (void)
+{
+  UserDirsArenaStats stats;
+  struct rusage usage;
+
+  user_dirs_arena_get_stats (&stats);
+  if (getrusage (RUSAGE_SELF, &usage) != 0)
+    usage.ru_maxrss = 0;
+
+  g_debug ("%" G_GUINT64_FORMAT " allocations from %" G_GUINT64_FORMAT
+           " arena blocks of %" G_GUINT64_FORMAT " bytes in total, largest"
+           " arena %" G_GUINT64_FORMAT " bytes; peak RSS %ld KiB",
+           stats.allocations, stats.blocks, stats.block_bytes,
+           stats.peak_bytes, usage.ru_maxrss);
+}
+
+static int
+run_batch (void)
+{
+  Config *config;
+  GThreadPool *pool;
+  Job *job;
+  guint i;
+  int max_threads, running, failures;
+
+  if (arg_batch_file)
+    add_batch_entries_from_file (arg_batch_file);
+
+  /* The system configuration and defaults are only parsed once */
+  config = config_new ();
+  load_all_configs (config, NULL);
+  if (config->enabled && !load_default_dirs (config, NULL))
+    return 1;
+
+  max_threads = arg_jobs > 0 ? arg_jobs : (int) g_get_num_processors ();
+
+  /* Root updates each home in a process of its own, as the owner.
+   * Otherwise all homes are updated as ourselves, on threads.
+   */
+  pool = NULL;
+  if (geteuid () != 0)
+    pool = g_thread_pool_new (batch_job_run, NULL, max_threads, TRUE, NULL);
+
+  running = 0;
+  for (i = 0; i < arg_batch_entries->len; i++)
+    {
+      job = batch_job_new (config, g_ptr_array_index (arg_batch_entries, i));
+      if (job == NULL)
+        {
+          g_atomic_int_inc (&batch_failures);
+          continue;
+        }
+
+      if (pool != NULL)
+        {
+          g_thread_pool_push (pool, job, NULL);
+          continue;
+        }
+
+      if (running == max_threads)
+        {
+          batch_wait_child ();
+          running--;
+        }
+      if (batch_job_fork (job))
+        running++;
+      else
+        g_atomic_int_inc (&batch_failures);
+    }
+
+  /* Wait for all jobs to finish */
+  if (pool != NULL)
+    g_thread_pool_free (pool, FALSE, TRUE);
+  for (; running > 0; running--)
+    batch_wait_child ();
+  config_free (config);
+  log_allocation_stats ();
+
+  failures = g_atomic_int_get (&batch_failures);
+  if (failures > 0)
+    {
+      g_printerr ("Failed to update %d of %u homes\n",
+                  failures, arg_batch_entries->len);
+      return 1;
+    }
+
+  return 0;
+}
+
+static int config_lock_fd = -1;
+
+/* Reads how many login updates finished and the status of the last
+ * one from the lock file
+ */
+static gboolean
+read_lock_result (int fd, guint64 *generation, int *status)
+{
+  char buffer[64];
+  ssize_t len;
+
+  len = pread (fd, buffer, sizeof (buffer) - 1, 0);
+  if (len <= 0)
+    return FALSE;
+  buffer[len] = 0;
+
+  return sscanf (buffer, "%" G_GUINT64_FORMAT " %d", generation, status) == 2;
+}
+
+/* Takes user-dirs.lock in config_home, so that concurrent runs for the
+ * same user, e.g. when several sessions start at once, don't all do
+ * the same work and race to replace user-dirs.dirs. If another run
+ * holds the lock this waits for it. A login update that waited for
+ * another login update which changed something doesn't run again:
+ * this returns FALSE and its status instead.
+ *
+ * Without the lock, e.g. on a read-only home, the run goes ahead
+ * anyway.
+ */
+static gboolean
+lock_config (const char *config_home, gboolean coalesce, int *status)
+{
+  guint64 generation_before = 0, generation;
+  char *lock_file;
+  int fd;
+
+  lock_file = g_build_filename (config_home, "user-dirs.lock", NULL);
+  user_dirs_stats_count (USER_DIRS_OP_OPEN);
+  fd = open (lock_file, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if (fd < 0 && errno == ENOENT)
+    {
+      user_dirs_stats_count (USER_DIRS_OP_MKDIR);
+      g_mkdir_with_parents (config_home, 0700);
+      user_dirs_stats_count (USER_DIRS_OP_OPEN);
+      fd = open (lock_file, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    }
+  g_free (lock_file);
+  if (fd < 0)
+    return TRUE;
+
+  if (flock (fd, LOCK_EX | LOCK_NB) == 0)
+    {
+      config_lock_fd = fd;
+      return TRUE;
+    }
+
+  read_lock_result (fd, &generation_before, status);
+
+  user_dirs_stats_begin (USER_DIRS_PHASE_WAIT_FOR_LOCK);
+  while (flock (fd, LOCK_EX) < 0)
+    if (errno != EINTR)
+      {
+        user_dirs_stats_end (USER_DIRS_PHASE_WAIT_FOR_LOCK);
+        close (fd);
+        return TRUE;
+      }
+  user_dirs_stats_end (USER_DIRS_PHASE_WAIT_FOR_LOCK);
+
+  config_lock_fd = fd;
+  if (coalesce &&
+      read_lock_result (fd, &generation, status) &&
+      generation != generation_before)
+    {
+      close (fd);
+      config_lock_fd = -1;
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+/* Releases the lock, recording the status for waiting login updates
+ * if record is set
+ */
+static void
+unlock_config (gboolean record, int status)
+{
+  guint64 generation = 0;
+  char buffer[64];
+  int unused, len;
+
+  if (config_lock_fd < 0)
+    return;
+
+  if (record)
+    {
+      read_lock_result (config_lock_fd, &generation, &unused);
+      /* Fixed width, so it always overwrites the whole file */
+      len = g_snprintf (buffer, sizeof (buffer), "%20" G_GUINT64_FORMAT " %11d\n",
+                        generation + 1, status);
+      if (pwrite (config_lock_fd, buffer, len, 0) != len)
+        g_printerr ("Can't record the result in the lock file: %s\n", g_strerror (errno));
+    }
+
+  close (config_lock_fd);
+  config_lock_fd = -1;
+}
+
+#ifdef HAVE_SYS_INOTIFY_H
+
+/* Events are collected until things have been quiet for this long,
+ * but at most for WATCH_MAX_DELAY_MS after the first one.
+ */
+#define WATCH_QUIET_MS 200
+#define WATCH_MAX_DELAY_MS 2000
+
+typedef struct {
+  Job *job;
+  int fd;
+  GHashTable *dir_watches; /* wd => owned dir name */
+  GHashTable *dirty; /* owned dir names to validate */
+  gboolean reload;
+  struct stat saved; /* user-dirs.dirs as we last saw it */
+} Watch;
+
+static void
+watch_remember_user_dirs (Watch *watch)
+{
+  char *user_config_file;
+
+  user_config_file = get_user_config_file (watch->job, "user-dirs.dirs");
+  if (stat (user_config_file, &watch->saved) != 0)
+    memset (&watch->saved, 0, sizeof (watch->saved));
+}
+
+/* Only the directories themselves are watched, not their contents, so
+ * file operations inside them don't wake us up.
+ */
+static void
+watch_add_dirs (Watch *watch)
+{
+  GHashTableIter iter;
+  gpointer wd;
+  Directory *default_dir, *user_dir;
+  char *path;
+  int new_wd;
+  guint i;
+
+  g_hash_table_iter_init (&iter, watch->dir_watches);
+  while (g_hash_table_iter_next (&iter, &wd, NULL))
+    inotify_rm_watch (watch->fd, GPOINTER_TO_INT (wd));
+  g_hash_table_remove_all (watch->dir_watches);
+
+  for (i = 0; i < user_dirs_table_size (watch->job->config->default_dirs); i++)
+    {
+      default_dir = user_dirs_table_index (watch->job->config->default_dirs, i);
+      user_dir = user_dirs_table_lookup (watch->job->user_dirs, default_dir->name);
+      if (user_dir == NULL || *user_dir->path == 0)
+        continue;
+
+      path = make_path_absolute (watch->job, user_dir->path);
+      new_wd = inotify_add_watch (watch->fd, path,
+                                  IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR);
+      if (new_wd >= 0)
+        g_hash_table_replace (watch->dir_watches, GINT_TO_POINTER (new_wd),
+                              g_strdup (user_dir->name));
+      else
+        g_hash_table_add (watch->dirty, g_strdup (user_dir->name));
+    }
+}
+
+/* An entry of the home dir was removed or renamed, check the dirs
+ * that live below it.
+ */
+static void
+watch_home_entry_changed (Watch *watch, const char *name)
+{
+  Directory *user_dir;
+  const char *p;
+  size_t len;
+  guint i;
+
+  len = strlen (name);
+  for (i = 0; i < user_dirs_table_size (watch->job->user_dirs); i++)
+    {
+      user_dir = user_dirs_table_index (watch->job->user_dirs, i);
+      p = user_dir->path;
+      if (strncmp (p, name, len) == 0 && (p[len] == '/' || p[len] == 0))
+        g_hash_table_add (watch->dirty, g_strdup (user_dir->name));
+    }
+}
+
+static void
+watch_config_file_changed (Watch *watch, const char *name)
+{
+  char *user_config_file;
+  struct stat statbuf;
+
+  if (strcmp (name, "user-dirs.dirs") == 0)
+    {
+      /* Ignore our own writes */
+      user_config_file = get_user_config_file (watch->job, "user-dirs.dirs");
+      if (stat (user_config_file, &statbuf) != 0)
+        memset (&statbuf, 0, sizeof (statbuf));
+
+      if (statbuf.st_ino == watch->saved.st_ino &&
+          statbuf.st_dev == watch->saved.st_dev &&
+          statbuf.st_mtim.tv_sec == watch->saved.st_mtim.tv_sec &&
+          statbuf.st_mtim.tv_nsec == watch->saved.st_mtim.tv_nsec)
+        return;
+
+      watch->reload = TRUE;
+    }
+  else if (strcmp (name, "user-dirs.conf") == 0 ||
+           strcmp (name, "user-dirs.defaults") == 0)
+    watch->reload = TRUE;
+}
+
+static void
+watch_read_events (Watch *watch, int home_wd)
+{
+  char buffer[4096]
+    __attribute__ ((aligned (__alignof__ (struct inotify_event))));
+  const struct inotify_event *event;
+  const char *name;
+  ssize_t len;
+  char *p;
+
+  len = read (watch->fd, buffer, sizeof (buffer));
+  if (len <= 0)
+    return;
+
+  for (p = buffer; p < buffer + len; p += sizeof (struct inotify_event) + event->len)
+    {
+      event = (const struct inotify_event *) p;
+
+      if (event->mask & IN_Q_OVERFLOW)
+        {
+          watch->reload = TRUE;
+          continue;
+        }
+
+      name = g_hash_table_lookup (watch->dir_watches, GINT_TO_POINTER (event->wd));
+      if (name != NULL)
+        {
+          if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED))
+            g_hash_table_add (watch->dirty, g_strdup (name));
+          if (event->mask & IN_IGNORED)
+            g_hash_table_remove (watch->dir_watches, GINT_TO_POINTER (event->wd));
+          continue;
+        }
+
+      if (event->len == 0)
+        continue;
+
+      if (event->wd == home_wd)
+        watch_home_entry_changed (watch, event->name);
+      else
+        watch_config_file_changed (watch, event->name);
+    }
+}
+
+static void
+job_reload (Job *job)
+{
+  Config *config;
+
+  config = config_new ();
+  load_all_configs (config, job->config_home);
+  if (config->enabled)
+    load_default_dirs (config, job->config_home);
+
+  config_free (job->config);
+  job->config = config;
+
+  if (job->filename_converter != (iconv_t)(-1))
+    iconv_close (job->filename_converter);
+  job->filename_converter = (iconv_t)(-1);
+  open_filename_converter (job);
+
+  job_renew_arena (job, FALSE);
+  load_user_dirs (job);
+}
+
+static void
+watch_reconcile (Watch *watch)
+{
+  Job *job = watch->job;
+  GHashTableIter iter;
+  gpointer name;
+  Directory *user_dir;
+  UserDirsStamp *stamp;
+  GPtrArray *dir_paths;
+  gboolean user_dirs_changed = FALSE;
+  int unused;
+
+  /* Takes turns with login updates and --set, as all save
+   * user-dirs.dirs
+   */
+  lock_config (job->config_home, FALSE, &unused);
+  stamp = user_dirs_stamp_new (job->config_home);
+
+  /* The directories may have been removed since */
+  user_dirs_root_forget (job->home_root);
+
+  if (watch->reload)
+    {
+      /* Start over, like at login */
+      job_reload (job);
+      if (job->config->enabled)
+        update_user_dirs (job);
+    }
+  else if (job->config->enabled)
+    {
+      /* Starting from what another run may have saved meanwhile */
+      job_renew_arena (job, FALSE);
+      load_user_dirs (job);
+
+      g_hash_table_iter_init (&iter, watch->dirty);
+      while (g_hash_table_iter_next (&iter, &name, NULL))
+        {
+          user_dir = user_dirs_table_lookup (job->user_dirs, name);
+          if (user_dir != NULL && user_dirs_table_lookup (job->config->default_dirs, name) != NULL)
+            user_dirs_changed |= !validate_user_dir_path (job, user_dir);
+        }
+
+      if (user_dirs_changed)
+        save_user_dirs (job, NULL);
+    }
+
+  watch->reload = FALSE;
+  g_hash_table_remove_all (watch->dirty);
+  watch_remember_user_dirs (watch);
+  watch_add_dirs (watch);
+
+  /* Keep the login fast path current */
+  save_snapshot (job);
+  dir_paths = get_validated_dir_paths (job);
+  user_dirs_stamp_save (stamp, dir_paths);
+  g_ptr_array_free (dir_paths, TRUE);
+  user_dirs_stamp_free (stamp);
+  unlock_config (FALSE, 0);
+
+  job_renew_arena (job, TRUE);
+}
+
+static int
+run_watch (Job *job)
+{
+  const char * const *config_paths;
+  struct pollfd pfd;
+  gint64 first_event;
+  Watch watch = { NULL, };
+  int home_wd, i, timeout;
+
+  /* --force and --move only apply to the initial update */
+  arg_force = FALSE;
+  arg_move = FALSE;
+
+  watch.job = job;
+  watch.fd = inotify_init1 (IN_CLOEXEC | IN_NONBLOCK);
+  if (watch.fd == -1)
+    {
+      g_printerr ("Can't watch for changes: %s\n", g_strerror (errno));
+      return 1;
+    }
+
+  watch.dir_watches = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, g_free);
+  watch.dirty = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+  /* The config dir may not exist yet if the update is disabled */
+  user_dirs_root_mkdir_with_parents (job->config_root, "", 0700);
+  inotify_add_watch (watch.fd, job->config_home,
+                     IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE | IN_MOVED_FROM);
+  config_paths = g_get_system_config_dirs ();
+  for (i = 0; config_paths[i] != NULL; i++)
+    inotify_add_watch (watch.fd, config_paths[i],
+                       IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE | IN_MOVED_FROM);
+  home_wd = inotify_add_watch (watch.fd, job->home_dir,
+                               IN_DELETE | IN_MOVED_FROM | IN_ONLYDIR);
+
+  watch_remember_user_dirs (&watch);
+  watch_add_dirs (&watch);
+
+  pfd.fd = watch.fd;
+  pfd.events = POLLIN;
+  first_event = 0;
+
+  for (;;)
+    {
+      if (first_event == 0)
+        timeout = -1;
+      else
+        timeout = MIN (WATCH_QUIET_MS,
+                       MAX (0, WATCH_MAX_DELAY_MS -
+                               (g_get_monotonic_time () - first_event) / 1000));
+
+      if (poll (&pfd, 1, timeout) < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          break;
+        }
+
+      if (pfd.revents & POLLIN)
+        {
+          watch_read_events (&watch, home_wd);
+          if (first_event == 0 &&
+              (watch.reload || g_hash_table_size (watch.dirty) > 0))
+            first_event = g_get_monotonic_time ();
+          if (timeout != 0)
+            continue;
+        }
+
+      if (first_event != 0)
+        {
+          watch_reconcile (&watch);
+          first_event = 0;
+        }
+    }
+
+  close (watch.fd);
+  g_hash_table_destroy (watch.dir_watches);
+  g_hash_table_destroy (watch.dirty);
+  return 1;
+}
+
+#else
+
+static int
+run_watch (Job *job)
+{
+  g_printerr ("Watching for changes is not supported on this system\n");
+  return 1;
+}
+
+#endif
+
+static void
+parse_argv (int argc, char *argv[])
+{
+  int i;
+
+  arg_batch_entries = g_ptr_array_new ();
+
+  for (i = 1; i < argc; i++)
+    {
+      if (strcmp (argv[i], "--help") == 0)
+        {
+          printf ("Usage: xdg-user-dirs-update [--force] [--move] [--no-fastpath] [--watch] [--dummy-output <path>] [--set DIR path]\n"
+                  "                            [--plan <path>] [--apply <path>] [--stats[=json]] [--stats-output <path>]\n"
+                  "       xdg-user-dirs-update --batch [--force] [--move] [--jobs N] [--batch-file FILE] [USER|HOME...]\n"
+                  "       xdg-user-dirs-update --update-desktop-cache\n"
+                  "       xdg-user-dirs-update --env-generator\n");
+          exit (0);
+        }
+      else if (strcmp (argv[i], "--force") == 0)
+        arg_force = TRUE;
+      else if (strcmp (argv[i], "--move") == 0)
+        arg_move = TRUE;
+      else if (strcmp (argv[i], "--no-fastpath") == 0)
+        arg_no_fastpath = TRUE;
+      else if (strcmp (argv[i], "--watch") == 0)
+        arg_watch = TRUE;
+      else if (strcmp (argv[i], "--stats") == 0)
+        arg_stats = TRUE;
+      else if (strcmp (argv[i], "--stats=json") == 0)
+        arg_stats = arg_stats_json = TRUE;
+      else if (strcmp (argv[i], "--stats-output") == 0 && i + 1 < argc)
+        {
+          arg_stats = TRUE;
+          arg_stats_file = argv[++i];
+        }
+      else if (strcmp (argv[i], "--dummy-output") == 0 && i + 1 < argc)
+        arg_dummy_file = argv[++i];
+      else if (strcmp (argv[i], "--plan") == 0 && i + 1 < argc)
+        arg_plan_file = argv[++i];
+      else if (strcmp (argv[i], "--apply") == 0 && i + 1 < argc)
+        arg_apply_file = argv[++i];
+      else if (strcmp (argv[i], "--set") == 0 && i + 2 < argc)
+        {
+          arg_set_dir = argv[++i];
+          arg_set_value = argv[++i];
+
+          if (!g_path_is_absolute (arg_set_value))
+            {
+              printf ("directory value must be absolute path (was %s)\n", arg_set_value);
+              exit (1);
+            }
+        }
+      else if (strcmp (argv[i], "--update-desktop-cache") == 0)
+        arg_update_desktop_cache = TRUE;
+      else if (strcmp (argv[i], "--env-generator") == 0)
+        arg_env_generator = TRUE;
+      else if (strcmp (argv[i], "--batch") == 0)
+        arg_batch = TRUE;
+      else if (strcmp (argv[i], "--batch-file") == 0 && i + 1 < argc)
+        {
+          arg_batch = TRUE;
+          arg_batch_file = argv[++i];
+        }
+      else if (strcmp (argv[i], "--jobs") == 0 && i + 1 < argc)
+        arg_jobs = atoi (argv[++i]);
+      else if (arg_batch && argv[i][0] != '-')
+        g_ptr_array_add (arg_batch_entries, g_strdup (argv[i]));
+      else
+        {
+          printf ("Invalid argument %s\n", argv[i]);
+          exit (1);
+        }
+    }
+
+  if (arg_batch && (arg_set_dir != NULL || arg_dummy_file != NULL))
+    {
+      printf ("--set and --dummy-output can't be used with --batch\n");
+      exit (1);
+    }
+
+  if (arg_watch && (arg_batch || arg_set_dir != NULL || arg_dummy_file != NULL))
+    {
+      printf ("--watch can't be used with --batch, --set or --dummy-output\n");
+      exit (1);
+    }
+
+  if (arg_update_desktop_cache &&
+      (arg_batch || arg_watch || arg_set_dir != NULL || arg_dummy_file != NULL))
+    {
+      printf ("--update-desktop-cache can't be used with --batch, --watch, --set or --dummy-output\n");
+      exit (1);
+    }
+
+  if (arg_env_generator && argc != 2)
+    {
+      printf ("--env-generator can't be used with other arguments\n");
+      exit (1);
+    }
+
+  if ((arg_plan_file != NULL || arg_apply_file != NULL) &&
+      (arg_batch || arg_watch || arg_set_dir != NULL || arg_dummy_file != NULL ||
+       arg_update_desktop_cache))
+    {
+      printf ("--plan and --apply can't be used with --batch, --watch, --set, --dummy-output or --update-desktop-cache\n");
+      exit (1);
+    }
+
+  if (arg_apply_file != NULL && (arg_plan_file != NULL || arg_force || arg_move))
+    {
+      printf ("--apply can't be used with --plan, --force or --move, which are for making the plan\n");
+      exit (1);
+    }
+
+  if (arg_stats && (arg_batch || arg_watch))
+    {
+      printf ("--stats can't be used with --batch or --watch\n");
+      exit (1);
+    }
+}
+
+/* Runs at exit, so that every way out of main() is covered */
+static void
+print_stats (void)
+{
+  FILE *file;
+
+  if (arg_stats_file == NULL)
+    {
+      user_dirs_stats_print (stderr, arg_stats_json);
+      return;
+    }
+
+  file = fopen (arg_stats_file, "w");
+  if (file == NULL)
+    {
+      g_printerr ("Can't write statistics to %s: %s\n", arg_stats_file, g_strerror (errno));
+      return;
+    }
+  user_dirs_stats_print (file, arg_stats_json);
+  fclose (file);
+}
+
+/* Whether this is the plain update run at login */
+static gboolean
+is_login_update (void)
+{
+  return !arg_batch && !arg_watch && !arg_force && !arg_move &&
+    arg_set_dir == NULL && arg_dummy_file == NULL &&
+    arg_plan_file == NULL && arg_apply_file == NULL;
+}
+
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_CLASS_IDLE 3
+#define IOPRIO_WHO_PROCESS 1
+
+/* Lets the update finish in the background if it takes longer than
+ * budget milliseconds, e.g. because of an unresponsive NFS server, so
+ * that it doesn't hold up the login. The update runs in a child with
+ * idle I/O priority; this returns in the child, while the parent
+ * exits with its status once it is done, or with 0 at the deadline.
+ * If the child can't be started the update runs here as usual.
+ */
+static void
+start_deadline (guint budget)
+{
+  struct pollfd pfd;
+  gint64 end, now;
+  int fds[2], status, res;
+  pid_t pid;
+
+  if (pipe2 (fds, O_CLOEXEC) != 0)
+    return;
+
+  fflush (NULL);
+  pid = fork ();
+  if (pid < 0)
+    {
+      close (fds[0]);
+      close (fds[1]);
+      return;
+    }
+
+  if (pid == 0)
+    {
+      /* The write end is never written, the parent waits for it to be
+       * closed when this exits
+       */
+      close (fds[0]);
+      setsid ();
+#ifdef SYS_ioprio_set
+      syscall (SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0,
+               IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT);
+#endif
+      user_dirs_stats_set_deadline (budget);
+      return;
+    }
+
+  close (fds[1]);
+  pfd.fd = fds[0];
+  pfd.events = POLLIN;
+  end = g_get_monotonic_time () + (gint64) budget * 1000;
+  do
+    {
+      now = g_get_monotonic_time ();
+      res = poll (&pfd, 1, now < end ? (end - now + 999) / 1000 : 0);
+    }
+  while (res < 0 && errno == EINTR);
+
+  /* Exits without running the atexit handlers, the statistics are the
+   * child's to print
+   */
+  if (res == 0)
+    {
+      g_printerr ("Not done after %u ms, finishing in the background\n", budget);
+      _exit (0);
+    }
+
+  while (waitpid (pid, &status, 0) < 0)
+    if (errno != EINTR)
+      _exit (1);
+  _exit (WIFEXITED (status) ? WEXITSTATUS (status) : 1);
+}
+
+/* Directory names are translated with the built-in tables, so no
+ * message catalog needs to be loaded.
+ */
+static void
+init_locale (void)
+{
+  setlocale (LC_ALL, "");
+}
+
+/* Nearly all runs at login don't change anything. Returns the stamp
+ * to save once updated if the fast path applies and something did
+ * change, NULL otherwise.
+ */
+static UserDirsStamp *
+check_stamp (gboolean *up_to_date)
+{
+  UserDirsStamp *stamp;
+
+  *up_to_date = FALSE;
+  if (arg_no_fastpath || !is_login_update ())
+    return NULL;
+
+  stamp = user_dirs_stamp_new (g_get_user_config_dir ());
+  user_dirs_stats_begin (USER_DIRS_PHASE_CHECK_STAMP);
+  *up_to_date = user_dirs_stamp_check (stamp);
+  user_dirs_stats_end (USER_DIRS_PHASE_CHECK_STAMP);
+  if (*up_to_date)
+    {
+      user_dirs_stamp_free (stamp);
+      return NULL;
+    }
+  return stamp;
+}
+
+/* Everything after the argument parsing and the stamp check, for the
+ * lock to be held around
+ */
+static int
+run_update (Job *job, UserDirsStamp *stamp, guint budget)
+{
+  Config *config;
+  GPtrArray *dir_paths;
+  gboolean res;
+
+  user_dirs_stats_begin (USER_DIRS_PHASE_INIT_LOCALE);
+  init_locale ();
+  user_dirs_stats_end (USER_DIRS_PHASE_INIT_LOCALE);
+
+  if (arg_batch)
+    return run_batch ();
+
+  config = config_new ();
+  user_dirs_stats_add_arena (config->arena);
+  user_dirs_stats_begin (USER_DIRS_PHASE_LOAD_ALL_CONFIGS);
+  load_all_configs (config, g_get_user_config_dir ());
+  user_dirs_stats_end (USER_DIRS_PHASE_LOAD_ALL_CONFIGS);
+
+  job->arena = user_dirs_arena_new ();
+  user_dirs_stats_add_arena (job->arena);
+  job->config = config;
+  job->home_dir = user_dirs_arena_strdup (job->arena, g_get_home_dir ());
+  job->config_home = user_dirs_arena_strdup (job->arena, g_get_user_config_dir ());
+  job->home_root = user_dirs_root_new (job->home_dir);
+  job->config_root = user_dirs_root_new (job->config_home);
+  job->user_dirs = user_dirs_table_new (job->arena);
+  job_set_locale (job, g_getenv ("LANGUAGE"), setlocale (LC_MESSAGES, NULL));
+  job->filename_converter = (iconv_t)(-1);
+
+  if (!open_filename_converter (job))
+    return 1;
+
+  /* Taken first, so that a plan is never older than what it saw */
+  if (arg_plan_file != NULL)
+    {
+      char *digest;
+
+      user_dirs_stats_count (USER_DIRS_OP_OPEN);
+      digest = user_dirs_plan_digest (get_user_config_file (job, "user-dirs.dirs"));
+      job->plan = user_dirs_plan_new (job->home_dir, digest);
+      g_free (digest);
+    }
+
+  user_dirs_stats_begin (USER_DIRS_PHASE_LOAD_USER_DIRS);
+  load_user_dirs (job);
+  user_dirs_stats_end (USER_DIRS_PHASE_LOAD_USER_DIRS);
+
+  if (arg_set_dir != NULL)
+    {
+      if (!set_one_directory (job, arg_set_dir, arg_set_value))
+        return 1;
+      if (arg_dummy_file == NULL)
+        save_snapshot (job);
+      return 0;
+    }
+
+  if (arg_apply_file != NULL)
+    {
+      if (config->enabled && !apply_plan (job, arg_apply_file))
+        return 1;
+      save_snapshot (job);
+      return 0;
+    }
+
+  /* default: update */
+  if (!config->enabled)
+    {
+      if (job->plan != NULL)
+        return save_plan (job) ? 0 : 1;
+      if (stamp)
+        user_dirs_stamp_save (stamp, NULL);
+      if (arg_watch)
+        {
+          unlock_config (FALSE, 0);
+          return run_watch (job);
+        }
+      return 0;
+    }
+
+  /* The last known good configuration, for the rest of the session
+   * to go on with while the directories are checked
+   */
+  if (budget > 0)
+    save_snapshot (job);
+
+  user_dirs_stats_begin (USER_DIRS_PHASE_LOAD_DEFAULT_DIRS);
+  res = load_default_dirs (config, job->config_home);
+  user_dirs_stats_end (USER_DIRS_PHASE_LOAD_DEFAULT_DIRS);
+  if (!res)
+    return 1;
+
+  if (!update_user_dirs (job))
+    return 1;
+
+  if (job->plan != NULL)
+    return save_plan (job) ? 0 : 1;
+
+  if (arg_watch)
+    {
+      unlock_config (FALSE, 0);
+      return run_watch (job);
+    }
+
+  if (arg_dummy_file == NULL)
+    save_snapshot (job);
+
+  if (stamp)
+    {
+      dir_paths = get_validated_dir_paths (job);
+      user_dirs_stamp_save (stamp, dir_paths);
+      g_ptr_array_free (dir_paths, TRUE);
+      user_dirs_stamp_free (stamp);
+    }
+
+  job_clear (job);
+  config_free (config);
+  log_allocation_stats ();
+
+  return 0;
+}
+
+int
+main (int argc, char *argv[])
+{
+  UserDirsStamp *stamp;
+  gboolean login_update, up_to_date;
+  guint budget = 0;
+  int res;
+  Job job = { NULL, };
+
+  parse_argv (argc, argv);
+
+  if (arg_stats)
+    {
+      user_dirs_stats_enable ();
+      atexit (print_stats);
+    }
+
+  if (arg_update_desktop_cache)
+    return update_desktop_cache ();
+
+  if (arg_env_generator)
+    return print_environment ();
+
+  /* Checked before parsing any configuration, even the time budget */
+  stamp = check_stamp (&up_to_date);
+  if (up_to_date)
+    return 0;
+
+  login_update = is_login_update ();
+  if (login_update)
+    {
+      budget = get_time_budget ();
+      if (budget > 0)
+        start_deadline (budget);
+    }
+
+  /* Runs that save user-dirs.dirs take turns */
+  if (!arg_batch && arg_dummy_file == NULL && arg_plan_file == NULL &&
+      !lock_config (g_get_user_config_dir (), login_update, &res))
+    return res;
+
+  /* Another run may have done the update while this one waited */
+  if (stamp != NULL)
+    {
+      user_dirs_stamp_free (stamp);
+      stamp = check_stamp (&up_to_date);
+      if (up_to_date)
+        {
+          unlock_config (FALSE, 0);
+          return 0;
+        }
+    }
+
+  /* Waiting login updates only take over the result of one that
+   * changed something, the others leave the lock file alone
+   */
+  res = run_update (&job, stamp, budget);
+  unlock_config (login_update && job.files_changed, res);
+  return res;
 }
@@ -0,0 +1,61 @@
+/*
+  This file is not licenced under the GPL like the rest of the code.
+  Its is under the MIT license, to encourage reuse.
+
+  Copyright (c) 2007 Red Hat, Inc.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation files
+  (the "Software"), to deal in the Software without restriction,
+  including without limitation the rights to use, copy, modify, merge,
+  publish, distribute, sublicense, and/or sell copies of the Software,
+  and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions: 
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software. 
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+  BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+  ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#ifndef __XDG_USER_DIRS_H__
+#define __XDG_USER_DIRS_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * XdgUserDirsFunc:
+ * @type: the directory type, e.g. "DESKTOP", or a desktop file id
+ * @path: the path of the directory
+ * @user_data: data passed to the function
+ *
+ * Called for each directory in the configuration.
+ **/
+typedef void (*XdgUserDirsFunc) (const char *type,
+                                 const char *path,
+                                 void       *user_data);
+
+char *xdg_user_dir_lookup               (const char      *type);
+char *xdg_user_dir_lookup_with_fallback (const char      *type,
+                                         const char      *fallback);
+void  xdg_user_dirs_foreach             (XdgUserDirsFunc  func,
+                                         void            *user_data);
+void  xdg_user_dirs_invalidate          (void);
+int   xdg_user_dirs_parse_file          (const char      *filename,
+                                         XdgUserDirsFunc  func,
+                                         void            *user_data);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __XDG_USER_DIRS_H__ */